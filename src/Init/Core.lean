@@ -150,6 +150,11 @@ protected def bind {α : Type u} {β : Type v} (x : Task α) (f : α → Task β
 
 end Task
 
+/-- Evaluate `x` in a separate task. If `x` has already been evaluated, the result is available immediately. -/
+@[noinline, extern "lean_thunk_get_async"]
+protected def Thunk.getAsync {α : Type u} (x : Thunk α) (prio := Task.Priority.default) : Task α :=
+  ⟨x.get⟩
+
 /- Some type that is not a scalar value in our runtime. -/
 structure NonScalar :=
   (val : Nat)
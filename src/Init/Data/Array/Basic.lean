@@ -648,14 +648,21 @@ partial def insertAtAux {α} (i : Nat) : Array α → Nat → Array α
       let as := as.swap! (j-1) j;
       insertAtAux i as (j-1)
 
+/--
+  Insert element `a` at position `i` without checking the index.
+  Pre: `i ≤ as.size`. The runtime primitive does not check it either, so this function must only be used
+  by `insertAt`. -/
+@[extern "lean_array_insert_at"]
+private def insertAtCore {α} (as : Array α) (i : @& Nat) (a : α) : Array α :=
+  let as := as.push a;
+  as.insertAtAux i as.size
+
 /--
   Insert element `a` at position `i`.
-  Pre: `i < as.size` -/
+  Pre: `i ≤ as.size` -/
 def insertAt {α} (as : Array α) (i : Nat) (a : α) : Array α :=
   if i > as.size then panic! "invalid index"
-  else
-    let as := as.push a;
-    as.insertAtAux i as.size
+  else insertAtCore as i a
 
 def toListLitAux {α : Type u} (a : Array α) (n : Nat) (hsz : a.size = n) : ∀ (i : Nat), i ≤ a.size → List α → List α
   | 0,     hi, acc => acc
@@ -44,6 +44,12 @@ def set! : ByteArray → (@& Nat) → UInt8 → ByteArray
 def isEmpty (s : ByteArray) : Bool :=
   s.size == 0
 
+/-- 64-bit hash code for the bytes in `a`. -/
+@[extern "lean_byte_array_hash"]
+protected constant hash (a : @& ByteArray) : UInt64
+
+instance : Hashable ByteArray := ⟨fun a => a.hash.toUSize⟩
+
 /--
   Copy the slice at `[srcOff, srcOff + len)` in `src` to `[destOff, destOff + len)` in `dest`, growing `dest` if necessary.
   If `exact` is `false`, the capacity will be doubled when grown. -/
@@ -60,6 +66,24 @@ protected def append (a : ByteArray) (b : ByteArray) : ByteArray :=
 
 instance : Append ByteArray := ⟨ByteArray.append⟩
 
+/-- Set the bytes at positions `[b, e)` to `v`. Positions past the end of `a` are ignored. -/
+@[extern "lean_byte_array_fill"]
+def fill (a : ByteArray) (b e : @& Nat) (v : UInt8) : ByteArray :=
+  (List.range (e - b)).foldl (fun a i => a.set! (b + i) v) a
+
+@[extern "lean_byte_array_beq"]
+protected def beq (a b : @& ByteArray) : Bool :=
+  a.data.toList == b.data.toList
+
+instance : BEq ByteArray := ⟨ByteArray.beq⟩
+
+instance : HasLess ByteArray :=
+  ⟨fun a b => a.data.toList < b.data.toList⟩
+
+@[extern "lean_byte_array_dec_lt"]
+instance decLt (a b : @& ByteArray) : Decidable (a < b) :=
+  List.hasDecidableLt a.data.toList b.data.toList
+
 partial def toList (bs : ByteArray) : List UInt8 :=
   let rec loop (i : Nat) (r : List UInt8) :=
     if i < bs.size then
@@ -76,6 +100,11 @@ partial def toList (bs : ByteArray) : List UInt8 :=
       none
   loop start
 
+/-- Position of the first occurrence of `v` at or after `start`. -/
+@[extern "lean_byte_array_index_of"]
+def indexOf? (a : @& ByteArray) (v : UInt8) (start : @& Nat := 0) : Option Nat :=
+  a.findIdx? (· == v) start
+
 end ByteArray
 
 def List.toByteArray (bs : List UInt8) : ByteArray :=
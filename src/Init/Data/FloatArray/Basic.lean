@@ -5,6 +5,7 @@ Author: Leonardo de Moura
 -/
 prelude
 import Init.Data.Array.Basic
+import Init.Data.Array.Subarray
 import Init.Data.Float
 import Init.Data.Option.Basic
 universes u
@@ -60,6 +61,42 @@ def set! : FloatArray → (@& Nat) → Float → FloatArray
 def isEmpty (s : FloatArray) : Bool :=
   s.size == 0
 
+/--
+  Copy the slice at `[srcOff, srcOff + len)` in `src` to `[destOff, destOff + len)` in `dest`, growing `dest` if necessary.
+  If `exact` is `false`, the capacity will be doubled when grown. -/
+@[extern "lean_float_array_copy_slice"]
+def copySlice (src : @& FloatArray) (srcOff : Nat) (dest : FloatArray) (destOff len : Nat) (exact : Bool := true) : FloatArray :=
+  ⟨dest.data.extract 0 destOff ++ src.data.extract srcOff len ++ dest.data.extract (destOff + len) dest.data.size⟩
+
+def extract (a : FloatArray) (b e : Nat) : FloatArray :=
+  a.copySlice b empty 0 (e - b)
+
+protected def append (a : FloatArray) (b : FloatArray) : FloatArray :=
+  b.copySlice 0 a a.size b.size false
+
+instance : Append FloatArray := ⟨FloatArray.append⟩
+
+/-- Apply `f` to every element. The update is destructive if `a` is not shared. -/
+@[inline] partial def map (f : Float → Float) (a : FloatArray) : FloatArray :=
+  let rec @[specialize] loop (a : FloatArray) (i : Nat) :=
+    if i < a.size then
+      loop (a.set! i (f (a.get! i))) (i+1)
+    else
+      a
+  loop a 0
+
+/--
+  Sum of the elements. The native implementation uses four partial sums,
+  so the rounding may differ from a sequential `foldl`. -/
+@[extern "lean_float_array_sum"]
+def sum (a : @& FloatArray) : Float :=
+  a.data.foldl (· + ·) 0
+
+/-- Dot product of `a` and `b`. Extra elements in the longer array are ignored. -/
+@[extern "lean_float_array_dot"]
+def dot (a b : @& FloatArray) : Float :=
+  (a.data.zipWith b.data (· * ·)).foldl (· + ·) 0
+
 partial def toList (ds : FloatArray) : List Float :=
   let rec loop (i r) :=
     if h : i < ds.size then
@@ -8,6 +8,19 @@ import Init.Data.UInt
 import Init.Data.String
 universes u
 
+instance : Hashable Substring := ⟨fun s => s.hash64.toUSize⟩
+
+/--
+  Wrapper for hashing strings using `String.hash64` instead of `String.hash`, e.g., `Std.HashMap String.Hash64 α`.
+  The default `Hashable String` instance cannot use `String.hash64` since the hash codes of names and literals
+  are stored in .olean files. -/
+structure String.Hash64 :=
+  (val : String)
+
+instance : BEq String.Hash64 := ⟨fun s₁ s₂ => s₁.val == s₂.val⟩
+
+instance : Hashable String.Hash64 := ⟨fun s => s.val.hash64.toUSize⟩
+
 instance : Hashable Nat := {
   hash := fun n => USize.ofNat n
 }
@@ -25,4 +25,44 @@ constant fromUTF8Unchecked (a : @& ByteArray) : String
 @[extern "lean_string_to_utf8"]
 constant toUTF8 (a : @& String) : ByteArray
 
+/-- 64-bit hash code for `s`. It is faster than `String.hash`, but the result must not be stored in .olean files. -/
+@[extern "lean_string_hash64"]
+protected constant hash64 (s : @& String) : UInt64
+
+/-- Return `true` iff `a` is a properly UTF-8 encoded string. -/
+@[extern "lean_string_validate_utf8"]
+constant validateUTF8 (a : @& ByteArray) : Bool
+
+def fromUTF8? (a : ByteArray) : Option String :=
+  if validateUTF8 a then some (fromUTF8Unchecked a) else none
+
+partial def findSubstrAux (s pattern : String) (i : Pos) : Option Pos :=
+  if i + pattern.bsize > s.bsize then none
+  else if s.extract i (i + pattern.bsize) == pattern then some i
+  else findSubstrAux s pattern (s.next i)
+
+/--
+  Return the position of the first occurrence of `pattern` in `s` at or after `start`.
+  The runtime implementation uses SIMD instructions when available. -/
+@[extern "lean_string_find_substr"]
+def findSubstr (s : @& String) (pattern : @& String) (start : @& Pos := 0) : Option Pos :=
+  if pattern.isEmpty then
+    if start ≤ s.bsize then some start else none
+  else
+    findSubstrAux s pattern start
+
+/-- Split `s` at line breaks. Both `"\n"` and `"\r\n"` are accepted. -/
+@[extern "lean_string_lines"]
+def lines (s : @& String) : List String :=
+  (s.splitOn "\n").map fun l => if !l.isEmpty && l.back == '\r' then l.dropRight 1 else l
+
 end String
+
+namespace Substring
+
+/-- 64-bit hash code for `s.toString`. -/
+@[extern "lean_substring_hash64"]
+protected def hash64 (s : @& Substring) : UInt64 :=
+  s.toString.hash64
+
+end Substring
@@ -148,6 +148,9 @@ instance : Div UInt32       := ⟨UInt32.div⟩
 constant UInt32.shiftLeft (a b : UInt32) : UInt32 := (arbitrary Nat).toUInt32
 @[extern c inline "#1 >> #2"]
 constant UInt32.shiftRight (a b : UInt32) : UInt32 := (arbitrary Nat).toUInt32
+/- Number of bits set in `a`. -/
+@[extern "lean_uint32_popcount"]
+constant UInt32.popcount (a : UInt32) : UInt32 := (arbitrary Nat).toUInt32
 
 @[extern "lean_uint64_of_nat"]
 def UInt64.ofNat (n : @& Nat) : UInt64 := ⟨Fin.ofNat n⟩
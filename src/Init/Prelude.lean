@@ -1326,6 +1326,8 @@ constant mixHash (u₁ u₂ : USize) : USize
 @[extern "lean_string_hash"]
 protected constant String.hash (s : @& String) : USize
 
+/- Remark: the hash codes of `Name`s and literals are stored in .olean files, and we must not change this instance.
+   See `String.Hash64` for a faster hash function. -/
 instance : Hashable String := ⟨String.hash⟩
 
 namespace Lean
@@ -1349,7 +1351,7 @@ namespace Name
 
 @[export lean_name_mk_string]
 def mkStr (p : Name) (s : String) : Name :=
-  Name.str p s (mixHash (hash p) (hash s))
+  Name.str p s (mixHash (hash p) (String.hash s))
 
 @[export lean_name_mk_numeral]
 def mkNum (p : Name) (v : Nat) : Name :=
@@ -131,6 +131,12 @@ inductive FS.Mode
 
 constant FS.Handle : Type := Unit
 
+/--
+  A buffered handle for a file descriptor. In contrast to `FS.Handle`, it supports reading into preallocated
+  buffers (`FdHandle.readToByteArray`) and positional reads and writes (`FdHandle.pread` and `FdHandle.pwrite`)
+  that may be executed concurrently. -/
+constant FS.FdHandle : Type := Unit
+
 /--
   A pure-Lean abstraction of POSIX streams. We use `Stream`s for the standard streams stdin/stdout/stderr so we can
   capture output of `#eval` commands into memory. -/
@@ -179,6 +185,20 @@ def fopenFlags (m : FS.Mode) (b : Bool) : String :=
 @[extern "lean_io_prim_handle_get_line"] constant Handle.getLine (h : @& Handle) : IO String
 @[extern "lean_io_prim_handle_put_str"] constant Handle.putStr (h : @& Handle) (s : @& String) : IO Unit
 
+@[extern "lean_io_prim_fd_handle_mk"] constant FdHandle.mk (s : @& String) (mode : Mode) : IO FdHandle
+@[extern "lean_io_prim_fd_handle_is_eof"] constant FdHandle.isEof (h : @& FdHandle) : IO Bool
+@[extern "lean_io_prim_fd_handle_flush"] constant FdHandle.flush (h : @& FdHandle) : IO Unit
+@[extern "lean_io_prim_fd_handle_read"] constant FdHandle.read (h : @& FdHandle) (bytes : USize) : IO ByteArray
+@[extern "lean_io_prim_fd_handle_read_to_byte_array"]
+constant FdHandle.readToByteArray (h : @& FdHandle) (buf : ByteArray) (bytes : USize) : IO ByteArray
+@[extern "lean_io_prim_fd_handle_write"] constant FdHandle.write (h : @& FdHandle) (buffer : @& ByteArray) : IO Unit
+@[extern "lean_io_prim_fd_handle_get_line"] constant FdHandle.getLine (h : @& FdHandle) : IO String
+@[extern "lean_io_prim_fd_handle_put_str"] constant FdHandle.putStr (h : @& FdHandle) (s : @& String) : IO Unit
+@[extern "lean_io_prim_fd_handle_pread"] constant FdHandle.pread (h : @& FdHandle) (offset : UInt64) (bytes : USize) : IO ByteArray
+@[extern "lean_io_prim_fd_handle_pwrite"] constant FdHandle.pwrite (h : @& FdHandle) (offset : UInt64) (buffer : @& ByteArray) : IO Unit
+
+@[extern "lean_io_prim_mmap"] constant mmap (fname : @& String) : IO ByteArray
+
 @[extern "lean_io_getenv"] constant getEnv (var : @& String) : IO (Option String)
 @[extern "lean_io_realpath"] constant realPath (fname : String) : IO String
 @[extern "lean_io_is_dir"] constant isDir (fname : @& String) : IO Bool
@@ -241,6 +261,40 @@ partial def lines (fname : String) : m (Array String) := do
       pure $ lines.push line
   read #[]
 
+/--
+  Return the contents of the file `fname` as a byte array backed by a memory-mapped region.
+  The file contents are loaded on demand, and the region is unmapped when the array is deallocated.
+  Destructive updates to the array are not written back to the file.
+  The behavior is undefined if the file is truncated while the array is alive. -/
+def mmap (fname : String) : m ByteArray := liftIO (Prim.mmap fname)
+
+def FdHandle.mk (s : String) (mode : Mode) : m FdHandle := liftIO (Prim.FdHandle.mk s mode)
+def FdHandle.isEof : FdHandle → m Bool := liftIO ∘ Prim.FdHandle.isEof
+def FdHandle.flush : FdHandle → m Unit := liftIO ∘ Prim.FdHandle.flush
+def FdHandle.read (h : FdHandle) (bytes : Nat) : m ByteArray := liftIO (Prim.FdHandle.read h (USize.ofNat bytes))
+/--
+  Append at most `bytes` bytes read from `h` to `buf`. Fewer bytes are appended only at the end of the file.
+  The bytes are read directly into `buf` if it is not shared and has enough capacity. -/
+def FdHandle.readToByteArray (h : FdHandle) (buf : ByteArray) (bytes : Nat) : m ByteArray :=
+  liftIO (Prim.FdHandle.readToByteArray h buf (USize.ofNat bytes))
+def FdHandle.write (h : FdHandle) (s : ByteArray) : m Unit := liftIO (Prim.FdHandle.write h s)
+def FdHandle.getLine : FdHandle → m String := liftIO ∘ Prim.FdHandle.getLine
+def FdHandle.putStr (h : FdHandle) (s : String) : m Unit := liftIO (Prim.FdHandle.putStr h s)
+def FdHandle.putStrLn (h : FdHandle) (s : String) : m Unit := h.putStr (s.push '\n')
+/-- Read at most `bytes` bytes starting at `offset`. The file position is not used or modified. -/
+def FdHandle.pread (h : FdHandle) (offset : UInt64) (bytes : Nat) : m ByteArray :=
+  liftIO (Prim.FdHandle.pread h offset (USize.ofNat bytes))
+/-- Write `s` at `offset`. The file position is not used or modified. -/
+def FdHandle.pwrite (h : FdHandle) (offset : UInt64) (s : ByteArray) : m Unit :=
+  liftIO (Prim.FdHandle.pwrite h offset s)
+
+/-- Asynchronous version of `FdHandle.pread`. The read is executed on a dedicated thread. -/
+def FdHandle.preadAsync (h : FdHandle) (offset : UInt64) (bytes : Nat) : IO (Task (Except IO.Error ByteArray)) :=
+  IO.asTask (h.pread offset bytes) Task.Priority.dedicated
+
+/-- Asynchronous version of `FdHandle.pwrite`. The write is executed on a dedicated thread. -/
+def FdHandle.pwriteAsync (h : FdHandle) (offset : UInt64) (s : ByteArray) : IO (Task (Except IO.Error Unit)) :=
+  IO.asTask (h.pwrite offset s) Task.Priority.dedicated
 
 namespace Stream
 
@@ -417,6 +471,15 @@ def ofHandle (h : Handle) : Stream := {
   putStr  := Prim.Handle.putStr h,
 }
 
+def ofFdHandle (h : FdHandle) : Stream := {
+  isEof   := Prim.FdHandle.isEof h,
+  flush   := Prim.FdHandle.flush h,
+  read    := Prim.FdHandle.read h,
+  write   := Prim.FdHandle.write h,
+  getLine := Prim.FdHandle.getLine h,
+  putStr  := Prim.FdHandle.putStr h,
+}
+
 structure Buffer :=
   (data : ByteArray := ByteArray.empty)
   (pos : Nat := 0)
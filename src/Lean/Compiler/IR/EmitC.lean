@@ -7,14 +7,18 @@ import Lean.Runtime
 import Lean.Compiler.NameMangling
 import Lean.Compiler.ExportAttr
 import Lean.Compiler.InitAttr
+import Lean.Compiler.Specialize
 import Lean.Compiler.IR.CompilerM
 import Lean.Compiler.IR.EmitUtil
 import Lean.Compiler.IR.NormIds
 import Lean.Compiler.IR.SimpCase
 import Lean.Compiler.IR.Boxing
+import Lean.Compiler.IR.UnboxResult
+import Lean.Compiler.IR.StaticData
 
 namespace Lean.IR.EmitC
 open ExplicitBoxing (requiresBoxedVersion mkBoxedName isBoxedName)
+open UnboxResult (isUnboxedName)
 
 def leanMainFn := "_lean_main"
 
@@ -22,18 +26,32 @@ structure Context :=
   (env        : Environment)
   (modName    : Name)
   (jpMap      : JPParamsMap := {})
+  (varMap     : VarTypeMap := {})
   (mainFn     : FunId := arbitrary _)
   (mainParams : Array Param := #[])
+  /- Module declarations to be emitted, see `UnboxResult.unboxResults`. -/
+  (decls      : List Decl := [])
+  /- Auxiliary `_unboxed` declarations. They are not stored in the environment. -/
+  (auxDecls   : NameMap Decl := {})
+  /- Nullary declarations that are emitted as static data, see `StaticData.lean`. -/
+  (staticData : NameMap StaticData.Value := {})
 
 abbrev M := ReaderT Context (EStateM String String)
 
 def getEnv : M Environment := Context.env <$> read
 def getModName : M Name := Context.modName <$> read
+def getModuleDecls : M (List Decl) := Context.decls <$> read
+def isStaticData (n : Name) : M Bool := do
+  let ctx ← read
+  pure (ctx.staticData.contains n)
 def getDecl (n : Name) : M Decl := do
-  let env ← getEnv
-  match findEnvDecl env n with
+  let ctx ← read
+  match findEnvDecl ctx.env n with
   | some d => pure d
-  | none   => throw s!"unknown declaration '{n}'"
+  | none   =>
+    match ctx.auxDecls.find? n with
+    | some d => pure d
+    | none   => throw s!"unknown declaration '{n}'"
 
 @[inline] def emit {α : Type} [ToString α] (a : α) : M Unit :=
   modify fun out => out ++ toString a
@@ -52,6 +70,17 @@ def argToCString (x : Arg) : String :=
 def emitArg (x : Arg) : M Unit :=
   emit (argToCString x)
 
+def toCStructName (tys : Array IRType) : String :=
+  tys.foldl (init := "lean_struct") fun s ty => s ++ "_" ++
+    match ty with
+    | IRType.float  => "d"
+    | IRType.uint8  => "u8"
+    | IRType.uint16 => "u16"
+    | IRType.uint32 => "u32"
+    | IRType.uint64 => "u64"
+    | IRType.usize  => "usize"
+    | _             => "o"
+
 def toCType : IRType → String
   | IRType.float      => "double"
   | IRType.uint8      => "uint8_t"
@@ -62,7 +91,7 @@ def toCType : IRType → String
   | IRType.object     => "lean_object*"
   | IRType.tobject    => "lean_object*"
   | IRType.irrelevant => "lean_object*"
-  | IRType.struct _ _ => panic! "not implemented yet"
+  | IRType.struct _ tys => toCStructName tys
   | IRType.union _ _  => panic! "not implemented yet"
 
 def throwInvalidExportName {α : Type} (n : Name) : M α :=
@@ -72,7 +101,10 @@ def toCName (n : Name) : M String := do
   let env ← getEnv;
   -- TODO: we should support simple export names only
   match getExportNameFor env n with
-  | some (Name.str Name.anonymous s _) => pure s
+  | some (Name.str Name.anonymous s _) =>
+    -- See `LEAN_SHARED_SPEC` in `lean.h`
+    if Compiler.isSharedSpecialization env n then pure ("LEAN_SHARED_SPEC(" ++ s ++ ", " ++ n.mangle ++ ")")
+    else pure s
   | some _                             => throwInvalidExportName n
   | none                               => if n == `main then pure leanMainFn else pure n.mangle
 
@@ -94,6 +126,7 @@ def emitFnDeclAux (decl : Decl) (cppBaseName : String) (addExternForConsts : Boo
   let ps := decl.params
   let env ← getEnv
   if ps.isEmpty && addExternForConsts then emit "extern "
+  if isUnboxedName decl.name then emit "static "
   emit (toCType decl.resultType ++ " " ++ cppBaseName)
   unless ps.isEmpty do
     emit "("
@@ -120,7 +153,7 @@ def emitExternDeclAux (decl : Decl) (cNameStr : String) : M Unit := do
 
 def emitFnDecls : M Unit := do
   let env ← getEnv
-  let decls := getDecls env
+  let decls ← getModuleDecls
   let modDecls  : NameSet := decls.foldl (fun s d => s.insert d.name) {}
   let usedDecls : NameSet := decls.foldl (fun s d => collectUsedDecls env d (s.insert d.name)) {}
   let usedDecls := usedDecls.toList
@@ -128,7 +161,7 @@ def emitFnDecls : M Unit := do
     let decl ← getDecl n;
     match getExternNameFor env `c decl.name with
     | some cName => emitExternDeclAux decl cName
-    | none       => emitFnDecl decl (!modDecls.contains n)
+    | none       => unless (← isStaticData n) do emitFnDecl decl (!modDecls.contains n)
 
 def emitMainFn : M Unit := do
   let d ← getDecl `main
@@ -360,8 +393,21 @@ def emitReuse (z : VarId) (x : VarId) (c : CtorInfo) (updtHeader : Bool) (ys : A
   emitLn "}";
   emitCtorSetArgs z ys
 
+def isStructVar (x : VarId) : M Bool := do
+  let ctx ← read
+  match ctx.varMap.find? x with
+  | some t => pure t.isStruct
+  | none   => pure false
+
+def emitStructCtor (z : VarId) (ys : Array Arg) : M Unit :=
+  ys.size.forM fun i => do
+    emit z; emit ".f"; emit i; emit " = "; emitArg ys[i]; emitLn ";"
+
 def emitProj (z : VarId) (i : Nat) (x : VarId) : M Unit := do
-  emitLhs z; emit "lean_ctor_get("; emit x; emit ", "; emit i; emitLn ");"
+  if (← isStructVar x) then
+    emitLhs z; emit x; emit ".f"; emit i; emitLn ";"
+  else
+    emitLhs z; emit "lean_ctor_get("; emit x; emit ", "; emit i; emitLn ");"
 
 def emitUProj (z : VarId) (i : Nat) (x : VarId) : M Unit := do
   emitLhs z; emit "lean_ctor_get_usize("; emit x; emit ", "; emit i; emitLn ");"
@@ -489,7 +535,7 @@ def emitLit (z : VarId) (t : IRType) (v : LitVal) : M Unit := do
 
 def emitVDecl (z : VarId) (t : IRType) (v : Expr) : M Unit :=
   match v with
-  | Expr.ctor c ys      => emitCtor z c ys
+  | Expr.ctor c ys      => if t.isStruct then emitStructCtor z ys else emitCtor z c ys
   | Expr.reset n x      => emitReset z n x
   | Expr.reuse x c u ys => emitReuse z x c u ys
   | Expr.proj i x       => emitProj z i x
@@ -626,13 +672,15 @@ end
 def emitDeclAux (d : Decl) : M Unit := do
   let env ← getEnv
   let (vMap, jpMap) := mkVarJPMaps d
-  withReader (fun ctx => { ctx with jpMap := jpMap }) do
-  unless hasInitAttr env d.name do
+  withReader (fun ctx => { ctx with jpMap := jpMap, varMap := vMap }) do
+  unless hasInitAttr env d.name || (← isStaticData d.name) do
     match d with
     | Decl.fdecl f xs t b =>
       let baseName ← toCName f;
-      if xs.size == 0 then
+      if xs.size == 0 || isUnboxedName f then
         emit "static "
+      else if Compiler.isSharedSpecialization env f then
+        emit "LEAN_WEAK "
       emit (toCType t); emit " ";
       if xs.size > 0 then
         emit baseName;
@@ -648,6 +696,9 @@ def emitDeclAux (d : Decl) : M Unit := do
       else
         emit ("_init_" ++ baseName ++ "()")
       emitLn " {";
+      if xs.size > 0 then
+        -- Call counter, it is only active if the C code is compiled with `-DLEAN_CALL_PROFILE`. See `lean.h`.
+        emit "LEAN_PROFILE_CALL("; emit (quoteString (toString f)); emitLn ");"
       if xs.size > closureMaxArgs && isBoxedName d.name then
         xs.size.forM fun i => do
           let x := xs[i]
@@ -665,8 +716,7 @@ def emitDecl (d : Decl) : M Unit := do
     throw s!"{err}\ncompiling:\n{d}"
 
 def emitFns : M Unit := do
-  let env ← getEnv;
-  let decls := getDecls env;
+  let decls ← getModuleDecls
   decls.reverse.forM emitDecl
 
 def emitMarkPersistent (d : Decl) (n : Name) : M Unit := do
@@ -682,7 +732,7 @@ def emitDeclInit (d : Decl) : M Unit := do
     emit "res = "; emitCName n; emitLn "(lean_io_mk_world());"
     emitLn "if (lean_io_result_is_error(res)) return res;"
     emitLn "lean_dec_ref(res);"
-  else if d.params.size == 0 then
+  else if d.params.size == 0 && !(← isStaticData n) then
     match getInitFnNameFor? env d.name with
     | some initFn =>
       emit "res = "; emitCName initFn; emitLn "(lean_io_mk_world());"
@@ -712,9 +762,110 @@ def emitInitFn : M Unit := do
   decls.reverse.forM emitDeclInit
   emitLns ["return lean_io_result_mk_ok(lean_box(0));", "}"]
 
+/- Emit the C `struct` types used to return unboxed values, see `UnboxResult.lean`. -/
+def emitStructTypes : M Unit := do
+  let ctx ← read
+  let tys := ctx.auxDecls.fold (init := #[]) fun (tys : Array (Array IRType)) _ d =>
+    match d.resultType with
+    | IRType.struct _ fieldTys => if tys.any (fun tys => toCStructName tys == toCStructName fieldTys) then tys else tys.push fieldTys
+    | _                        => tys
+  tys.forM fun tys => do
+    emit "typedef struct { "
+    tys.size.forM fun i => do
+      emit (toCType tys[i]); emit " f"; emit i; emit "; "
+    emitLn ("} " ++ toCStructName tys ++ ";")
+
+/- Quote the UTF-8 encoding of `s` as a C string literal. We use octal escape sequences since, unlike `\x`,
+   they have a fixed number of digits. -/
+def quoteBytes (s : String) : String :=
+  let q := s.toUTF8.data.foldl (init := "\"") fun (q : String) (b : UInt8) =>
+    let n := b.toNat
+    /- `?` is escaped to avoid trigraphs. -/
+    if n ≥ 32 && n < 127 && n != 34 && n != 92 && n != 63 then q.push (Char.ofNat n)
+    else q ++ "\\" ++ toString (n / 64) ++ toString (n / 8 % 8) ++ toString (n % 8)
+  q ++ "\""
+
+namespace EmitStatic
+
+structure State :=
+  (ptrs : NameMap String := {})
+  (next : Nat := 0)
+
+abbrev EmitM := StateT State M
+
+def mkObjName (baseName : String) : EmitM String := do
+  let s ← get
+  set { s with next := s.next + 1 }
+  pure ("_data_" ++ baseName ++ "_" ++ toString s.next)
+
+def toObjPtr (objName : String) : String :=
+  "(lean_object*)&" ++ objName
+
+/- Emit the objects of `v` as static data, and return a C expression for its `lean_object*` value. -/
+partial def emitValue (baseName : String) : StaticData.Value → EmitM String
+  | StaticData.Value.scalar n => pure ("(lean_object*)(size_t)" ++ toString (2*n + 1))
+  | StaticData.Value.ref c => do
+    let s ← get
+    pure (s.ptrs.findD c "NULL")
+  | StaticData.Value.str str => do
+    let objName ← mkObjName baseName
+    let size := str.utf8ByteSize + 1
+    emitLn ("static struct { lean_object m_header; size_t m_size; size_t m_capacity; size_t m_length; char m_data[" ++ toString size ++ "]; } " ++
+      objName ++ " = { LEAN_STATIC_OBJECT_HEADER(1, LeanString, 0), " ++ toString size ++ ", " ++ toString size ++ ", " ++ toString str.length ++ ", " ++
+      quoteBytes str ++ " };")
+    pure (toObjPtr objName)
+  | StaticData.Value.ctor c args => do
+    let args ← args.mapM (emitValue baseName)
+    let objName ← mkObjName baseName
+    let n := toString args.size
+    emitLn ("static struct { lean_object m_header; lean_object * m_objs[" ++ n ++ "]; } " ++ objName ++
+      " = { LEAN_STATIC_OBJECT_HEADER(sizeof(lean_ctor_object) + sizeof(void*)*" ++ n ++ ", " ++ toString c.cidx ++ ", " ++ n ++ "), { " ++
+      ", ".intercalate args.toList ++ " } };")
+    pure (toObjPtr objName)
+  | StaticData.Value.array elems => do
+    let elems ← elems.mapM (emitValue baseName)
+    let objName ← mkObjName baseName
+    let n := toString elems.size
+    if elems.isEmpty then
+      emitLn ("static lean_array_object " ++ objName ++ " = { LEAN_STATIC_OBJECT_HEADER(1, LeanArray, 0), 0, 0 };")
+    else
+      emitLn ("static struct { lean_object m_header; size_t m_size; size_t m_capacity; lean_object * m_data[" ++ n ++ "]; } " ++ objName ++
+        " = { LEAN_STATIC_OBJECT_HEADER(1, LeanArray, 0), " ++ n ++ ", " ++ n ++ ", { " ++ ", ".intercalate elems.toList ++ " } };")
+    pure (toObjPtr objName)
+
+partial def collectRefs : StaticData.Value → Array Name → Array Name
+  | StaticData.Value.ref c,     cs => cs.push c
+  | StaticData.Value.ctor _ vs, cs => vs.foldl (fun cs v => collectRefs v cs) cs
+  | StaticData.Value.array vs,  cs => vs.foldl (fun cs v => collectRefs v cs) cs
+  | _,                          cs => cs
+
+/- Emit the static constant `c`. The constants it references are emitted first. -/
+partial def emitConst (c : Name) : EmitM Unit := do
+  let ctx ← read
+  let s ← get
+  match ctx.staticData.find? c with
+  | some v =>
+    unless s.ptrs.contains c do
+      (collectRefs v #[]).forM emitConst
+      let baseName ← toCName c
+      modify fun s => { s with next := 0 }
+      let ptr ← emitValue baseName v
+      emitLn ("lean_object* " ++ baseName ++ " = " ++ ptr ++ ";")
+      modify fun s => { s with ptrs := s.ptrs.insert c ptr }
+  | none => pure ()
+
+end EmitStatic
+
+def emitStaticData : M Unit := do
+  let decls ← getModuleDecls
+  /- We emit the constants in the order they were declared to make the generated code easier to read. -/
+  (decls.reverse.forM fun d => EmitStatic.emitConst d.name).run' {}
+
 def main : M Unit := do
   emitFileHeader
+  emitStructTypes
   emitFnDecls
+  emitStaticData
   emitFns
   emitInitFn
   emitMainFnIfNeeded
@@ -723,8 +874,10 @@ def main : M Unit := do
 end EmitC
 
 @[export lean_ir_emit_c]
-def emitC (env : Environment) (modName : Name) : Except String String :=
-  match (EmitC.main { env := env, modName := modName }).run "" with
+def emitC (env : Environment) (opts : Options) (modName : Name) : Except String String :=
+  let (decls, auxDecls) := UnboxResult.unboxResults env (getDecls env)
+  let staticData := StaticData.getStaticValues env opts decls
+  match (EmitC.main { env := env, modName := modName, decls := decls, auxDecls := auxDecls, staticData := staticData }).run "" with
   | EStateM.Result.ok    _   s => Except.ok s
   | EStateM.Result.error err _ => Except.error err
 
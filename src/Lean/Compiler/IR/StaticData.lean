@@ -0,0 +1,157 @@
+/-
+Copyright (c) 2020 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+Authors: agent
+-/
+import Std.Data.HashMap
+import Lean.Compiler.InitAttr
+import Lean.Compiler.IR.CompilerM
+
+namespace Lean.IR.StaticData
+/-
+Closed terms (e.g., the `_closed` constants produced by `extract_closed`) are usually initialized by the module
+initializer, and then marked as persistent. For constants whose value can be computed at compile time,
+the C code generator emits the objects as static data instead. They use the `LEAN_OTHER_MEM_KIND` memory kind
+(see `LEAN_STATIC_OBJECT_HEADER`), and are never stored in the heap.
+
+We currently support strings, small natural numbers, constructor objects without scalar fields, arrays built using
+`Array.mkEmpty` and `Array.push`, boxed `UInt8` and `UInt16` values, and references to other static constants in the
+same module. Constants from other modules are only copied when their value is a string or an empty array.
+The option `compiler.static_data` can be used to disable this feature. -/
+
+def staticDataOptionName : Name := `compiler.static_data
+
+/- Natural numbers that are represented using `lean_box` on all platforms. -/
+def maxSmallNat : Nat := 2^31
+
+/- `#[a_1, ..., a_n]` produces a closed term for each prefix `#[a_1, ..., a_i]`.
+   We bound the size of static arrays to avoid a quadratic blowup in the size of the generated code. -/
+def maxArraySize : Nat := 256
+
+inductive Value
+  | scalar (n : Nat)
+  | str (s : String)
+  | ctor (c : CtorInfo) (args : Array Value)
+  | array (elems : Array Value)
+  /- Reference to a static constant in the current module. -/
+  | ref (c : Name)
+
+instance : Inhabited Value := ⟨Value.scalar 0⟩
+
+structure State :=
+  (modDecls : NameMap Decl := {})
+  (values   : NameMap (Option Value) := {})
+  (foreign  : NameMap (Option Value) := {})
+
+abbrev M := ReaderT Environment (StateM State)
+
+def isCandidate (env : Environment) : Decl → Bool
+  | Decl.fdecl f xs t _ => xs.isEmpty && t.isObj && !hasInitAttr env f
+  | _                   => false
+
+/- Return the value of a static constant of the current module, following references. -/
+partial def deref (s : State) : Value → Value
+  | Value.ref c =>
+    match s.values.find? c with
+    | some (some v) => deref s v
+    | _             => Value.ref c
+  | v => v
+
+def isForeignCopyable : Value → Bool
+  | Value.str _   => true
+  | Value.array a => a.isEmpty
+  | _             => false
+
+def evalArg (ctx : Std.HashMap VarId Value) : Arg → Option Value
+  | Arg.var x      => ctx.find? x
+  | Arg.irrelevant => some (Value.scalar 0)
+
+mutual
+
+partial def evalConst (c : Name) : M (Option Value) := do
+  let s ← get
+  match s.modDecls.find? c with
+  | some d =>
+    match s.values.find? c with
+    | some v => pure (v.map fun _ => Value.ref c)
+    | none   =>
+      /- Mark `c` as visited before evaluating its body. -/
+      modify fun s => { s with values := s.values.insert c none }
+      let v ← evalDecl d
+      modify fun s => { s with values := s.values.insert c v }
+      pure (v.map fun _ => Value.ref c)
+  | none =>
+    match s.foreign.find? c with
+    | some v => pure v
+    | none   => do
+      modify fun s => { s with foreign := s.foreign.insert c none }
+      let env ← read
+      let v ← match findEnvDecl env c with
+        | some d => evalDecl d
+        | none   => pure none
+      /- The value of a foreign constant is copied. Thus, it must not contain references to its own module. -/
+      let v := match v with
+        | some v => if isForeignCopyable v then some v else none
+        | none   => none
+      modify fun s => { s with foreign := s.foreign.insert c v }
+      pure v
+
+partial def evalDecl (d : Decl) : M (Option Value) := do
+  let env ← read
+  if isCandidate env d then
+    match d with
+    | Decl.fdecl _ _ _ b => evalFnBody {} b
+    | _                  => pure none
+  else
+    pure none
+
+partial def evalExpr (ctx : Std.HashMap VarId Value) (t : IRType) : Expr → M (Option Value)
+  | Expr.lit (LitVal.str s) => pure (some (Value.str s))
+  | Expr.lit (LitVal.num n) =>
+    pure $ if t.isObj && n ≥ maxSmallNat then none else some (Value.scalar n)
+  | Expr.ctor c ys =>
+    if c.usize != 0 || c.ssize != 0 then pure none
+    else if c.size == 0 then pure (some (Value.scalar c.cidx))
+    else pure (Value.ctor c <$> ys.mapM (evalArg ctx))
+  | Expr.box ty x =>
+    if ty == IRType.uint8 || ty == IRType.uint16 then pure (ctx.find? x) else pure none
+  | Expr.fap c ys =>
+    if ys.isEmpty then evalConst c
+    else if c == `Array.mkEmpty && ys.size == 2 then pure (some (Value.array #[]))
+    else if c == `Array.push && ys.size == 3 then do
+      let s ← get
+      match (ys[1] : Arg), (ys[2] : Arg) with
+      | Arg.var a, Arg.var x =>
+        match (ctx.find? a).map (deref s), ctx.find? x with
+        | some (Value.array as), some v =>
+          pure $ if as.size < maxArraySize then some (Value.array (as.push v)) else none
+        | _, _ => pure none
+      | _, _ => pure none
+    else pure none
+  | _ => pure none
+
+partial def evalFnBody (ctx : Std.HashMap VarId Value) : FnBody → M (Option Value)
+  | FnBody.vdecl x t e b => do
+    match (← evalExpr ctx t e) with
+    | some v => evalFnBody (ctx.insert x v) b
+    | none   => pure none
+  | FnBody.inc _ _ _ _ b => evalFnBody ctx b
+  | FnBody.dec _ _ _ _ b => evalFnBody ctx b
+  | FnBody.mdata _ b     => evalFnBody ctx b
+  | FnBody.ret x         => pure (evalArg ctx x)
+  | _                    => pure none
+
+end
+
+/- Return the values of the nullary declarations in `decls` that can be emitted as static data. -/
+def getStaticValues (env : Environment) (opts : Options) (decls : List Decl) : NameMap Value :=
+  if !opts.getBool staticDataOptionName true then {}
+  else
+    let modDecls := decls.foldl (fun (m : NameMap Decl) d => if isCandidate env d then m.insert d.name d else m) {}
+    let act : M Unit := decls.forM fun d => do let _ ← evalConst d.name; pure ()
+    let (_, s) := (act.run env).run { modDecls := modDecls }
+    s.values.fold (fun (r : NameMap Value) c v => match v with
+      | some v => if modDecls.contains c then r.insert c v else r
+      | none   => r) {}
+
+end Lean.IR.StaticData
@@ -4,7 +4,11 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Authors: Leonardo de Moura
 -/
 import Lean.Data.Format
+import Lean.Compiler.InitAttr
 import Lean.Compiler.IR.Basic
+import Lean.Compiler.IR.FreeVars
+import Lean.Compiler.IR.NormIds
+import Lean.Compiler.IR.Boxing
 
 namespace Lean.IR.UnboxResult
 
@@ -20,4 +24,441 @@ builtin_initialize unboxAttr : TagAttribute ←
 def hasUnboxAttr (env : Environment) (n : Name) : Bool :=
 unboxAttr.hasTag env n
 
+/-
+Small constructor objects containing only scalar values (e.g., `Float × Float`, or a structure with two `UInt64` fields)
+are returned using `struct` values instead of heap allocated objects.
+
+This transformation is applied by the C code generator on the final IR. Given an eligible function `f`,
+we produce an auxiliary function `f._unboxed` that returns a `struct` containing the (unboxed) fields, and
+`f` becomes a wrapper that allocates the constructor object using the result of `f._unboxed`.
+Calls to `f` in the same module are replaced with calls to `f._unboxed` when the caller only projects the fields of the result.
+Functions in other modules, closures, and the IR interpreter keep using `f`. Thus, `f._unboxed` is not part of the ABI,
+and it is emitted as a `static` C function.
+
+A function `f` is eligible if each `ret x` in its body is of one of the following forms
+1- `x` is a constructor application that is only initialized (using `sset`) and returned, and whose object fields are
+   boxed scalar values that are not used anywhere else.
+2- `x := g ys` where `g` is an eligible function in the same module that returns the same kind of `struct`.
+-/
+
+/- Location of a field in the constructor object. -/
+inductive FieldLoc
+  /- Boxed scalar value stored at `proj[i]`. -/
+  | obj (i : Nat)
+  /- Scalar value stored at `sset[n, offset]` -/
+  | scalar (n : Nat) (offset : Nat)
+
+namespace FieldLoc
+
+def beq : FieldLoc → FieldLoc → Bool
+  | obj i₁,         obj i₂         => i₁ == i₂
+  | scalar n₁ o₁,   scalar n₂ o₂   => n₁ == n₂ && o₁ == o₂
+  | _,              _              => false
+
+instance : BEq FieldLoc := ⟨beq⟩
+
+instance : Inhabited FieldLoc := ⟨obj 0⟩
+
+end FieldLoc
+
+instance : Inhabited IRType := ⟨IRType.irrelevant⟩
+
+structure Shape :=
+  (ctor   : CtorInfo)
+  (fields : Array (FieldLoc × IRType))
+
+namespace Shape
+
+def beq (s₁ s₂ : Shape) : Bool :=
+  s₁.ctor == s₂.ctor && Array.isEqv s₁.fields s₂.fields fun f₁ f₂ => f₁.1 == f₂.1 && f₁.2 == f₂.2
+
+instance : BEq Shape := ⟨beq⟩
+
+def type (s : Shape) : IRType :=
+  IRType.struct (some s.ctor.name.getPrefix) (s.fields.map Prod.snd)
+
+def findField? (s : Shape) (loc : FieldLoc) : Option Nat :=
+  s.fields.findIdx? fun f => f.1 == loc
+
+end Shape
+
+def scalarSize : IRType → Nat
+  | IRType.uint8  => 1
+  | IRType.uint16 => 2
+  | IRType.uint32 => 4
+  | _             => 8
+
+/- Size of the C `struct` with fields `tys`. -/
+def structSize (tys : Array IRType) : Nat :=
+  let align (n : Nat) (a : Nat) := (n + a - 1) / a * a
+  let (size, maxAlign) := tys.foldl (init := (0, 1)) fun (size, maxAlign) ty =>
+    let sz := scalarSize ty
+    (align size sz + sz, if sz > maxAlign then sz else maxAlign)
+  align size maxAlign
+
+/- We only unbox results that fit in two registers in the x86-64 and AArch64 calling conventions. -/
+def maxStructSize := 16
+
+def mkUnboxedName (n : Name) : Name :=
+  Name.mkStr n "_unboxed"
+
+def isUnboxedName : Name → Bool
+  | Name.str _ "_unboxed" _ => true
+  | _                       => false
+
+/- How a variable is used in a function body. -/
+inductive Use
+  | proj (x : VarId) (i : Nat)                                   -- `let x := proj[i] y`
+  | sproj (x : VarId) (n : Nat) (offset : Nat) (ty : IRType)     -- `let x : ty := sproj[n, offset] y`
+  | unbox (x : VarId) (ty : IRType)                              -- `let x : ty := unbox y`
+  | sset (n : Nat) (offset : Nat) (z : VarId) (ty : IRType)      -- `sset y[n, offset] : ty := z`
+  | ret
+  | inc
+  | dec
+  | other
+
+instance : Inhabited Use := ⟨Use.other⟩
+
+structure UseInfo :=
+  (decls : Std.HashMap VarId (IRType × Expr) := {})
+  (uses  : Std.HashMap VarId (Array Use) := {})
+  (rets  : Array Arg := #[])
+
+
+namespace Use
+
+def isDec : Use → Bool
+  | dec => true
+  | _   => false
+
+end Use
+
+namespace CollectUses
+
+abbrev M := StateM UseInfo
+
+def addUse (x : VarId) (u : Use) : M Unit :=
+  modify fun s => { s with uses := s.uses.insert x ((s.uses.findD x #[]).push u) }
+
+/- Register `Use.other` for all free variables in the instruction `b`. -/
+def addOtherUses (b : FnBody) : M Unit :=
+  b.freeIndices.fold (init := pure ()) fun k idx => k *> addUse { idx := idx } Use.other
+
+def collectVDecl (x : VarId) (t : IRType) (e : Expr) : M Unit := do
+  modify fun s => { s with decls := s.decls.insert x (t, e) }
+  match e with
+  | Expr.proj i y    => addUse y (Use.proj x i)
+  | Expr.sproj n o y => addUse y (Use.sproj x n o t)
+  | Expr.unbox y     => addUse y (Use.unbox x t)
+  | _                => addOtherUses (FnBody.vdecl x t e FnBody.nil)
+
+partial def collectFnBody : FnBody → M Unit
+  | FnBody.vdecl x t e b       => do collectVDecl x t e; collectFnBody b
+  | FnBody.jdecl _ _ v b       => do collectFnBody v; collectFnBody b
+  | FnBody.sset x n o y t b    => do addUse x (Use.sset n o y t); addUse y Use.other; collectFnBody b
+  | FnBody.inc x _ _ _ b       => do addUse x Use.inc; collectFnBody b
+  | FnBody.dec x _ _ _ b       => do addUse x Use.dec; collectFnBody b
+  | FnBody.case _ x _ alts     => do addUse x Use.other; alts.forM fun alt => collectFnBody alt.body
+  | FnBody.ret (Arg.var x)     => do addUse x Use.ret; modify fun s => { s with rets := s.rets.push (Arg.var x) }
+  | FnBody.ret x               => modify fun s => { s with rets := s.rets.push x }
+  | b =>
+    if b.isTerminal then addOtherUses b
+    else do
+      let (instr, b) := b.split
+      addOtherUses instr
+      collectFnBody b
+
+end CollectUses
+
+def collectUses (b : FnBody) : UseInfo :=
+  ((CollectUses.collectFnBody b).run {}).2
+
+def UseInfo.getUses (info : UseInfo) (x : VarId) : Array Use :=
+  info.uses.findD x #[]
+
+/- Return site of a function. -/
+inductive RetSite
+  | ctor (s : Shape)
+  | call (g : Name)
+
+private def getBoxedField? (info : UseInfo) (i : Nat) : Arg → Option (FieldLoc × IRType)
+  | Arg.var y =>
+    match info.decls.find? y with
+    | some (_, Expr.box ty _) =>
+      /- The boxed value must only be used to initialize the constructor object. -/
+      if (info.getUses y).size == 1 then some (FieldLoc.obj i, ty) else none
+    | _ => none
+  | _ => none
+
+private def getScalarFields? (c : CtorInfo) (uses : Array Use) : Option (Array (FieldLoc × IRType)) :=
+  uses.foldlM (init := #[]) fun fields u =>
+    match u with
+    | Use.sset n o _ ty =>
+      if n == c.size && !fields.any (fun f => f.1 == FieldLoc.scalar n o) then some (fields.push (FieldLoc.scalar n o, ty))
+      else none
+    | Use.ret => some fields
+    | _       => none
+
+private def getOffset : FieldLoc × IRType → Nat
+  | (FieldLoc.scalar _ o, _) => o
+  | _                        => 0
+
+/- Return the shape of `x` if it is a constructor object that is only initialized and returned. -/
+def getCtorShape? (info : UseInfo) (x : VarId) : Option Shape :=
+  match info.decls.find? x with
+  | some (_, Expr.ctor c ys) =>
+    if c.usize != 0 || c.isScalar then none
+    else do
+      let objFields ← (List.range ys.size).mapM fun i => getBoxedField? info i ys[i]
+      let scalarFields ← getScalarFields? c (info.getUses x)
+      let scalarFields := scalarFields.qsort fun f₁ f₂ => getOffset f₁ < getOffset f₂
+      let fields := objFields.toArray ++ scalarFields
+      /- Make sure all scalar fields have been initialized. -/
+      if scalarFields.foldl (fun n f => n + scalarSize f.2) 0 != c.ssize then none
+      else if structSize (fields.map Prod.snd) > maxStructSize then none
+      else some { ctor := c, fields := fields }
+  | _ => none
+
+def getRetSite? (info : UseInfo) : Arg → Option RetSite
+  | Arg.var x =>
+    match info.decls.find? x with
+    | some (_, Expr.ctor _ _) => RetSite.ctor <$> getCtorShape? info x
+    | some (_, Expr.fap g _)  => if (info.getUses x).size == 1 then some (RetSite.call g) else none
+    | _                       => none
+  | _ => none
+
+def getRetSites? (env : Environment) : Decl → Option (Array RetSite)
+  | Decl.fdecl f xs t b =>
+    if xs.size == 0 || !t.isObj || ExplicitBoxing.isBoxedName f || hasInitAttr env f then none
+    else
+      let info := collectUses b
+      if info.rets.isEmpty then none
+      else info.rets.mapM (getRetSite? info)
+  | _ => none
+
+private def getSiteShape? (shapes : NameMap Shape) : RetSite → Option Shape
+  | RetSite.ctor s => some s
+  | RetSite.call g => shapes.find? g
+
+private def isCompatibleSite (shapes : NameMap Shape) (s : Shape) (site : RetSite) : Bool :=
+  match getSiteShape? shapes site with
+  | some s' => s == s'
+  | none    => false
+
+private partial def assignShapes (sites : NameMap (Array RetSite)) (shapes : NameMap Shape) : NameMap Shape :=
+  let shapes' := sites.fold (init := shapes) fun shapes f fSites =>
+    if shapes.contains f then shapes
+    else match fSites.findSome? (getSiteShape? shapes) with
+      | some s => shapes.insert f s
+      | none   => shapes
+  if shapes'.size == shapes.size then shapes else assignShapes sites shapes'
+
+private partial def checkShapes (sites : NameMap (Array RetSite)) (shapes : NameMap Shape) : NameMap Shape :=
+  let shapes' := sites.fold (init := shapes) fun shapes' f fSites =>
+    match shapes.find? f with
+    | some s => if fSites.all (isCompatibleSite shapes s) then shapes' else shapes'.erase f
+    | none   => shapes'
+  if shapes'.size == shapes.size then shapes else checkShapes sites shapes'
+
+/- Compute the eligible functions. We first assign a shape to each function using its return sites,
+   and then we remove functions containing return sites that are not compatible with their shapes
+   until we reach a fixpoint. -/
+def getShapes (sites : NameMap (Array RetSite)) : NameMap Shape :=
+  checkShapes sites (assignShapes sites {})
+
+namespace MkUnboxed
+
+structure Context :=
+  (sType    : IRType)
+  (ctor     : CtorInfo)
+  /- Variables that are only used to build the result constructor object. -/
+  (dropped  : VarIdSet)
+  /- Returned constructor objects, and the fields of the new `struct` value. -/
+  (retCtors : Std.HashMap VarId (Array Arg))
+  /- `let x := g ys; ret x` where `g` is eligible. -/
+  (retCalls : VarIdSet)
+
+partial def visitFnBody (ctx : Context) : FnBody → FnBody
+  | FnBody.vdecl x t e b =>
+    if ctx.dropped.contains x then visitFnBody ctx b
+    else match e with
+      | Expr.fap g ys =>
+        if ctx.retCalls.contains x then FnBody.vdecl x ctx.sType (Expr.fap (mkUnboxedName g) ys) (visitFnBody ctx b)
+        else FnBody.vdecl x t e (visitFnBody ctx b)
+      | _ => FnBody.vdecl x t e (visitFnBody ctx b)
+  | FnBody.sset x i o y t b =>
+    if ctx.dropped.contains x then visitFnBody ctx b else FnBody.sset x i o y t (visitFnBody ctx b)
+  | FnBody.jdecl j xs v b        => FnBody.jdecl j xs (visitFnBody ctx v) (visitFnBody ctx b)
+  | FnBody.case tid x xType alts => FnBody.case tid x xType (alts.map fun alt => alt.modifyBody (visitFnBody ctx))
+  | b@(FnBody.ret (Arg.var x))   =>
+    match ctx.retCtors.find? x with
+    | some zs => FnBody.vdecl x ctx.sType (Expr.ctor ctx.ctor zs) b
+    | none    => b
+  | b =>
+    if b.isTerminal then b
+    else let (instr, b) := b.split; instr.setBody (visitFnBody ctx b)
+
+private def getFieldValue (info : UseInfo) (x : VarId) (ys : Array Arg) : FieldLoc → Arg
+  | FieldLoc.obj i =>
+    match ys[i] with
+    | Arg.var y =>
+      match info.decls.find? y with
+      | some (_, Expr.box _ z) => Arg.var z
+      | _                      => Arg.irrelevant -- unreachable
+    | _ => Arg.irrelevant -- unreachable
+  | FieldLoc.scalar n o =>
+    let z? := (info.getUses x).findSome? fun u => match u with
+      | Use.sset n' o' z _ => if n == n' && o == o' then some z else none
+      | _                  => none
+    match z? with
+    | some z => Arg.var z
+    | none   => Arg.irrelevant -- unreachable
+
+def mkContext (shapes : NameMap Shape) (info : UseInfo) (s : Shape) : Context :=
+  info.rets.foldl (init := { sType := s.type, ctor := s.ctor, dropped := {}, retCtors := {}, retCalls := {} }) fun ctx x =>
+    match x with
+    | Arg.var x =>
+      match info.decls.find? x with
+      | some (_, Expr.ctor _ ys) =>
+        let dropped := ys.foldl (init := ctx.dropped.insert x) fun dropped y =>
+          match y with
+          | Arg.var y => dropped.insert y
+          | _         => dropped
+        let zs := s.fields.map fun f => getFieldValue info x ys f.1
+        { ctx with dropped := dropped, retCtors := ctx.retCtors.insert x zs }
+      | some (_, Expr.fap g _) =>
+        if shapes.contains g then { ctx with retCalls := ctx.retCalls.insert x } else ctx
+      | _ => ctx
+    | _ => ctx
+
+end MkUnboxed
+
+/- Create `f._unboxed` using the body `b` of the eligible function `f`. -/
+def mkUnboxedDecl (shapes : NameMap Shape) (f : FunId) (xs : Array Param) (b : FnBody) (s : Shape) : Decl :=
+  let ctx := MkUnboxed.mkContext shapes (collectUses b) s
+  Decl.fdecl (mkUnboxedName f) xs s.type (MkUnboxed.visitFnBody ctx b)
+
+/- Create the wrapper `f` that boxes the result of `f._unboxed`. -/
+def mkWrapperDecl (d : Decl) (s : Shape) : Decl :=
+  let next := d.maxIndex + 1
+  let r : VarId := { idx := next }
+  let fieldVar (j : Nat) : VarId := { idx := next + 1 + j }
+  let boxedVar (j : Nat) : VarId := { idx := next + 1 + s.fields.size + j }
+  let obj : VarId := { idx := next + 1 + 2 * s.fields.size }
+  let bs := #[FnBody.vdecl r s.type (Expr.fap (mkUnboxedName d.name) (d.params.map fun p => Arg.var p.x)) FnBody.nil]
+  let (bs, objArgs, ssets) := s.fields.size.fold (init := (bs, #[], #[])) fun j (bs, objArgs, ssets) =>
+    let (loc, ty) := s.fields[j]
+    let bs := bs.push (FnBody.vdecl (fieldVar j) ty (Expr.proj j r) FnBody.nil)
+    match loc with
+    | FieldLoc.obj _ =>
+      (bs.push (FnBody.vdecl (boxedVar j) IRType.object (Expr.box ty (fieldVar j)) FnBody.nil), objArgs.push (Arg.var (boxedVar j)), ssets)
+    | FieldLoc.scalar n o =>
+      (bs, objArgs, ssets.push (FnBody.sset obj n o (fieldVar j) ty FnBody.nil))
+  let bs := bs.push (FnBody.vdecl obj d.resultType (Expr.ctor s.ctor objArgs) FnBody.nil)
+  Decl.fdecl d.name d.params d.resultType (reshape (bs ++ ssets) (FnBody.ret (Arg.var obj)))
+
+namespace UnboxCalls
+
+structure Context :=
+  /- `let r := g ys` where `g` is eligible, and the new type of `r`. -/
+  (unboxed : Std.HashMap VarId IRType)
+  /- Projections `x` of unboxed results `r`, and the corresponding `struct` field. -/
+  (fields  : Std.HashMap VarId (VarId × Nat))
+
+/- Return `(x, j)` if the use `u` of a result with shape `s` is the projection `x` of the `struct` field `j`.
+   The projections of boxed fields must only be unboxed. -/
+private def getField? (info : UseInfo) (s : Shape) (u : Use) : Option (VarId × Nat) :=
+  match u with
+  | Use.proj x i =>
+    match s.findField? (FieldLoc.obj i) with
+    | some j =>
+      let ty := s.fields[j].2
+      let isUnboxUse (u : Use) : Bool := match u with
+        | Use.unbox _ ty' => ty == ty'
+        | Use.inc         => true
+        | Use.dec         => true
+        | _               => false
+      if (info.getUses x).all isUnboxUse then some (x, j) else none
+    | none => none
+  | Use.sproj x n o ty =>
+    match s.findField? (FieldLoc.scalar n o) with
+    | some j => if s.fields[j].2 == ty then some (x, j) else none
+    | none   => none
+  | _ => none
+
+def mkContext (shapes : NameMap Shape) (info : UseInfo) : Context :=
+  info.decls.fold (init := { unboxed := {}, fields := {} }) fun ctx r (_, e) =>
+    match e with
+    | Expr.fap g _ =>
+      match shapes.find? g with
+      | some s =>
+        let uses    := info.getUses r
+        let rFields := uses.filterMap (getField? info s)
+        if rFields.size + (uses.filter Use.isDec).size != uses.size then ctx
+        else {
+          unboxed := ctx.unboxed.insert r s.type,
+          fields  := rFields.foldl (init := ctx.fields) fun fields (x, j) => fields.insert x (r, j) }
+      | none => ctx
+    | _ => ctx
+
+partial def visitFnBody (ctx : Context) : FnBody → FnBody
+  | FnBody.vdecl x t e b =>
+    match e with
+    | Expr.fap g ys =>
+      match ctx.unboxed.find? x with
+      | some sType => FnBody.vdecl x sType (Expr.fap (mkUnboxedName g) ys) (visitFnBody ctx b)
+      | none       => FnBody.vdecl x t e (visitFnBody ctx b)
+    | Expr.proj _ y =>
+      if ctx.unboxed.contains y then visitFnBody ctx b else FnBody.vdecl x t e (visitFnBody ctx b)
+    | Expr.sproj _ _ y =>
+      if ctx.unboxed.contains y then
+        match ctx.fields.find? x with
+        | some (r, j) => FnBody.vdecl x t (Expr.proj j r) (visitFnBody ctx b)
+        | none        => FnBody.vdecl x t e (visitFnBody ctx b) -- unreachable
+      else FnBody.vdecl x t e (visitFnBody ctx b)
+    | Expr.unbox y =>
+      match ctx.fields.find? y with
+      | some (r, j) => FnBody.vdecl x t (Expr.proj j r) (visitFnBody ctx b)
+      | none        => FnBody.vdecl x t e (visitFnBody ctx b)
+    | _ => FnBody.vdecl x t e (visitFnBody ctx b)
+  | FnBody.inc x n c p b =>
+    if ctx.fields.contains x then visitFnBody ctx b else FnBody.inc x n c p (visitFnBody ctx b)
+  | FnBody.dec x n c p b =>
+    if ctx.fields.contains x || ctx.unboxed.contains x then visitFnBody ctx b else FnBody.dec x n c p (visitFnBody ctx b)
+  | FnBody.jdecl j xs v b        => FnBody.jdecl j xs (visitFnBody ctx v) (visitFnBody ctx b)
+  | FnBody.case tid x xType alts => FnBody.case tid x xType (alts.map fun alt => alt.modifyBody (visitFnBody ctx))
+  | b =>
+    if b.isTerminal then b
+    else let (instr, b) := b.split; instr.setBody (visitFnBody ctx b)
+
+end UnboxCalls
+
+/- Replace `let r := g ys` with `let r : struct := g._unboxed ys` when `g` is eligible and `r` is only projected. -/
+def unboxCalls (shapes : NameMap Shape) (b : FnBody) : FnBody :=
+  let ctx := UnboxCalls.mkContext shapes (collectUses b)
+  if ctx.unboxed.isEmpty then b else UnboxCalls.visitFnBody ctx b
+
+/- Return the module declarations that must be emitted, and the new auxiliary `_unboxed` declarations.
+   The order of `decls` is preserved, and `f._unboxed` is inserted after `f`. -/
+def unboxResults (env : Environment) (decls : List Decl) : List Decl × NameMap Decl :=
+  let decls := decls.map Decl.normalizeIds
+  let sites : NameMap (Array RetSite) := decls.foldl (init := {}) fun sites d =>
+    match getRetSites? env d with
+    | some ss => sites.insert d.name ss
+    | none    => sites
+  let shapes := getShapes sites
+  if shapes.isEmpty then (decls, {})
+  else decls.foldr (init := ([], {})) fun d (decls, auxDecls) =>
+    match d with
+    | Decl.fdecl f xs t b =>
+      match shapes.find? f with
+      | some s =>
+        let aux := mkUnboxedDecl shapes f xs b s
+        let aux := match aux with
+          | Decl.fdecl g ys u c => Decl.fdecl g ys u (unboxCalls shapes c)
+          | other               => other
+        (mkWrapperDecl d s :: aux :: decls, auxDecls.insert aux.name aux)
+      | none => (Decl.fdecl f xs t (unboxCalls shapes b) :: decls, auxDecls)
+    | d => (d :: decls, auxDecls)
+
 end Lean.IR.UnboxResult
@@ -5,6 +5,7 @@ Authors: Leonardo de Moura
 -/
 import Lean.Attributes
 import Lean.Compiler.Util
+import Lean.Compiler.ExportAttr
 
 namespace Lean.Compiler
 
@@ -67,10 +68,13 @@ structure SpecInfo :=
 structure SpecState :=
   (specInfo : SMap Name SpecInfo := {})
   (cache    : SMap Expr Name := {})
+  /- Specializations emitted using a content-addressed C symbol. See `addSharedSpecialization`. -/
+  (shared   : NameSet := {})
 
 inductive SpecEntry
   | info (name : Name) (info : SpecInfo)
   | cache (key : Expr) (fn : Name)
+  | shared (fn : Name)
 
 namespace SpecState
 
@@ -80,9 +84,10 @@ def addEntry (s : SpecState) (e : SpecEntry) : SpecState :=
   match e with
   | SpecEntry.info name info => { s with specInfo := s.specInfo.insert name info }
   | SpecEntry.cache key fn   => { s with cache    := s.cache.insert key fn }
+  | SpecEntry.shared fn      => { s with shared   := s.shared.insert fn }
 
 def switch : SpecState → SpecState
-  | ⟨m₁, m₂⟩ => ⟨m₁.switch, m₂.switch⟩
+  | ⟨m₁, m₂, s⟩ => ⟨m₁.switch, m₂.switch, s⟩
 
 end SpecState
 
@@ -109,4 +114,19 @@ def cacheSpecialization (env : Environment) (e : Expr) (fn : Name) : Environment
 def getCachedSpecialization (env : Environment) (e : Expr) : Option Name :=
   (specExtension.getState env).cache.find? e
 
+/--
+  Use the content-addressed C symbol `sym` for the specialization `fn`.
+  `sym` is computed from the specialization cache key. Thus, modules that do not import each other
+  produce the same symbol for equivalent specializations, and `EmitC` emits them as weak symbols
+  that are merged by the linker.
+  We use the `export` attribute to set the C symbol. Recall that exported functions do not
+  participate in borrow inference. So, all copies of a shared specialization have the same calling convention. -/
+@[export lean_add_shared_specialization]
+def addSharedSpecialization (env : Environment) (fn : Name) (sym : Name) : Except String Environment := do
+  let env ← exportAttr.setParam env fn sym
+  pure $ specExtension.addEntry env (SpecEntry.shared fn)
+
+def isSharedSpecialization (env : Environment) (fn : Name) : Bool :=
+  (specExtension.getState env).shared.contains fn
+
 end Lean.Compiler
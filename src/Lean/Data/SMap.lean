@@ -9,7 +9,7 @@ universes u v w w'
 
 namespace Lean
 
-open Std (HashMap PHashMap)
+open Std (HashMap PHashMap mkHashMap)
 
 /- Staged map for implementing the Environment. The idea is to store
    imported entries into a hashtable and local entries into a persistent hashtable.
@@ -38,6 +38,9 @@ variables {α : Type u} {β : Type v} [BEq α] [Hashable α]
 instance : Inhabited (SMap α β) := ⟨{}⟩
 def empty : SMap α β := {}
 
+/- Empty map where `capacity` entries can be inserted in stage 1 without resizing the hashtable. -/
+def mkEmpty (capacity : Nat) : SMap α β := { map₁ := mkHashMap capacity }
+
 @[specialize] def insert : SMap α β → α → β → SMap α β
   | ⟨true, m₁, m₂⟩, k, v  => ⟨true, m₁.insert k v, m₂⟩
   | ⟨false, m₁, m₂⟩, k, v => ⟨false, m₁, m₂.insert k v⟩
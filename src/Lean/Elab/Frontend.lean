@@ -94,4 +94,14 @@ def runFrontend (input : String) (opts : Options) (fileName : String) (mainModul
   let s ← IO.processCommands inputCtx parserState (Command.mkState env messages opts)
   pure (s.commandState.env, s.commandState.messages.toList, { header := header, commands := s.commands })
 
+/- Similar to `runFrontend`, but `env` must be the result of importing the header of `input`.
+   It is used by `lean --daemon` to reuse imported environments. -/
+@[export lean_run_frontend_with_env]
+def runFrontendWithEnv (env : Environment) (input : String) (opts : Options) (fileName : String) (mainModuleName : Name) : IO (Environment × List Message × Module) := do
+  let inputCtx := Parser.mkInputContext input fileName
+  let (header, parserState, messages) ← Parser.parseHeader inputCtx
+  let env := env.setMainModule mainModuleName
+  let s ← IO.processCommands inputCtx parserState (Command.mkState env messages opts)
+  pure (s.commandState.env, s.commandState.messages.toList, { header := header, commands := s.commands })
+
 end Lean.Elab
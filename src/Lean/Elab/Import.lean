@@ -36,10 +36,20 @@ def parseImportsExport (input : String) (fileName : Option String) : IO (List Im
   let (imports, pos, log) ← parseImports input fileName
   pure (imports, pos, log.toList)
 
+@[export lean_find_oleans]
+def findOLeans (deps : List Import) : IO (List String) :=
+  deps.mapM fun dep => findOLean dep.module
+
 @[export lean_print_deps]
 def printDeps (deps : List Import) : IO Unit := do
-  for dep in deps do
-    let fname ← findOLean dep.module;
+  for fname in (← findOLeans deps) do
     IO.println fname
 
+/- Return the .olean files of all modules imported by `env`. -/
+@[export lean_get_imported_olean_files]
+def getImportedOLeanFiles (env : Environment) : IO (List String) :=
+  env.allImportedModuleNames.foldM (init := []) fun fnames mod => do
+    let fname ← findOLean mod
+    pure (fname :: fnames)
+
 end Lean.Elab
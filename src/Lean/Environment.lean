@@ -48,7 +48,7 @@ structure EnvironmentHeader :=
   (regions      : Array CompactedRegion := #[]) -- compacted regions of all imported modules
   (moduleNames  : NameSet      := {})  -- names of all imported modules
 
-open Std (HashMap)
+open Std (HashMap mkHashMap)
 
 structure Environment :=
   (const2ModIdx : HashMap Name ModuleIdx)
@@ -429,8 +429,10 @@ structure ModuleData :=
 instance : Inhabited ModuleData :=
   ⟨{imports := arbitrary _, constants := arbitrary _, entries := arbitrary _}⟩
 
-@[extern 3 "lean_save_module_data"]
-constant saveModuleData (fname : @& String) (m : ModuleData) : IO Unit
+/- Write `m` to the .olean file `fname`. If `compress` is `true`, the compressed container format is used,
+   see the option `olean.compress`. -/
+@[extern 4 "lean_save_module_data"]
+constant saveModuleData (fname : @& String) (m : ModuleData) (compress : Bool := false) : IO Unit
 @[extern 2 "lean_read_module_data"]
 constant readModuleData (fname : @& String) : IO (ModuleData × CompactedRegion)
 
@@ -472,8 +474,8 @@ def mkModuleData (env : Environment) : IO ModuleData := do
   }
 
 @[export lean_write_module]
-def writeModule (env : Environment) (fname : String) : IO Unit := do
-  let modData ← mkModuleData env; saveModuleData fname modData
+def writeModule (env : Environment) (fname : String) (compress : Bool := false) : IO Unit := do
+  let modData ← mkModuleData env; saveModuleData fname modData compress
 
 partial def importModulesAux : List Import → (NameSet × Array ModuleData × Array CompactedRegion) → IO (NameSet × Array ModuleData × Array CompactedRegion)
   | [],    r         => pure r
@@ -491,20 +493,21 @@ partial def importModulesAux : List Import → (NameSet × Array ModuleData × A
       let regions := regions.push region
       importModulesAux is (s, mods, regions)
 
-private partial def getEntriesFor (mod : ModuleData) (extId : Name) (i : Nat) : Array EnvExtensionEntry :=
-  if i < mod.entries.size then
-    let curr := mod.entries.get! i;
-    if curr.1 == extId then curr.2 else getEntriesFor mod extId (i+1)
-  else
-    #[]
-
 private def setImportedEntries (env : Environment) (mods : Array ModuleData) : IO Environment := do
   let mut env := env
   let pExtDescrs ← persistentEnvExtensionsRef.get
-  for mod in mods do
-    for extDescr in pExtDescrs do
-      let entries := getEntriesFor mod extDescr.name 0
-      env ← extDescr.toEnvExtension.modifyState env fun s => { s with importedEntries := s.importedEntries.push entries }
+  /- Each extension stores an array of entries for every imported module, and most of them are empty.
+     We allocate these arrays upfront, and then visit only the entries stored in each module. -/
+  let mut extNameIdx : HashMap Name Nat := {}
+  for i in [:pExtDescrs.size] do
+    let extDescr := pExtDescrs[i]
+    extNameIdx := extNameIdx.insert extDescr.name i
+    env ← extDescr.toEnvExtension.modifyState env fun s => { s with importedEntries := mkArray mods.size #[] }
+  for modIdx in [:mods.size] do
+    for (extName, entries) in mods[modIdx].entries do
+      match extNameIdx.find? extName with
+      | some i => env ← pExtDescrs[i].toEnvExtension.modifyState env fun s => { s with importedEntries := s.importedEntries.set! modIdx entries }
+      | none   => pure ()
   return env
 
 private def finalizePersistentExtensions (env : Environment) (opts : Options) : IO Environment := do
@@ -520,8 +523,10 @@ private def finalizePersistentExtensions (env : Environment) (opts : Options) :
 def importModules (imports : List Import) (opts : Options) (trustLevel : UInt32 := 0) : IO Environment := profileitIO "import" ⟨0, 0⟩ do
   let (moduleNames, mods, regions) ← importModulesAux imports ({}, #[], #[])
   let mut modIdx : Nat := 0
-  let mut const2ModIdx : HashMap Name ModuleIdx := {}
-  let mut constants : ConstMap := SMap.empty
+  /- We know how many constants are going to be inserted, and allocate enough buckets to avoid rehashing. -/
+  let numConsts := mods.foldl (fun numConsts mod => numConsts + mod.constants.size) 0
+  let mut const2ModIdx : HashMap Name ModuleIdx := mkHashMap (nbuckets := numConsts)
+  let mut constants : ConstMap := SMap.mkEmpty numConsts
   for mod in mods do
     for cinfo in mod.constants do
       const2ModIdx := const2ModIdx.insert cinfo.name modIdx
@@ -16,7 +16,7 @@ instance : Inhabited Literal := ⟨Literal.natVal 0⟩
 
 protected def Literal.hash : Literal → USize
   | Literal.natVal v => hash v
-  | Literal.strVal v => hash v
+  | Literal.strVal v => String.hash v
 
 instance : Hashable Literal := ⟨Literal.hash⟩
 
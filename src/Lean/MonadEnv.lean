@@ -94,7 +94,8 @@ def getConstInfoRec (constName : Name) : m RecursorVal := do
       | _ => failK ()
 
 def addDecl [MonadOptions m] (decl : Declaration) : m Unit := do
-  match (← getEnv).addDecl decl with
+  let env ← getEnv
+  match profileit "type checking" ⟨0, 0⟩ fun _ => env.addDecl decl with
   | Except.ok    env => setEnv env
   | Except.error ex  => throwKernelException ex
 
@@ -53,6 +53,7 @@ def modPathToFilePath : Name → String
   | Name.anonymous              => ""
   | Name.num p _ _              => panic! "ill-formed import"
 
+@[export lean_find_olean]
 def findOLean (mod : Name) : IO String := do
   let sp ← searchPathRef.get
   let pkg := mod.getRoot.toString
@@ -0,0 +1,258 @@
+/-
+Copyright (c) 2020 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+Authors: agent
+-/
+namespace Std
+universes u v w
+
+/-
+Open addressing hash map using the "Swiss table" layout.
+The slots are split into groups of `FlatHashMapImp.groupSize` consecutive entries. Each slot has a control byte in `ctrl`:
+`ctrlEmpty`, `ctrlDeleted`, or the 7 low bits of the hash code of the key stored in the slot.
+Lookups probe whole groups at a time by comparing their control bytes against the 7-bit tag of the key
+(using SSE2 when available, see `lean_flat_hash_map_match`), and only compare keys for matching tags.
+Keys and values are boxed objects stored directly in the arrays `keys` and `vals`, and free slots contain `lean_box(0)`.
+Thus, unlike `HashMap`, there is no cons cell per entry, and updates are performed in place when the map is not shared. -/
+structure FlatHashMapImp (α : Type u) (β : Type v) :=
+  (size : Nat)
+  /- Number of full and deleted slots. -/
+  (used : Nat)
+  (ctrl : ByteArray)
+  (keys : Array α)
+  (vals : Array β)
+
+namespace FlatHashMapImp
+variables {α : Type u} {β : Type v}
+
+def groupSize : Nat := 16
+def ctrlEmpty : UInt8 := 0x80
+def ctrlDeleted : UInt8 := 0xfe
+
+/- Return `n` control bytes set to `ctrlEmpty`. -/
+@[extern "lean_flat_hash_map_mk_ctrl"]
+constant mkCtrl (n : @& Nat) : ByteArray
+
+/- Return an array of size `n` filled with `lean_box(0)`. The elements must not be accessed before they are set. -/
+@[extern "lean_flat_hash_map_mk_slots"]
+constant mkSlots {α : Type u} (n : @& Nat) : Array α
+
+/- Return `a` with the slot `i` set to `lean_box(0)`. -/
+@[extern "lean_flat_hash_map_clear_slot"]
+constant clearSlot {α : Type u} (a : Array α) (i : @& Nat) : Array α
+
+/- Return a bitmask of the slots of group `g` whose control byte is `c` in the low 16 bits, and a bitmask of its empty slots
+   in the high 16 bits. -/
+@[extern "lean_flat_hash_map_match"]
+constant matchGroup (ctrl : @& ByteArray) (g : USize) (c : UInt8) : UInt32
+
+/- Return a bitmask of the empty and deleted slots of group `g`. -/
+@[extern "lean_flat_hash_map_match_free"]
+constant matchFree (ctrl : @& ByteArray) (g : USize) : UInt32
+
+/- Index of the least significant bit set in `bits`. -/
+@[inline] def lowestBit (bits : UInt32) : USize :=
+  ((bits.land (0 - bits)) - 1).popcount.toUSize
+
+@[inline] def clearLowestBit (bits : UInt32) : UInt32 :=
+  bits.land (bits - 1)
+
+@[inline] def tag (h : USize) : UInt8 :=
+  (h.land 0x7f).toUInt32.toUInt8
+
+def mkFlatHashMapImp (capacity := 8) : FlatHashMapImp α β :=
+  -- keep the load factor below 7/8
+  let n := capacity + capacity / 7
+  let rec ngroups (g : Nat) (fuel : Nat) : Nat :=
+    match fuel with
+    | 0      => g
+    | fuel+1 => if g * groupSize < n then ngroups (2*g) fuel else g
+  let cap := ngroups 1 64 * groupSize
+  { size := 0, used := 0, ctrl := mkCtrl cap, keys := mkSlots cap, vals := mkSlots cap }
+
+/- The number of groups is a power of two. -/
+@[inline] def groupMask (m : FlatHashMapImp α β) : USize :=
+  (m.ctrl.size / groupSize).toUSize - 1
+
+/- Return the index of the slot of the group starting at `base` that contains `a`, or `keys.size` if there is none.
+   `bits` is the bitmask of the slots of the group whose tag matches the one of `a`. -/
+@[specialize] partial def findInGroup [BEq α] (keys : Array α) (a : α) (base : USize) (bits : UInt32) : Nat :=
+  if bits == 0 then keys.size
+  else
+    let i := base + lowestBit bits
+    if h : i.toNat < keys.size then
+      if keys.uget i h == a then i.toNat else findInGroup keys a base (clearLowestBit bits)
+    else keys.size
+
+/- Groups are visited using triangular probing (`g, g+1, g+3, g+6, ...`),
+   which visits every group when the number of groups is a power of two. -/
+@[specialize] partial def findIdxAux [BEq α] (ctrl : ByteArray) (keys : Array α) (a : α) (t : UInt8) (mask : USize) (g : USize) (i : USize) : Nat :=
+  let bits := matchGroup ctrl g t
+  let idx  := findInGroup keys a (g * 16) (bits.land 0xffff)
+  if idx < keys.size then idx
+  -- a key is never stored past a group containing an empty slot
+  else if bits.shiftRight 16 != 0 then keys.size
+  else findIdxAux ctrl keys a t mask ((g + i + 1).land mask) (i+1)
+
+/- Return the index of the slot containing `a`, or `m.keys.size` if `a` is not in `m`. `h` is the hash code of `a`. -/
+@[inline] def findIdx [BEq α] (m : FlatHashMapImp α β) (a : α) (h : USize) : Nat :=
+  let mask := m.groupMask
+  findIdxAux m.ctrl m.keys a (tag h) mask ((h.shiftRight 7).land mask) 0
+
+/- Return the first free slot in the probe sequence of a key with hash code `h`. -/
+partial def findFree (m : FlatHashMapImp α β) (h : USize) : Nat :=
+  let mask := m.groupMask
+  let rec loop (g : USize) (i : USize) : Nat :=
+    let bits := matchFree m.ctrl g
+    if bits != 0 then (g * 16 + lowestBit bits).toNat
+    else loop ((g + i + 1).land mask) (i+1)
+  loop ((h.shiftRight 7).land mask) 0
+
+/- Store `a ↦ b` at a free slot. It assumes `a` is not in `m`, and that `m` has a free slot. -/
+@[inline] def insertNew [Hashable α] (m : FlatHashMapImp α β) (a : α) (b : β) : FlatHashMapImp α β :=
+  let h := hash a
+  let i := m.findFree h
+  match m with
+  | ⟨size, used, ctrl, keys, vals⟩ =>
+    let used := if ctrl.get! i == ctrlEmpty then used + 1 else used
+    ⟨size + 1, used, ctrl.set! i (tag h), keys.set! i a, vals.set! i b⟩
+
+/- Move the entries of `m` to a new table. The new table has twice the capacity, unless at least half of the used slots
+   are tombstones. -/
+def resize [Hashable α] (m : FlatHashMapImp α β) : FlatHashMapImp α β :=
+  let cap := m.ctrl.size
+  let cap := if m.size * 2 ≤ m.used then cap else 2 * cap
+  let rec move (i : Nat) (r : FlatHashMapImp α β) : Nat → FlatHashMapImp α β
+    | 0      => r
+    | fuel+1 =>
+      if h₁ : i < m.keys.size then
+        if h₂ : i < m.vals.size then
+          if m.ctrl.get! i < ctrlEmpty then move (i+1) (r.insertNew (m.keys.get ⟨i, h₁⟩) (m.vals.get ⟨i, h₂⟩)) fuel
+          else move (i+1) r fuel
+        else r
+      else r
+  move 0 { size := 0, used := 0, ctrl := mkCtrl cap, keys := mkSlots cap, vals := mkSlots cap } cap
+
+@[specialize] def foldM {δ : Type w} {m : Type w → Type w} [Monad m] (f : δ → α → β → m δ) (d : δ) (h : FlatHashMapImp α β) : m δ :=
+  let rec loop (i : Nat) (d : δ) : Nat → m δ
+    | 0      => pure d
+    | fuel+1 =>
+      if h₁ : i < h.keys.size then
+        if h₂ : i < h.vals.size then
+          if h.ctrl.get! i < ctrlEmpty then do
+            let d ← f d (h.keys.get ⟨i, h₁⟩) (h.vals.get ⟨i, h₂⟩)
+            loop (i+1) d fuel
+          else loop (i+1) d fuel
+        else pure d
+      else pure d
+  loop 0 d h.ctrl.size
+
+@[inline] def fold {δ : Type w} (f : δ → α → β → δ) (d : δ) (m : FlatHashMapImp α β) : δ :=
+  Id.run $ foldM f d m
+
+def findEntry? [BEq α] [Hashable α] (m : FlatHashMapImp α β) (a : α) : Option (α × β) :=
+  let i := m.findIdx a (hash a)
+  if h₁ : i < m.keys.size then
+    if h₂ : i < m.vals.size then some (m.keys.get ⟨i, h₁⟩, m.vals.get ⟨i, h₂⟩) else none
+  else none
+
+def find? [BEq α] [Hashable α] (m : FlatHashMapImp α β) (a : α) : Option β :=
+  let i := m.findIdx a (hash a)
+  if h : i < m.vals.size then some (m.vals.get ⟨i, h⟩) else none
+
+def contains [BEq α] [Hashable α] (m : FlatHashMapImp α β) (a : α) : Bool :=
+  m.findIdx a (hash a) < m.keys.size
+
+def insert [BEq α] [Hashable α] (m : FlatHashMapImp α β) (a : α) (b : β) : FlatHashMapImp α β :=
+  let i := m.findIdx a (hash a)
+  if i < m.keys.size then
+    match m with
+    | ⟨size, used, ctrl, keys, vals⟩ => ⟨size, used, ctrl, keys.set! i a, vals.set! i b⟩
+  else
+    let m := if (m.used + 1) * 8 > m.ctrl.size * 7 then m.resize else m
+    m.insertNew a b
+
+def erase [BEq α] [Hashable α] (m : FlatHashMapImp α β) (a : α) : FlatHashMapImp α β :=
+  let i := m.findIdx a (hash a)
+  if i < m.keys.size then
+    match m with
+    | ⟨size, used, ctrl, keys, vals⟩ =>
+      let ctrl :=
+        -- If the group of `i` has an empty slot, no probe sequence goes past it, and `i` can be marked as empty.
+        if (matchGroup ctrl (i / groupSize).toUSize 0).shiftRight 16 != 0 then ctrl.set! i ctrlEmpty
+        else ctrl.set! i ctrlDeleted
+      let used := if ctrl.get! i == ctrlEmpty then used - 1 else used
+      ⟨size - 1, used, ctrl, clearSlot keys i, clearSlot vals i⟩
+  else m
+
+end FlatHashMapImp
+
+def FlatHashMap (α : Type u) (β : Type v) [BEq α] [Hashable α] :=
+  FlatHashMapImp α β
+
+open Std.FlatHashMapImp
+
+/- Create an empty map that can store `capacity` entries without being resized. -/
+def mkFlatHashMap {α : Type u} {β : Type v} [BEq α] [Hashable α] (capacity := 8) : FlatHashMap α β :=
+  mkFlatHashMapImp capacity
+
+namespace FlatHashMap
+variables {α : Type u} {β : Type v} [BEq α] [Hashable α]
+
+instance : Inhabited (FlatHashMap α β) := ⟨mkFlatHashMap⟩
+
+instance : EmptyCollection (FlatHashMap α β) := ⟨mkFlatHashMap⟩
+
+@[inline] def insert (m : FlatHashMap α β) (a : α) (b : β) : FlatHashMap α β :=
+  FlatHashMapImp.insert m a b
+
+@[inline] def erase (m : FlatHashMap α β) (a : α) : FlatHashMap α β :=
+  FlatHashMapImp.erase m a
+
+@[inline] def findEntry? (m : FlatHashMap α β) (a : α) : Option (α × β) :=
+  FlatHashMapImp.findEntry? m a
+
+@[inline] def find? (m : FlatHashMap α β) (a : α) : Option β :=
+  FlatHashMapImp.find? m a
+
+@[inline] def findD (m : FlatHashMap α β) (a : α) (b₀ : β) : β :=
+  (m.find? a).getD b₀
+
+@[inline] def find! [Inhabited β] (m : FlatHashMap α β) (a : α) : β :=
+  match m.find? a with
+  | some b => b
+  | none   => panic! "key is not in the map"
+
+@[inline] def getOp (self : FlatHashMap α β) (idx : α) : Option β :=
+  self.find? idx
+
+@[inline] def contains (m : FlatHashMap α β) (a : α) : Bool :=
+  FlatHashMapImp.contains m a
+
+@[inline] def foldM {δ : Type w} {m : Type w → Type w} [Monad m] (f : δ → α → β → m δ) (init : δ) (h : FlatHashMap α β) : m δ :=
+  FlatHashMapImp.foldM f init h
+
+@[inline] def fold {δ : Type w} (f : δ → α → β → δ) (init : δ) (m : FlatHashMap α β) : δ :=
+  FlatHashMapImp.fold f init m
+
+@[inline] def size (m : FlatHashMap α β) : Nat :=
+  FlatHashMapImp.size m
+
+@[inline] def isEmpty (m : FlatHashMap α β) : Bool :=
+  m.size = 0
+
+@[inline] def empty : FlatHashMap α β :=
+  mkFlatHashMap
+
+def toList (m : FlatHashMap α β) : List (α × β) :=
+  m.fold (init := []) fun r k v => (k, v)::r
+
+def toArray (m : FlatHashMap α β) : Array (α × β) :=
+  m.fold (init := #[]) fun r k v => r.push (k, v)
+
+/- Number of slots in the table. -/
+def capacity (m : FlatHashMap α β) : Nat :=
+  (FlatHashMapImp.ctrl m).size
+
+end FlatHashMap
+end Std
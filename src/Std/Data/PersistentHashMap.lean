@@ -15,24 +15,25 @@ inductive Entry (α : Type u) (β : Type v) (σ : Type w)
 
 instance {α β σ} : Inhabited (Entry α β σ) := ⟨Entry.null⟩
 
+/-
+  Inner nodes are compressed: bit `i` of `bitmap` is set iff the `i`-th slot of the node is not empty,
+  and `es` contains only the entries for the nonempty slots, in increasing slot order.
+  Thus, the entry for slot `i` is stored at position `popcount (bitmap &&& (2^i - 1))` (see `sparseIndex`). -/
 inductive Node (α : Type u) (β : Type v) : Type (max u v)
-  | entries   (es : Array (Entry α β (Node α β))) : Node α β
+  | entries   (bitmap : UInt32) (es : Array (Entry α β (Node α β))) : Node α β
   | collision (ks : Array α) (vs : Array β) (h : ks.size = vs.size) : Node α β
 
-instance {α β} : Inhabited (Node α β) := ⟨Node.entries #[]⟩
+instance {α β} : Inhabited (Node α β) := ⟨Node.entries 0 #[]⟩
 
 abbrev shift         : USize  := 5
 abbrev branching     : USize  := USize.ofNat (2 ^ shift.toNat)
 abbrev maxDepth      : USize  := 7
 abbrev maxCollisions : Nat    := 4
 
-def mkEmptyEntriesArray {α β} : Array (Entry α β (Node α β)) :=
-  (Array.mkArray PersistentHashMap.branching.toNat PersistentHashMap.Entry.null)
-
 end PersistentHashMap
 
 structure PersistentHashMap (α : Type u) (β : Type v) [BEq α] [Hashable α] :=
-  (root    : PersistentHashMap.Node α β := PersistentHashMap.Node.entries PersistentHashMap.mkEmptyEntriesArray)
+  (root    : PersistentHashMap.Node α β := PersistentHashMap.Node.entries 0 #[])
   (size    : Nat                        := 0)
 
 abbrev PHashMap (α : Type u) (β : Type v) [BEq α] [Hashable α] := PersistentHashMap α β
@@ -48,19 +49,30 @@ def isEmpty [BEq α] [Hashable α] (m : PersistentHashMap α β) : Bool :=
 instance [BEq α] [Hashable α] : Inhabited (PersistentHashMap α β) := ⟨{}⟩
 
 def mkEmptyEntries {α β} : Node α β :=
-  Node.entries mkEmptyEntriesArray
+  Node.entries 0 #[]
 
 abbrev mul2Shift (i : USize) (shift : USize) : USize := i.shiftLeft shift
 abbrev div2Shift (i : USize) (shift : USize) : USize := i.shiftRight shift
 abbrev mod2Shift (i : USize) (shift : USize) : USize := USize.land i ((USize.shiftLeft 1 shift) - 1)
 
+/- Bit of the slot selected by the lower `shift` bits of `h`. -/
+@[inline] def bitpos (h : USize) : UInt32 :=
+  UInt32.shiftLeft 1 (mod2Shift h shift).toUInt32
+
+/- Position in the dense entries array of the slot `bit`. -/
+@[inline] def sparseIndex (bitmap : UInt32) (bit : UInt32) : Nat :=
+  (bitmap.land (bit - 1)).popcount.toNat
+
+@[inline] def hasSlot (bitmap : UInt32) (bit : UInt32) : Bool :=
+  bitmap.land bit != 0
+
 inductive IsCollisionNode : Node α β → Prop
   | mk (keys : Array α) (vals : Array β) (h : keys.size = vals.size) : IsCollisionNode (Node.collision keys vals h)
 
 abbrev CollisionNode (α β) := { n : Node α β // IsCollisionNode n }
 
 inductive IsEntriesNode : Node α β → Prop
-  | mk (entries : Array (Entry α β (Node α β))) : IsEntriesNode (Node.entries entries)
+  | mk (bitmap : UInt32) (entries : Array (Entry α β (Node α β))) : IsEntriesNode (Node.entries bitmap entries)
 
 abbrev EntriesNode (α β) := { n : Node α β // IsEntriesNode n }
 
@@ -84,14 +96,14 @@ partial def insertAtCollisionNodeAux [BEq α] : CollisionNode α β → Nat →
       else insertAtCollisionNodeAux n (i+1) k v
     else
       ⟨Node.collision (keys.push k) (vals.push v) (pushSizeEq heq k v), IsCollisionNode.mk _ _ _⟩
-  | ⟨Node.entries _, h⟩, _, _, _ => False.elim (nomatch h)
+  | ⟨Node.entries _ _, h⟩, _, _, _ => False.elim (nomatch h)
 
 def insertAtCollisionNode [BEq α] : CollisionNode α β → α → β → CollisionNode α β :=
   fun n k v => insertAtCollisionNodeAux n 0 k v
 
 def getCollisionNodeSize : CollisionNode α β → Nat
   | ⟨Node.collision keys _ _, _⟩ => keys.size
-  | ⟨Node.entries _, h⟩          => False.elim (nomatch h)
+  | ⟨Node.entries _ _, h⟩        => False.elim (nomatch h)
 
 def mkCollisionNode (k₁ : α) (v₁ : β) (k₂ : α) (v₂ : β) : Node α β :=
   let ks : Array α := Array.mkEmpty maxCollisions
@@ -105,7 +117,7 @@ partial def insertAux [BEq α] [Hashable α] : Node α β → USize → USize 
     let newNode := insertAtCollisionNode ⟨Node.collision keys vals heq, IsCollisionNode.mk _ _ _⟩ k v
     if depth >= maxDepth || getCollisionNodeSize newNode < maxCollisions then newNode.val
     else match newNode with
-      | ⟨Node.entries _, h⟩ => False.elim (nomatch h)
+      | ⟨Node.entries _ _, h⟩ => False.elim (nomatch h)
       | ⟨Node.collision keys vals heq, _⟩ =>
         let rec traverse (i : Nat) (entries : Node α β) : Node α β :=
           if h : i < keys.size then
@@ -117,9 +129,12 @@ partial def insertAux [BEq α] [Hashable α] : Node α β → USize → USize 
           else
             entries
         traverse 0 mkEmptyEntries
-  | Node.entries entries, h, depth, k, v =>
-    let j     := (mod2Shift h shift).toNat
-    Node.entries $ entries.modify j fun entry =>
+  | Node.entries bitmap entries, h, depth, k, v =>
+    let bit := bitpos h
+    let j   := sparseIndex bitmap bit
+    if !hasSlot bitmap bit then
+      Node.entries (bitmap.lor bit) (entries.insertAt j (Entry.entry k v))
+    else Node.entries bitmap $ entries.modify j fun entry =>
       match entry with
       | Entry.null        => Entry.entry k v
       | Entry.ref node    => Entry.ref $ insertAux node (div2Shift h shift) (depth+1) k v
@@ -138,9 +153,10 @@ partial def findAtAux [BEq α] (keys : Array α) (vals : Array β) (heq : keys.s
   else none
 
 partial def findAux [BEq α] : Node α β → USize → α → Option β
-  | Node.entries entries, h, k =>
-    let j     := (mod2Shift h shift).toNat
-    match entries.get! j with
+  | Node.entries bitmap entries, h, k =>
+    let bit := bitpos h
+    if !hasSlot bitmap bit then none
+    else match entries.get! (sparseIndex bitmap bit) with
     | Entry.null       => none
     | Entry.ref node   => findAux node (div2Shift h shift) k
     | Entry.entry k' v => if k == k' then some v else none
@@ -168,9 +184,10 @@ partial def findEntryAtAux [BEq α] (keys : Array α) (vals : Array β) (heq : k
   else none
 
 partial def findEntryAux [BEq α] : Node α β → USize → α → Option (α × β)
-  | Node.entries entries, h, k =>
-    let j     := (mod2Shift h shift).toNat
-    match entries.get! j with
+  | Node.entries bitmap entries, h, k =>
+    let bit := bitpos h
+    if !hasSlot bitmap bit then none
+    else match entries.get! (sparseIndex bitmap bit) with
     | Entry.null       => none
     | Entry.ref node   => findEntryAux node (div2Shift h shift) k
     | Entry.entry k' v => if k == k' then some (k', v) else none
@@ -187,9 +204,10 @@ partial def containsAtAux [BEq α] (keys : Array α) (vals : Array β) (heq : ke
   else false
 
 partial def containsAux [BEq α] : Node α β → USize → α → Bool
-  | Node.entries entries, h, k =>
-    let j     := (mod2Shift h shift).toNat
-    match entries.get! j with
+  | Node.entries bitmap entries, h, k =>
+    let bit := bitpos h
+    if !hasSlot bitmap bit then false
+    else match entries.get! (sparseIndex bitmap bit) with
     | Entry.null       => false
     | Entry.ref node   => containsAux node (div2Shift h shift) k
     | Entry.entry k' v => k == k'
@@ -210,7 +228,7 @@ partial def isUnaryEntries (a : Array (Entry α β (Node α β))) (i : Nat) (acc
   else acc
 
 def isUnaryNode : Node α β → Option (α × β)
-  | Node.entries entries         => isUnaryEntries entries 0 none
+  | Node.entries _ entries       => isUnaryEntries entries 0 none
   | Node.collision keys vals heq =>
     if h : 1 = keys.size then
       have 0 < keys.size by rw [←h]; decide!
@@ -227,20 +245,23 @@ partial def eraseAux [BEq α] : Node α β → USize → α → Node α β × Bo
       have keys.size - 1 = vals.size - 1 by rw [heq]; rfl
       (Node.collision keys' vals' (keq.trans (this.trans veq.symm)), true)
     | none     => (n, false)
-  | n@(Node.entries entries), h, k =>
-    let j       := (mod2Shift h shift).toNat
-    let entry   := entries.get! j
-    match entry with
-    | Entry.null       => (n, false)
-    | Entry.entry k' v =>
-      if k == k' then (Node.entries (entries.set! j Entry.null), true) else (n, false)
-    | Entry.ref node   =>
-      let entries := entries.set! j Entry.null
-      let (newNode, deleted) := eraseAux node (div2Shift h shift) k
-      if !deleted then (n, false)
-      else match isUnaryNode newNode with
-        | none        => (Node.entries (entries.set! j (Entry.ref newNode)), true)
-        | some (k, v) => (Node.entries (entries.set! j (Entry.entry k v)), true)
+  | n@(Node.entries bitmap entries), h, k =>
+    let bit := bitpos h
+    if !hasSlot bitmap bit then (n, false)
+    else
+      let j     := sparseIndex bitmap bit
+      let entry := entries.get! j
+      match entry with
+      | Entry.null       => (n, false)
+      | Entry.entry k' v =>
+        if k == k' then (Node.entries (bitmap - bit) (entries.eraseIdx j), true) else (n, false)
+      | Entry.ref node   =>
+        let entries := entries.set! j Entry.null
+        let (newNode, deleted) := eraseAux node (div2Shift h shift) k
+        if !deleted then (n, false)
+        else match isUnaryNode newNode with
+          | none        => (Node.entries bitmap (entries.set! j (Entry.ref newNode)), true)
+          | some (k, v) => (Node.entries bitmap (entries.set! j (Entry.entry k v)), true)
 
 def erase [BEq α] [Hashable α] : PersistentHashMap α β → α → PersistentHashMap α β
   | { root := n, size := sz }, k =>
@@ -262,7 +283,7 @@ variables {σ : Type w}
       else
         pure acc
     traverse 0 acc
-  | Node.entries entries, acc => entries.foldlM (fun acc entry =>
+  | Node.entries _ entries, acc => entries.foldlM (fun acc entry =>
     match entry with
     | Entry.null      => pure acc
     | Entry.entry k v => f acc k v
@@ -284,6 +305,7 @@ def toList [BEq α] [Hashable α] (m : PersistentHashMap α β) : List (α × β
 
 structure Stats :=
   (numNodes      : Nat := 0)
+  /- Number of empty slots in inner nodes. They are not stored in memory. -/
   (numNull       : Nat := 0)
   (numCollisions : Nat := 0)
   (maxDepth      : Nat := 0)
@@ -294,10 +316,11 @@ partial def collectStats : Node α β → Stats → Nat → Stats
       numNodes      := stats.numNodes + 1,
       numCollisions := stats.numCollisions + keys.size - 1,
       maxDepth      := Nat.max stats.maxDepth depth }
-  | Node.entries entries, stats, depth =>
+  | Node.entries _ entries, stats, depth =>
     let stats :=
       { stats with
         numNodes      := stats.numNodes + 1,
+        numNull       := stats.numNull + (branching.toNat - entries.size),
         maxDepth      := Nat.max stats.maxDepth depth }
     entries.foldl (fun stats entry =>
       match entry with
@@ -110,6 +110,20 @@ def State.shareCommon {α} (s : State) (a : α) : α × State :=
 def PersistentState.shareCommon {α} (s : PersistentState) (a : α) : α × PersistentState :=
 (a, s)
 
+/-
+  `ConcurrentState` is a maximal sharing table that can be used by multiple tasks at the same time.
+  It is implemented internally using a hash table divided in shards, each one protected by its own lock.
+  Terms produced by different tasks are mapped to the same maximally shared representation.
+  Remark: all objects stored in the table are marked as multi-threaded. -/
+constant ConcurrentState : Type := Unit
+
+@[extern "lean_sharecommon_mk_cstate"]
+constant mkConcurrentState : IO ConcurrentState
+
+@[extern "lean_concurrent_state_sharecommon"]
+def ConcurrentState.shareCommon {α} (s : @& ConcurrentState) (a : α) : α :=
+a
+
 end ShareCommon
 
 class MonadShareCommon (m : Type u → Type v) :=
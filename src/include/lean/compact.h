@@ -24,6 +24,8 @@ class object_compactor {
     void * m_begin;
     void * m_end;
     void * m_capacity;
+    void * m_base_addr;
+    size_t m_num_mpzs;
     size_t capacity() const { return static_cast<char*>(m_capacity) - static_cast<char*>(m_begin); }
     void save(object * o, object * new_o);
     void save_max_sharing(object * o, object * new_o, size_t new_o_sz);
@@ -40,7 +42,9 @@ class object_compactor {
     bool insert_ref(object * o);
     void insert_mpz(object * o);
 public:
-    object_compactor();
+    /* `base_addr` is the address the compacted data is going to be stored at when it is read back.
+       A `compacted_region` stored at this address does not need to relocate the object pointers. */
+    object_compactor(void * base_addr = nullptr);
     object_compactor(object_compactor const &) = delete;
     object_compactor(object_compactor &&) = delete;
     ~object_compactor();
@@ -49,12 +53,17 @@ public:
     void operator()(object * o);
     size_t size() const { return static_cast<char*>(m_end) - static_cast<char*>(m_begin); }
     void const * data() const { return m_begin; }
+    void * base_addr() const { return m_base_addr; }
+    size_t num_mpzs() const { return m_num_mpzs; }
 };
 
 class compacted_region {
     void *            m_begin;
     void *            m_next;
     void *            m_end;
+    void *            m_base_addr;
+    void *            m_mapping;
+    size_t            m_mapping_size;
     mpz_object *      m_nested_mpzs;
     void move(size_t d);
     void move(object * o);
@@ -66,9 +75,12 @@ class compacted_region {
     void fix_task(object * o);
     void fix_mpz(object * o);
 public:
-    /* Creates a compacted object region using the given region in memory.
+    /* Creates a compacted object region using the given region in memory, and the `base_addr` it was compacted for.
        This object takes ownership of the region. */
-    compacted_region(size_t sz, void * data);
+    compacted_region(size_t sz, void * data, void * base_addr = nullptr);
+    /* Creates a compacted object region for data contained in a file mapped into memory at `mapping` using `mmap`.
+       This object takes ownership of the mapping. */
+    compacted_region(size_t sz, void * data, void * base_addr, void * mapping, size_t mapping_size);
     /* Creates a compacted object region using the object_compactor current state.
        It creates a copy of the compacted region generated by the object compactor. */
     explicit compacted_region(object_compactor const & c);
@@ -78,5 +90,9 @@ public:
     compacted_region operator=(compacted_region const &) = delete;
     compacted_region operator=(compacted_region &&) = delete;
     object * read();
+    /* Return the root of the last object graph in the region without visiting any object.
+       This is only valid if the region is stored at its base address, and does not contain `mpz` objects,
+       since they are initialized by `read`. */
+    object * read_last();
 };
 }
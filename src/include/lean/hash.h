@@ -14,6 +14,10 @@ void mix(unsigned & a, unsigned & b, unsigned & c);
 
 unsigned hash_str(size_t len, char const * str, unsigned init_value);
 
+/* Faster 64-bit hash function for strings and byte arrays.
+   Remark: the result is not stable across Lean versions, and must not be stored in .olean files. */
+uint64 hash_str64(size_t len, char const * str, uint64 init_value);
+
 inline unsigned hash(unsigned h1, unsigned h2) {
     h2 -= h1; h2 ^= (h1 << 8);
     h1 -= h2; h2 ^= (h1 << 16);
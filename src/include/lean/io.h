@@ -16,6 +16,11 @@ obj_res io_result_mk_error(char const * msg);
 obj_res io_result_mk_error(std::string const & msg);
 obj_res decode_io_error(int errnum, b_obj_arg fname);
 obj_res io_wrap_handle(FILE * hfile);
+/* Record a `ST.Ref` marked as persistent during initialization, see `ref_maybe_mt`. Return false if initialization
+   has ended, and the value of the ref must be marked as well. */
+bool io_register_init_ref(object * ref);
+/* Mark the values of the refs recorded by `io_register_init_ref` as multi-threaded. */
+void io_end_init_refs();
 void initialize_io();
 void finalize_io();
 }
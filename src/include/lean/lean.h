@@ -11,6 +11,9 @@ Author: Leonardo de Moura
 #include <assert.h>
 #include <string.h>
 #include <limits.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #if !defined(__APPLE__)
 #include <malloc.h>
 #endif
@@ -40,10 +43,16 @@ extern "C" {
 #define LEAN_UNLIKELY(x) (__builtin_expect((x), 0))
 #define LEAN_LIKELY(x) (__builtin_expect((x), 1))
 #define LEAN_ALWAYS_INLINE __attribute__((always_inline))
+#define LEAN_WEAK __attribute__((weak))
+#define LEAN_SHARED_SPEC(sym, unique) sym
 #else
 #define LEAN_UNLIKELY(x) (x)
 #define LEAN_LIKELY(x) (x)
 #define LEAN_ALWAYS_INLINE
+#define LEAN_WEAK
+/* Without weak symbols, the copies of a shared specialization cannot be merged by the linker,
+   and we use the module-unique name the specialization would have without sharing. */
+#define LEAN_SHARED_SPEC(sym, unique) unique
 #endif
 
 #ifdef LEAN_RUNTIME_STATS
@@ -175,6 +184,10 @@ typedef struct {
     uint8_t       m_data[0];
 } lean_sarray_object;
 
+/* Byte arrays produced by `lean_io_prim_mmap` are stored in memory-mapped regions.
+   The object header is placed right before the mapped file contents, and these objects are
+   identified by `m_capacity < m_size` (their capacity is always 0). They are unmapped by `lean_free_mapped_sarray`. */
+
 typedef struct {
     lean_object m_header;
     size_t      m_size;     /* byte length including '\0' terminator */
@@ -183,6 +196,22 @@ typedef struct {
     char        m_data[0];
 } lean_string_object;
 
+/* Strings produced by `lean_string_append` and `lean_string_utf8_extract` may be represented using
+   concatenation nodes and slices of shared strings instead of copying their contents.
+   These objects also use the tag `LeanString`, and are identified by `m_capacity == 0`.
+   The `m_size`, `m_capacity` and `m_length` fields are at the same offsets used in `lean_string_object`.
+   The contents are copied into a flat string object on demand (see `lean_string_cstr`). */
+typedef struct {
+    lean_object            m_header;
+    size_t                 m_size;     /* byte length including '\0' terminator */
+    size_t                 m_capacity; /* always 0 */
+    size_t                 m_length;   /* UTF8 length */
+    _Atomic(lean_object *) m_flat;     /* flat string with the same contents, or `NULL` if it has not been created yet */
+    lean_object *          m_left;
+    lean_object *          m_right;    /* `NULL` if the object is a slice of `m_left` */
+    size_t                 m_offset;   /* slice offset in `m_left` */
+} lean_string_rope_object;
+
 typedef struct {
     lean_object   m_header;
     void *        m_fun;
@@ -558,6 +587,21 @@ static inline bool lean_dec_ref_core(lean_object * o) {
 /* Generic Lean object delete operation. */
 void lean_del(lean_object * o);
 
+/* Deferred deallocation.
+   When `budget > 0`, `lean_del` frees at most `budget` objects, and the remaining dead objects are stored in a thread local queue.
+   The queue is processed incrementally by the following `lean_del` operations and allocations. Allocations of big objects,
+   and allocations that need a new memory page, free at most `alloc_budget` objects.
+   When `background` is true, multi-threaded object graphs that cannot be freed within the budget are sent to a background thread.
+   Remark: this function should be invoked at initialization time. `budget == 0` (the default) means objects are freed eagerly. */
+void lean_set_deferred_free(unsigned budget, unsigned alloc_budget, bool background);
+/* Free at most `alloc_budget` objects from the current thread deferred deallocation queue. */
+void lean_free_deferred();
+/* Free all objects in the current thread deferred deallocation queue, and wait for the background thread. */
+void lean_flush_deferred();
+/* Execute `fn(data)` as soon as the deferred deallocation queues of all threads and the background thread are empty,
+   e.g., to free memory that may still be referenced by dead objects. `fn(data)` is executed immediately if they are empty. */
+void lean_run_after_deferred_free(void (*fn)(void *), void * data);
+
 static inline void lean_dec_ref(lean_object * o) { if (lean_dec_ref_core(o)) lean_del(o); }
 static inline void lean_inc(lean_object * o) { if (!lean_is_scalar(o)) lean_inc_ref(o); }
 static inline void lean_inc_n(lean_object * o, size_t n) { if (!lean_is_scalar(o)) lean_inc_ref_n(o, n); }
@@ -586,6 +630,7 @@ static inline lean_closure_object * lean_to_closure(lean_object * o) { assert(le
 static inline lean_array_object * lean_to_array(lean_object * o) { assert(lean_is_array(o)); return (lean_array_object*)(o); }
 static inline lean_sarray_object * lean_to_sarray(lean_object * o) { assert(lean_is_sarray(o)); return (lean_sarray_object*)(o); }
 static inline lean_string_object * lean_to_string(lean_object * o) { assert(lean_is_string(o)); return (lean_string_object*)(o); }
+static inline lean_string_rope_object * lean_to_string_rope(lean_object * o) { assert(lean_is_string(o)); return (lean_string_rope_object*)(o); }
 static inline lean_thunk_object * lean_to_thunk(lean_object * o) { assert(lean_is_thunk(o)); return (lean_thunk_object*)(o); }
 static inline lean_task_object * lean_to_task(lean_object * o) { assert(lean_is_task(o)); return (lean_task_object*)(o); }
 static inline lean_ref_object * lean_to_ref(lean_object * o) { assert(lean_is_ref(o)); return (lean_ref_object*)(o); }
@@ -690,6 +735,17 @@ static inline void lean_set_non_heap_header_for_big(lean_object * o, unsigned ta
     lean_set_non_heap_header(o, 1, tag, other);
 }
 
+/* Initializer for the header of objects that are statically allocated by the code generator.
+   Like objects in compacted regions, they are not stored in the heap, and are never deallocated. See `lean_set_non_heap_header`.
+   `sz` must be 1 for big objects such as arrays and strings. */
+#if defined(LEAN_COMPRESSED_OBJECT_HEADER)
+#define LEAN_STATIC_OBJECT_HEADER(sz, tag, other) { ((size_t)(tag) << 56) | ((size_t)(other) << 48) | (size_t)(sz) }
+#elif defined(LEAN_COMPRESSED_OBJECT_HEADER_SMALL_RC)
+#define LEAN_STATIC_OBJECT_HEADER(sz, tag, other) { ((size_t)(tag) << 56) | ((size_t)(other) << 48) | ((size_t)LEAN_OTHER_MEM_KIND << 40) | (size_t)(sz) }
+#else
+#define LEAN_STATIC_OBJECT_HEADER(sz, tag, other) { (sz), (tag), LEAN_OTHER_MEM_KIND, (other) }
+#endif
+
 /* Constructor objects */
 
 static inline unsigned lean_ctor_num_objs(lean_object * o) {
@@ -1004,6 +1060,7 @@ static inline lean_object * lean_array_swap(lean_obj_arg a, b_lean_obj_arg i, b_
 }
 
 lean_object * lean_array_push(lean_obj_arg a, lean_obj_arg v);
+lean_object * lean_array_insert_at(lean_obj_arg a, b_lean_obj_arg i, lean_obj_arg v);
 lean_object * lean_mk_array(lean_obj_arg n, lean_obj_arg v);
 
 /* Array of scalars */
@@ -1020,10 +1077,13 @@ static inline unsigned lean_sarray_elem_size(lean_object * o) {
     return lean_ptr_other(o);
 }
 static inline size_t lean_sarray_capacity(lean_object * o) { return lean_to_sarray(o)->m_capacity; }
+static inline size_t lean_sarray_size(b_lean_obj_arg o) { return lean_to_sarray(o)->m_size; }
+static inline bool lean_sarray_is_mapped(lean_object * o) { return lean_sarray_capacity(o) < lean_sarray_size(o); }
 static inline size_t lean_sarray_byte_size(lean_object * o) {
-    return sizeof(lean_sarray_object) + lean_sarray_elem_size(o)*lean_sarray_capacity(o);
+    size_t n = LEAN_UNLIKELY(lean_sarray_is_mapped(o)) ? lean_sarray_size(o) : lean_sarray_capacity(o);
+    return sizeof(lean_sarray_object) + lean_sarray_elem_size(o)*n;
 }
-static inline size_t lean_sarray_size(b_lean_obj_arg o) { return lean_to_sarray(o)->m_size; }
+void lean_free_mapped_sarray(lean_object * o);
 static inline void lean_sarray_set_size(u_lean_obj_arg o, size_t sz) {
     assert(lean_is_exclusive(o));
     assert(sz <= lean_sarray_capacity(o));
@@ -1059,6 +1119,12 @@ static inline uint8_t lean_byte_array_get(b_lean_obj_arg a, b_lean_obj_arg i) {
 }
 
 lean_obj_res lean_byte_array_push(lean_obj_arg a, uint8_t b);
+uint64_t lean_byte_array_hash(b_lean_obj_arg a);
+lean_obj_res lean_byte_array_copy_slice(b_lean_obj_arg src, lean_obj_arg src_off, lean_obj_arg dest, lean_obj_arg dest_off, lean_obj_arg len, uint8_t exact);
+lean_obj_res lean_byte_array_fill(lean_obj_arg a, b_lean_obj_arg b, b_lean_obj_arg e, uint8_t v);
+lean_obj_res lean_byte_array_index_of(b_lean_obj_arg a, uint8_t v, b_lean_obj_arg b);
+uint8_t lean_byte_array_beq(b_lean_obj_arg a1, b_lean_obj_arg a2);
+uint8_t lean_byte_array_dec_lt(b_lean_obj_arg a1, b_lean_obj_arg a2);
 
 static inline lean_obj_res lean_byte_array_set(lean_obj_arg a, b_lean_obj_arg i, uint8_t b) {
     if (!lean_is_scalar(i)) {
@@ -1108,6 +1174,9 @@ static inline double lean_float_array_get(b_lean_obj_arg a, b_lean_obj_arg i) {
 }
 
 lean_obj_res lean_float_array_push(lean_obj_arg a, double d);
+lean_obj_res lean_float_array_copy_slice(b_lean_obj_arg src, lean_obj_arg src_off, lean_obj_arg dest, lean_obj_arg dest_off, lean_obj_arg len, uint8_t exact);
+double lean_float_array_sum(b_lean_obj_arg a);
+double lean_float_array_dot(b_lean_obj_arg a1, b_lean_obj_arg a2);
 
 static inline lean_obj_res lean_float_array_set(lean_obj_arg a, b_lean_obj_arg i, double d) {
     if (!lean_is_scalar(i)) {
@@ -1142,6 +1211,47 @@ static inline lean_obj_res lean_float_array_fset(lean_obj_arg a, b_lean_obj_arg
     return r;
 }
 
+/* Flat hash maps (see `Std.FlatHashMap`) */
+
+lean_obj_res lean_flat_hash_map_mk_ctrl(b_lean_obj_arg n);
+lean_obj_res lean_flat_hash_map_mk_slots(b_lean_obj_arg n);
+lean_obj_res lean_flat_hash_map_clear_slot(lean_obj_arg a, b_lean_obj_arg i);
+
+#define LEAN_FLAT_HASH_MAP_GROUP_SIZE 16
+
+/* Return a bitmask of the control bytes of group `g` that are equal to `c` in the low 16 bits,
+   and a bitmask of the empty ones (0x80) in the high 16 bits. */
+static inline uint32_t lean_flat_hash_map_match(b_lean_obj_arg ctrl, size_t g, uint8_t c) {
+    uint8_t const * p = lean_sarray_cptr(ctrl) + g * LEAN_FLAT_HASH_MAP_GROUP_SIZE;
+#if defined(__SSE2__)
+    __m128i grp = _mm_loadu_si128((__m128i const *)p);
+    uint32_t r  = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(grp, _mm_set1_epi8((char)c)));
+    uint32_t e  = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(grp, _mm_set1_epi8((char)0x80)));
+    return r | (e << 16);
+#else
+    uint32_t r = 0;
+    for (unsigned i = 0; i < LEAN_FLAT_HASH_MAP_GROUP_SIZE; i++) {
+        if (p[i] == c) r |= 1u << i;
+        if (p[i] == 0x80) r |= 1u << (i + 16);
+    }
+    return r;
+#endif
+}
+
+/* Return a bitmask of the control bytes of group `g` that are empty (0x80) or deleted (0xfe),
+   i.e., the ones whose most significant bit is set. */
+static inline uint32_t lean_flat_hash_map_match_free(b_lean_obj_arg ctrl, size_t g) {
+    uint8_t const * p = lean_sarray_cptr(ctrl) + g * LEAN_FLAT_HASH_MAP_GROUP_SIZE;
+#if defined(__SSE2__)
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((__m128i const *)p));
+#else
+    uint32_t r = 0;
+    for (unsigned i = 0; i < LEAN_FLAT_HASH_MAP_GROUP_SIZE; i++)
+        if (p[i] & 0x80) r |= 1u << i;
+    return r;
+#endif
+}
+
 /* Strings */
 
 static inline lean_obj_res lean_alloc_string(size_t size, size_t capacity, size_t len) {
@@ -1153,12 +1263,18 @@ static inline lean_obj_res lean_alloc_string(size_t size, size_t capacity, size_
     return (lean_object*)o;
 }
 static inline size_t lean_string_capacity(lean_object * o) { return lean_to_string(o)->m_capacity; }
-static inline size_t lean_string_byte_size(lean_object * o) { return sizeof(lean_string_object) + lean_string_capacity(o); }
+static inline bool lean_string_is_rope(lean_object * o) { return lean_string_capacity(o) == 0; }
+static inline size_t lean_string_byte_size(lean_object * o) {
+    return lean_string_is_rope(o) ? sizeof(lean_string_rope_object) : sizeof(lean_string_object) + lean_string_capacity(o);
+}
 /* instance : inhabited char := ⟨'A'⟩ */
 static inline uint32_t lean_char_default_value() { return 'A'; }
 lean_obj_res lean_mk_string(char const * s);
+lean_obj_res lean_mk_string_from_bytes(char const * s, size_t sz);
+char const * lean_string_rope_cstr(b_lean_obj_arg o);
 static inline char const * lean_string_cstr(b_lean_obj_arg o) {
     assert(lean_is_string(o));
+    if (LEAN_UNLIKELY(lean_string_is_rope(o))) return lean_string_rope_cstr(o);
     return lean_to_string(o)->m_data;
 }
 static inline size_t lean_string_size(b_lean_obj_arg o) { return lean_to_string(o)->m_size; }
@@ -1186,6 +1302,11 @@ bool lean_string_lt(b_lean_obj_arg s1, b_lean_obj_arg s2);
 static inline uint8_t lean_string_dec_eq(b_lean_obj_arg s1, b_lean_obj_arg s2) { return lean_string_eq(s1, s2); }
 static inline uint8_t lean_string_dec_lt(b_lean_obj_arg s1, b_lean_obj_arg s2) { return lean_string_lt(s1, s2); }
 size_t lean_string_hash(b_lean_obj_arg);
+uint64_t lean_string_hash64(b_lean_obj_arg);
+uint64_t lean_substring_hash64(b_lean_obj_arg);
+uint8_t lean_string_validate_utf8(b_lean_obj_arg a);
+lean_obj_res lean_string_find_substr(b_lean_obj_arg s, b_lean_obj_arg p, b_lean_obj_arg b);
+lean_obj_res lean_string_lines(b_lean_obj_arg s);
 
 /* Thunks */
 
@@ -1223,6 +1344,9 @@ static inline lean_obj_res lean_thunk_get_own(b_lean_obj_arg t) {
 
 lean_obj_res lean_thunk_map(lean_obj_arg f, lean_obj_arg t);
 lean_obj_res lean_thunk_bind(lean_obj_arg x, lean_obj_arg f);
+lean_obj_res lean_thunk_get_async_core(lean_obj_arg t, unsigned prio);
+/* Thunk.getAsync : Thunk A -> Task.Priority -> Task A */
+static inline lean_obj_res lean_thunk_get_async(lean_obj_arg t, lean_obj_arg prio) { return lean_thunk_get_async_core(t, lean_unbox(prio)); }
 
 /* Tasks */
 
@@ -1705,6 +1829,15 @@ static inline uint32_t lean_uint32_modn(uint32_t a1, b_lean_obj_arg a2) {
         return a1;
     }
 }
+static inline uint32_t lean_uint32_popcount(uint32_t a) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcount(a);
+#else
+    a = a - ((a >> 1) & 0x55555555u);
+    a = (a & 0x33333333u) + ((a >> 2) & 0x33333333u);
+    return (((a + (a >> 4)) & 0x0f0f0f0fu) * 0x01010101u) >> 24;
+#endif
+}
 static inline uint8_t lean_uint32_dec_eq(uint32_t a1, uint32_t a2) { return a1 == a2; }
 static inline uint8_t lean_uint32_dec_lt(uint32_t a1, uint32_t a2) { return a1 < a2; }
 static inline uint8_t lean_uint32_dec_le(uint32_t a1, uint32_t a2) { return a1 <= a2; }
@@ -1827,6 +1960,10 @@ static inline bool lean_io_result_is_error(b_lean_obj_arg r) { return lean_ptr_t
 static inline b_lean_obj_res lean_io_result_get_value(b_lean_obj_arg r) { assert(lean_io_result_is_ok(r)); return lean_ctor_get(r, 0); }
 static inline b_lean_obj_res lean_io_result_get_error(b_lean_obj_arg r) { assert(lean_io_result_is_error(r)); return lean_ctor_get(r, 0); }
 void lean_io_result_show_error(b_lean_obj_arg r);
+/* Must be invoked after the modules have been initialized. Remark: global refs (e.g., `builtin_initialize` refs) are
+   updated in place while the modules are being initialized, and this function marks their values as
+   multi-threaded. It is also executed when the Lean runtime creates its first thread (e.g., for the task manager),
+   but programs that embed Lean and access global refs from their own threads must invoke it before starting them. */
 void lean_io_mark_end_initialization();
 static inline lean_obj_res lean_io_result_mk_ok(lean_obj_arg a) {
     lean_object * r = lean_alloc_ctor(0, 2, 0);
@@ -1851,6 +1988,34 @@ lean_obj_res lean_st_ref_swap(b_lean_obj_arg, lean_obj_arg, lean_obj_arg);
 /* pointer address unsafe primitive  */
 static inline size_t lean_ptr_addr(b_lean_obj_arg a) { return (size_t)a; }
 
+/* Call count profiling
+
+   When the C code produced by the Lean compiler is compiled with `-DLEAN_CALL_PROFILE`, every function counts how often
+   it is invoked, and the counts are written at exit to the file specified by the environment variable `LEAN_CALL_PROFILE`
+   (default: `lean_call_profile.txt`). The compiler option `compiler.profile` uses this file to inline hot functions.
+   Functions may be invoked by different threads, and the counter is incremented using a relaxed atomic operation.
+   `m_registered` is set with release semantics by `lean_register_call_counter` after the counter has been linked. */
+typedef struct lean_call_counter {
+    struct lean_call_counter * m_next;
+    char const *               m_name;
+    _Atomic(size_t)            m_count;
+    _Atomic(bool)              m_registered;
+} lean_call_counter;
+
+void lean_register_call_counter(lean_call_counter * c);
+
+#ifdef LEAN_CALL_PROFILE
+#define LEAN_PROFILE_CALL(n) {                                                                        \
+    LEAN_USING_STD;                                                                                   \
+    static lean_call_counter _lean_call_counter = { NULL, n, 0, false };                              \
+    if (LEAN_UNLIKELY(!atomic_load_explicit(&_lean_call_counter.m_registered, memory_order_acquire))) \
+        lean_register_call_counter(&_lean_call_counter);                                              \
+    atomic_fetch_add_explicit(&_lean_call_counter.m_count, (size_t)1, memory_order_relaxed);          \
+}
+#else
+#define LEAN_PROFILE_CALL(n)
+#endif
+
 #ifdef __cplusplus
 }
 #endif
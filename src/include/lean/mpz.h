@@ -14,6 +14,11 @@ Author: Leonardo de Moura
 #include <lean/debug.h>
 #include <lean/lean.h>
 
+#if defined(__SIZEOF_INT128__) && GMP_LIMB_BITS == 64
+/* Values whose absolute value fits in two limbs can be processed using `unsigned __int128` arithmetic. */
+#define LEAN_MPZ_TWO_LIMB
+#endif
+
 namespace lean {
 
 class mpq;
@@ -78,6 +83,16 @@ public:
     unsigned int get_unsigned_int() const { lean_assert(is_unsigned_int()); return static_cast<unsigned>(get_unsigned_long_int()); }
     size_t get_size_t() const;
     double get_double() const { return mpz_get_d(m_val); }
+#ifdef LEAN_MPZ_TWO_LIMB
+    /** \brief Return true iff the absolute value fits in two limbs, and store it in `r` if it does. */
+    bool get_abs_uint128(unsigned __int128 & r) const {
+        if (mpz_size(m_val) > 2) return false;
+        r = (static_cast<unsigned __int128>(mpz_getlimbn(m_val, 1)) << 64) | mpz_getlimbn(m_val, 0);
+        return true;
+    }
+    /** \brief Return `v`, or `-v` if `is_neg`, writing the limbs directly. */
+    static mpz of_uint128(unsigned __int128 v, bool is_neg = false);
+#endif
 
     mpz & operator=(mpz const & v) { mpz_set(m_val, v.m_val); return *this; }
     mpz & operator=(mpz && v) { swap(*this, v); return *this; }
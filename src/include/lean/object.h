@@ -28,6 +28,7 @@ struct mpz_object {
     mpz         m_value;
     mpz_object() {}
     explicit mpz_object(mpz const & m):m_value(m) {}
+    explicit mpz_object(mpz && m):m_value(std::move(m)) {}
 };
 
 typedef lean_external_class         external_object_class;
@@ -194,6 +195,7 @@ inline obj_res fixpoint6(obj_arg rec, obj_arg a1, obj_arg a2, obj_arg a3, obj_ar
 // MPZ
 
 object * alloc_mpz(mpz const &);
+object * alloc_mpz(mpz &&);
 inline mpz_object * to_mpz(object * o) { lean_assert(is_mpz(o)); return (mpz_object*)o; }
 
 // =======================================
@@ -234,6 +236,8 @@ inline void sarray_set_size(u_obj_arg o, size_t sz) { lean_sarray_set_size(o, sz
 inline unsigned sarray_elem_size(object * o) { return lean_sarray_elem_size(o); }
 inline size_t sarray_capacity(object * o) { return lean_sarray_capacity(o); }
 inline uint8 * sarray_cptr(object * o) { return lean_sarray_cptr(o); }
+obj_res lean_sarray_ensure_exclusive(obj_arg a);
+extern "C" obj_res lean_sarray_ensure_capacity(obj_arg a, size_t min_cap, bool exact);
 
 // =======================================
 // ByteArray
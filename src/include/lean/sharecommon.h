@@ -0,0 +1,12 @@
+/*
+Copyright (c) 2020 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: agent
+*/
+#pragma once
+
+namespace lean {
+void initialize_sharecommon();
+void finalize_sharecommon();
+}
@@ -22,6 +22,12 @@ size_t utf8_strlen(std::string const & str);
 /* Return the length of the string `str` encoded using UTF8.
    `str` may contain null characters. */
 size_t utf8_strlen(char const * str, size_t sz);
+/* Return the number of ASCII characters at the beginning of `str`.
+   It uses SSE2 instructions when available. */
+size_t utf8_ascii_prefix(char const * str, size_t sz);
+/* Return true iff `str` is a valid UTF-8 encoded string.
+   Overlong encodings, surrogates and code points greater than 0x10FFFF are rejected. */
+bool validate_utf8(uchar const * str, size_t sz);
 optional<size_t> utf8_char_pos(char const * str, size_t char_idx);
 char const * get_utf8_last_char(char const * str);
 std::string utf8_trim(std::string const & s);
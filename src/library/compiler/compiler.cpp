@@ -30,10 +30,12 @@ Author: Leonardo de Moura
 #include "library/compiler/extern_attribute.h"
 #include "library/compiler/struct_cases_on.h"
 #include "library/compiler/ir.h"
+#include "library/compiler/compiler_stats.h"
 
 namespace lean {
 static name * g_codegen = nullptr;
 static name * g_extract_closed = nullptr;
+static name * g_static_data = nullptr;
 
 bool is_codegen_enabled(options const & opts) { return opts.get_bool(*g_codegen, true); }
 bool is_extract_closed_enabled(options const & opts) { return opts.get_bool(*g_extract_closed, true); }
@@ -91,9 +93,9 @@ static expr ensure_arity(expr const & t, unsigned arity) {
     return update_binding(t, binding_domain(t), ensure_arity(binding_body(t), arity-1));
 }
 
-static environment cache_stage2(environment env, comp_decls const & ds, bool only_new_ones = false) {
-    buffer<expr> ts;
-    ll_infer_type(env, ds, ts);
+/* Cache the declarations in `ds`, `ts` are their types as computed by `ll_infer_type`. */
+static environment cache_stage2(environment env, comp_decls const & ds, buffer<expr> const & ts,
+                                bool only_new_ones = false) {
     lean_assert(ts.size() == length(ds));
     unsigned i = 0;
     for (comp_decl const & d : ds) {
@@ -114,7 +116,9 @@ static environment cache_stage2(environment env, comp_decls const & ds, bool onl
 
 /* Cache the declarations in `ds` that have not already been cached. */
 static environment cache_new_stage2(environment env, comp_decls const & ds) {
-    return cache_stage2(env, ds, true);
+    buffer<expr> ts;
+    ll_infer_type(env, ds, ts);
+    return cache_stage2(env, ds, ts, true);
 }
 
 #define trace_compiler(k, ds) lean_trace(k, trace(ds);)
@@ -195,65 +199,110 @@ environment compile(environment const & env, options const & opts, names cs) {
 
     comp_decls ds = to_comp_decls(env, cs);
     csimp_cfg cfg(opts);
+    cfg.set_decls(cs);
+    compiler_stats stats(opts, head(cs));
     // Use the following line to see compiler intermediate steps
     // scope_traces_as_string trace_scope;
     auto simp  = [&](environment const & env, expr const & e) { return csimp(env, e, cfg); };
     auto esimp = [&](environment const & env, expr const & e) { return cesimp(env, e, cfg); };
     trace_compiler(name({"compiler", "input"}), ds);
+    stats.begin(ds);
     ds = apply(eta_expand, env, ds);
+    stats.end("eta_expand", ds);
     trace_compiler(name({"compiler", "eta_expand"}), ds);
+    stats.begin(ds);
     ds = apply(to_lcnf, env, ds);
     ds = apply(find_jp, env, ds);
+    stats.end("lcnf", ds);
     // trace(ds);
     trace_compiler(name({"compiler", "lcnf"}), ds);
     // trace(ds);
+    stats.begin(ds);
     ds = apply(cce, env, ds);
+    stats.end("cce", ds);
     trace_compiler(name({"compiler", "cce"}), ds);
+    stats.begin(ds);
     ds = apply(simp, env, ds);
+    stats.end("simp", ds);
     trace_compiler(name({"compiler", "simp"}), ds);
     // trace(ds);
     environment new_env = env;
+    stats.begin(ds);
     std::tie(new_env, ds) = eager_lambda_lifting(new_env, ds, cfg);
+    stats.end("eager_lambda_lifting", ds);
     trace_compiler(name({"compiler", "eager_lambda_lifting"}), ds);
+    stats.begin(ds);
     ds = apply(max_sharing, ds);
+    stats.end("max_sharing", ds);
     trace_compiler(name({"compiler", "stage1"}), ds);
     new_env = cache_stage1(new_env, ds);
-    std::tie(new_env, ds) = specialize(new_env, ds, cfg);
+    stats.begin(ds);
+    std::tie(new_env, ds) = specialize(new_env, ds, cfg, is_share_specializations_enabled(opts));
+    stats.end("specialize", ds);
     lean_assert(lcnf_check_let_decls(new_env, ds));
     trace_compiler(name({"compiler", "specialize"}), ds);
+    stats.begin(ds);
     ds = apply(elim_dead_let, ds);
+    stats.end("elim_dead_let", ds);
     trace_compiler(name({"compiler", "elim_dead_let"}), ds);
+    stats.begin(ds);
     ds = apply(erase_irrelevant, new_env, ds);
+    stats.end("erase_irrelevant", ds);
     trace_compiler(name({"compiler", "erase_irrelevant"}), ds);
+    stats.begin(ds);
     ds = apply(struct_cases_on, new_env, ds);
+    stats.end("struct_cases_on", ds);
     trace_compiler(name({"compiler", "struct_cases_on"}), ds);
+    stats.begin(ds);
     ds = apply(esimp, new_env, ds);
+    stats.end("esimp", ds);
     trace_compiler(name({"compiler", "simp"}), ds);
+    stats.begin(ds);
     ds = reduce_arity(new_env, ds);
+    stats.end("reduce_arity", ds);
     trace_compiler(name({"compiler", "reduce_arity"}), ds);
+    stats.begin(ds);
     std::tie(new_env, ds) = lambda_lifting(new_env, ds);
+    stats.end("lambda_lifting", ds);
     trace_compiler(name({"compiler", "lambda_lifting"}), ds);
     // trace(ds);
+    stats.begin(ds);
     ds = apply(esimp, new_env, ds);
+    stats.end("esimp (lambda_lifting)", ds);
     trace_compiler(name({"compiler", "simp"}), ds);
-    new_env = cache_stage2(new_env, ds);
+    stats.begin(ds);
+    buffer<expr> ts;
+    ll_infer_type(new_env, ds, ts);
+    stats.end("ll_infer_type", ds);
+    stats.begin(ds);
+    new_env = cache_stage2(new_env, ds, ts);
+    stats.end("cache_stage2", ds);
     trace_compiler(name({"compiler", "stage2"}), ds);
     if (is_extract_closed_enabled(opts)) {
+        stats.begin(ds);
         std::tie(new_env, ds) = extract_closed(new_env, ds);
         ds = apply(elim_dead_let, ds);
         ds = apply(esimp, new_env, ds);
+        stats.end("extract_closed", ds);
         trace_compiler(name({"compiler", "extract_closed"}), ds);
     }
     new_env = cache_new_stage2(new_env, ds);
+    stats.begin(ds);
     ds = apply(esimp, new_env, ds);
+    stats.end("esimp (final)", ds);
     trace_compiler(name({"compiler", "simp"}), ds);
+    stats.begin(ds);
     ds = apply(simp_app_args, new_env, ds);
     ds = apply(ecse, new_env, ds);
     ds = apply(elim_dead_let, ds);
+    stats.end("simp_app_args", ds);
     trace_compiler(name({"compiler", "simp_app_args"}), ds);
     // std::cout << trace_scope.get_string() << "\n";
     /* compile IR. */
-    return compile_ir(new_env, opts, ds);
+    stats.begin(ds);
+    new_env = compile_ir(new_env, opts, ds);
+    stats.end("compile_ir");
+    return new_env;
 }
 
 extern "C" object* lean_get_decl_names_for_code_gen(object *);
@@ -272,8 +321,12 @@ void initialize_compiler() {
     mark_persistent(g_codegen->raw());
     g_extract_closed = new name{"compiler", "extract_closed"};
     mark_persistent(g_extract_closed->raw());
+    g_static_data    = new name{"compiler", "static_data"};
+    mark_persistent(g_static_data->raw());
     register_bool_option(*g_codegen, true, "(compiler) enable/disable code generation");
     register_bool_option(*g_extract_closed, true, "(compiler) enable/disable closed term caching");
+    register_bool_option(*g_static_data, true,
+                         "(compiler) emit closed terms that can be evaluated at compile time as static data in the generated C code");
     register_trace_class("compiler");
     register_trace_class({"compiler", "input"});
     register_trace_class({"compiler", "eta_expand"});
@@ -316,5 +369,6 @@ void initialize_compiler() {
 void finalize_compiler() {
     delete g_codegen;
     delete g_extract_closed;
+    delete g_static_data;
 }
 }
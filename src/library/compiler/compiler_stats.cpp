@@ -0,0 +1,173 @@
+/*
+Copyright (c) 2020 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: agent
+*/
+#include <iomanip>
+#include <sstream>
+#include <lean/thread.h>
+#include "util/option_declarations.h"
+#include "kernel/for_each_fn.h"
+#include "library/trace.h"
+#include "library/compiler/compiler_stats.h"
+
+namespace lean {
+static name * g_compiler_stats = nullptr;
+
+bool is_compiler_stats_enabled(options const & opts) { return opts.get_bool(*g_compiler_stats, false); }
+
+static void collect_stats(expr const & e, comp_decls_stats & r) {
+    for_each(e, [&](expr const & e, unsigned) {
+            r.m_size++;
+            if (is_let(e)) {
+                r.m_num_lets++;
+                if (is_join_point_name(let_name(e)))
+                    r.m_num_jps++;
+            }
+            return true;
+        });
+}
+
+comp_decls_stats get_comp_decls_stats(comp_decls const & ds) {
+    comp_decls_stats r;
+    for (comp_decl const & d : ds) {
+        r.m_num_decls++;
+        collect_stats(d.snd(), r);
+    }
+    return r;
+}
+
+/* Cumulative statistics for a compiler pass. */
+struct cumulative_pass_stats {
+    std::string     m_pass;
+    second_duration m_time{0};
+    uint64          m_input_size{0};
+    uint64          m_output_size{0};
+    uint64          m_num_lets{0};
+    uint64          m_num_jps{0};
+    uint64          m_num_new_decls{0};
+};
+
+/* We use a vector instead of a map to report the passes in pipeline order. */
+static std::vector<cumulative_pass_stats> * g_cum_stats = nullptr;
+static mutex * g_cum_stats_mutex = nullptr;
+
+static unsigned num_new_decls(compiler_stats::pass_info const & p) {
+    return p.m_output.m_num_decls > p.m_input.m_num_decls ? p.m_output.m_num_decls - p.m_input.m_num_decls : 0;
+}
+
+static void report_cumulative_pass_stats(compiler_stats::pass_info const & p) {
+    lock_guard<mutex> _(*g_cum_stats_mutex);
+    cumulative_pass_stats * s = nullptr;
+    for (cumulative_pass_stats & c : *g_cum_stats) {
+        if (c.m_pass == p.m_pass) {
+            s = &c;
+            break;
+        }
+    }
+    if (!s) {
+        g_cum_stats->push_back(cumulative_pass_stats());
+        s = &g_cum_stats->back();
+        s->m_pass = p.m_pass;
+    }
+    s->m_time          += p.m_time;
+    s->m_input_size    += p.m_input.m_size;
+    s->m_output_size   += p.m_output.m_size;
+    s->m_num_lets      += p.m_output.m_num_lets;
+    s->m_num_jps       += p.m_output.m_num_jps;
+    s->m_num_new_decls += num_new_decls(p);
+}
+
+static void display_header(std::ostream & out) {
+    out << "  " << std::left << std::setw(22) << "pass" << std::right
+        << std::setw(12) << "time"
+        << std::setw(10) << "in size" << std::setw(10) << "out size"
+        << std::setw(8) << "lets" << std::setw(8) << "jps" << std::setw(8) << "new"
+        << "\n";
+}
+
+template<typename T>
+static void display_row(std::ostream & out, std::string const & pass, second_duration time,
+                        T in_size, T out_size, T num_lets, T num_jps, T num_new) {
+    std::ostringstream time_str;
+    time_str << display_profiling_time{time};
+    out << "  " << std::left << std::setw(22) << pass << std::right
+        << std::setw(12) << time_str.str()
+        << std::setw(10) << in_size << std::setw(10) << out_size
+        << std::setw(8) << num_lets << std::setw(8) << num_jps << std::setw(8) << num_new
+        << "\n";
+}
+
+compiler_stats::compiler_stats(options const & opts, name const & decl):
+    m_enabled(is_compiler_stats_enabled(opts)), m_decl(decl) {
+}
+
+compiler_stats::~compiler_stats() {
+    if (!m_enabled || m_passes.empty())
+        return;
+    second_duration total(0);
+    for (pass_info const & p : m_passes) {
+        report_cumulative_pass_stats(p);
+        total += p.m_time;
+    }
+    std::ostringstream out;
+    out << "compiler statistics for " << m_decl << "\n";
+    display_header(out);
+    for (pass_info const & p : m_passes) {
+        display_row<unsigned>(out, p.m_pass, p.m_time, p.m_input.m_size, p.m_output.m_size,
+                              p.m_output.m_num_lets, p.m_output.m_num_jps, num_new_decls(p));
+    }
+    out << "  total " << display_profiling_time{total} << "\n";
+    tout() << out.str();
+}
+
+void compiler_stats::begin(comp_decls const & ds) {
+    if (!m_enabled) return;
+    m_input = get_comp_decls_stats(ds);
+    m_start = std::chrono::steady_clock::now();
+}
+
+void compiler_stats::end(char const * pass, comp_decls const & ds) {
+    if (!m_enabled) return;
+    second_duration time(std::chrono::steady_clock::now() - m_start);
+    m_passes.push_back(pass_info{pass, time, m_input, get_comp_decls_stats(ds)});
+}
+
+void compiler_stats::end(char const * pass) {
+    if (!m_enabled) return;
+    second_duration time(std::chrono::steady_clock::now() - m_start);
+    m_passes.push_back(pass_info{pass, time, m_input, comp_decls_stats()});
+}
+
+void display_cumulative_compiler_stats(std::ostream & out) {
+    lock_guard<mutex> _(*g_cum_stats_mutex);
+    if (g_cum_stats->empty())
+        return;
+    out << "cumulative compiler statistics:\n";
+    display_header(out);
+    second_duration total(0);
+    for (cumulative_pass_stats const & s : *g_cum_stats) {
+        display_row<uint64>(out, s.m_pass, s.m_time, s.m_input_size, s.m_output_size,
+                            s.m_num_lets, s.m_num_jps, s.m_num_new_decls);
+        total += s.m_time;
+    }
+    out << "  total " << display_profiling_time{total} << "\n";
+}
+
+void initialize_compiler_stats() {
+    g_compiler_stats  = new name{"compiler", "stats"};
+    mark_persistent(g_compiler_stats->raw());
+    register_bool_option(*g_compiler_stats, false,
+                         "(compiler) report time, code size, number of let-declarations and join points, "
+                         "and number of new auxiliary declarations (e.g., specializations) for each compiler pass");
+    g_cum_stats       = new std::vector<cumulative_pass_stats>();
+    g_cum_stats_mutex = new mutex;
+}
+
+void finalize_compiler_stats() {
+    delete g_cum_stats_mutex;
+    delete g_cum_stats;
+    delete g_compiler_stats;
+}
+}
@@ -0,0 +1,65 @@
+/*
+Copyright (c) 2020 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: agent
+*/
+#pragma once
+#include <string>
+#include <vector>
+#include "util/options.h"
+#include "util/timeit.h"
+#include "library/compiler/util.h"
+
+namespace lean {
+/* Size metrics for a collection of compiler declarations. */
+struct comp_decls_stats {
+    unsigned m_num_decls{0};
+    /* Number of expression nodes, shared subterms are counted only once. */
+    unsigned m_size{0};
+    unsigned m_num_lets{0};
+    unsigned m_num_jps{0};
+};
+
+comp_decls_stats get_comp_decls_stats(comp_decls const & ds);
+
+bool is_compiler_stats_enabled(options const & opts);
+
+/* Collect wall time and size metrics for each pass of the compiler pipeline.
+   The collected data is reported per declaration using `tout()`, and it is also accumulated
+   in a global table that can be displayed using `display_cumulative_compiler_stats`.
+
+   The methods are no-ops when the option `compiler.stats` is not set. Usage:
+   ```
+   stats.begin(ds);
+   ds = some_pass(ds);
+   stats.end("some_pass", ds);
+   ``` */
+class compiler_stats {
+public:
+    struct pass_info {
+        std::string      m_pass;
+        second_duration  m_time;
+        comp_decls_stats m_input;
+        comp_decls_stats m_output;
+    };
+private:
+    bool                                  m_enabled;
+    name                                  m_decl;
+    std::chrono::steady_clock::time_point m_start;
+    comp_decls_stats                      m_input;
+    std::vector<pass_info>                m_passes;
+public:
+    compiler_stats(options const & opts, name const & decl);
+    ~compiler_stats();
+    void begin(comp_decls const & ds);
+    void end(char const * pass, comp_decls const & ds);
+    /* Similar to `end(pass, ds)`, but for passes that do not produce compiler declarations (e.g., `compile_ir`). */
+    void end(char const * pass);
+};
+
+void display_cumulative_compiler_stats(std::ostream & out);
+
+void initialize_compiler_stats();
+void finalize_compiler_stats();
+}
@@ -5,9 +5,12 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Author: Leonardo de Moura
 */
 #include <algorithm>
+#include <fstream>
 #include <unordered_set>
 #include <unordered_map>
 #include <lean/flet.h>
+#include <lean/thread.h>
+#include "util/option_declarations.h"
 #include "kernel/type_checker.h"
 #include "kernel/for_each_fn.h"
 #include "kernel/find_fn.h"
@@ -29,8 +32,59 @@ Author: Leonardo de Moura
 #include "library/compiler/init_attribute.h"
 
 namespace lean {
-csimp_cfg::csimp_cfg(options const &):
+static name * g_profile              = nullptr;
+static name * g_hot_inline_threshold = nullptr;
+static name * g_hot_call_threshold   = nullptr;
+static name * g_cold_inline_threshold = nullptr;
+static name * g_cold_call_threshold   = nullptr;
+
+call_profile::call_profile(std::string const & fname) {
+    std::ifstream in(fname);
+    if (in.fail())
+        throw exception(sstream() << "failed to open call profile '" << fname << "'");
+    uint64 count;
+    std::string fn;
+    while (in >> count) {
+        in.get(); // skip separator
+        std::getline(in, fn);
+        m_counts[fn] += count;
+    }
+}
+
+uint64 call_profile::get_count(name const & fn) const {
+    uint64 r = 0;
+    auto it = m_counts.find(fn.to_string());
+    if (it != m_counts.end())
+        r = it->second;
+    it = m_counts.find(name(fn, "_rarg").to_string());
+    if (it != m_counts.end())
+        r = std::max(r, it->second);
+    return r;
+}
+
+/* We load each profile only once. */
+static std::unordered_map<std::string, std::shared_ptr<call_profile const>> * g_profiles = nullptr;
+static mutex * g_profiles_mutex = nullptr;
+
+static std::shared_ptr<call_profile const> get_call_profile(std::string const & fname) {
+    lock_guard<mutex> _(*g_profiles_mutex);
+    auto it = g_profiles->find(fname);
+    if (it != g_profiles->end())
+        return it->second;
+    std::shared_ptr<call_profile const> p = std::make_shared<call_profile>(fname);
+    g_profiles->insert(std::make_pair(fname, p));
+    return p;
+}
+
+csimp_cfg::csimp_cfg(options const & opts):
     csimp_cfg() {
+    char const * profile = opts.get_string(*g_profile, "");
+    if (profile && *profile)
+        m_profile = get_call_profile(profile);
+    m_hot_inline_threshold = opts.get_unsigned(*g_hot_inline_threshold, m_hot_inline_threshold);
+    m_hot_call_threshold   = opts.get_unsigned(*g_hot_call_threshold, m_hot_call_threshold);
+    m_cold_inline_threshold = opts.get_unsigned(*g_cold_inline_threshold, m_cold_inline_threshold);
+    m_cold_call_threshold   = opts.get_unsigned(*g_cold_call_threshold, m_cold_call_threshold);
 }
 
 csimp_cfg::csimp_cfg() {
@@ -38,6 +92,17 @@ csimp_cfg::csimp_cfg() {
     m_inline_threshold                = 1;
     m_float_cases_threshold           = 20;
     m_inline_jp_threshold             = 2;
+    m_hot_inline_threshold            = 16;
+    m_hot_call_threshold              = 10000;
+    m_cold                            = false;
+    m_cold_inline_threshold           = 32;
+    m_cold_call_threshold             = 1;
+}
+
+void csimp_cfg::set_decls(names const & cs) {
+    m_cold = m_profile && std::all_of(cs.begin(), cs.end(), [&](name const & c) {
+            return m_profile->get_count(c) < m_cold_call_threshold;
+        });
 }
 
 /*
@@ -1671,6 +1736,46 @@ class csimp_fn {
         return !arity_was_reduced(comp_decl(n, info->get_value()));
     }
 
+    /* Return true if `arg` is a lambda, literal or constructor application.
+       Inlining a function applied to these arguments usually enables further simplifications. */
+    bool is_known_value(expr const & arg) {
+        expr v = find(arg);
+        return is_lambda(v) || is_lit(v) || is_constructor_app(env(), v);
+    }
+
+    /* Return true if the profile says `fn` is hot, and the estimated cost of inlining `fn` at `e` is small enough.
+       See `csimp_cfg::m_hot_inline_threshold`. */
+    bool inline_hot(name const & fn, expr const & e, expr const & val) {
+        if (!m_cfg.m_profile || m_cfg.m_profile->get_count(fn) < m_cfg.m_hot_call_threshold)
+            return false;
+        unsigned size     = get_lcnf_size(env(), val);
+        unsigned discount = 0;
+        buffer<expr> args;
+        get_app_args(e, args);
+        for (expr const & arg : args) {
+            if (is_known_value(arg))
+                discount++;
+        }
+        bool r = size <= m_cfg.m_hot_inline_threshold + discount;
+        lean_trace(name({"compiler", "inline_hot"}),
+                   tout() << fn << " [calls: " << m_cfg.m_profile->get_count(fn) << ", size: " << size
+                   << ", discount: " << discount << "] " << (r ? "inlined" : "not inlined") << "\n";);
+        return r;
+    }
+
+    /* Return true if we are compiling cold code, and `fn` is too big to be inlined there.
+       See `csimp_cfg::m_cold_inline_threshold`. */
+    bool skip_inline_cold(name const & fn, expr const & val) {
+        if (!m_cfg.m_cold)
+            return false;
+        unsigned size = get_lcnf_size(env(), val);
+        if (size <= m_cfg.m_cold_inline_threshold)
+            return false;
+        lean_trace(name({"compiler", "inline_hot"}),
+                   tout() << fn << " [cold code, size: " << size << "] not inlined\n";);
+        return true;
+    }
+
     optional<expr> try_inline(expr const & fn, expr const & e, bool is_let_val) {
         lean_assert(is_constant(fn));
         lean_assert(is_constant(e) || is_eqp(find(get_app_fn(e)), fn));
@@ -1686,10 +1791,13 @@ class csimp_fn {
             bool inline_attr           = has_inline_attribute(env(), const_name(fn));
             bool inline_if_reduce_attr = has_inline_if_reduce_attribute(env(), const_name(fn));
             if (!inline_attr && !inline_if_reduce_attr &&
-                (get_lcnf_size(env(), info->get_value()) > m_cfg.m_inline_threshold ||
+                ((get_lcnf_size(env(), info->get_value()) > m_cfg.m_inline_threshold &&
+                  !inline_hot(const_name(fn), e, info->get_value())) ||
                  is_constant(e))) { /* We only inline constants if they are marked with the `[inline]` or `[inline_if_reduce]` attrs */
                 return none_expr();
             }
+            if (inline_attr && !inline_if_reduce_attr && skip_inline_cold(const_name(fn), info->get_value()))
+                return none_expr();
             if (!inline_if_reduce_attr && is_recursive(c)) return none_expr();
             if (uses_unsafe_inductive(c)) return none_expr();
             expr new_fn = instantiate_value_lparams(*info, const_levels(fn));
@@ -1706,7 +1814,8 @@ class csimp_fn {
             if (!info || !info->is_definition()) return none_expr();
             unsigned arity = get_num_nested_lambdas(info->get_value());
             if (get_app_num_args(e) < arity || arity == 0) return none_expr();
-            if (get_lcnf_size(env(), info->get_value()) > m_cfg.m_inline_threshold) return none_expr();
+            if (get_lcnf_size(env(), info->get_value()) > m_cfg.m_inline_threshold &&
+                !inline_hot(const_name(fn), e, info->get_value())) return none_expr();
             if (is_recursive(c)) return none_expr();
             if (uses_unsafe_inductive(c)) return none_expr();
             return some_expr(beta_reduce(info->get_value(), e, is_let_val));
@@ -2057,4 +2166,41 @@ expr csimp_core(environment const & env, local_ctx const & lctx, expr const & e0
         e = new_e;
     }
 }
+
+void initialize_csimp() {
+    g_profile              = new name{"compiler", "profile"};
+    mark_persistent(g_profile->raw());
+    g_hot_inline_threshold = new name{"compiler", "hot_inline_threshold"};
+    mark_persistent(g_hot_inline_threshold->raw());
+    g_hot_call_threshold   = new name{"compiler", "hot_call_threshold"};
+    mark_persistent(g_hot_call_threshold->raw());
+    register_option(*g_profile, data_value_kind::String, "",
+                    "(compiler) call count profile produced by an executable compiled with `-DLEAN_CALL_PROFILE`, "
+                    "it is used to inline hot functions");
+    register_unsigned_option(*g_hot_inline_threshold, 16,
+                             "(compiler) maximum estimated cost of hot functions that are inlined, see `compiler.profile`");
+    register_unsigned_option(*g_hot_call_threshold, 10000,
+                             "(compiler) minimum number of calls for a function to be considered hot, see `compiler.profile`");
+    g_cold_inline_threshold = new name{"compiler", "cold_inline_threshold"};
+    mark_persistent(g_cold_inline_threshold->raw());
+    g_cold_call_threshold   = new name{"compiler", "cold_call_threshold"};
+    mark_persistent(g_cold_call_threshold->raw());
+    register_unsigned_option(*g_cold_inline_threshold, 32,
+                             "(compiler) maximum code size of `[inline]` functions that are inlined in cold code, see `compiler.profile`");
+    register_unsigned_option(*g_cold_call_threshold, 1,
+                             "(compiler) declarations invoked fewer times than this threshold are cold, see `compiler.profile`");
+    register_trace_class({"compiler", "inline_hot"});
+    g_profiles       = new std::unordered_map<std::string, std::shared_ptr<call_profile const>>();
+    g_profiles_mutex = new mutex();
+}
+
+void finalize_csimp() {
+    delete g_profiles_mutex;
+    delete g_profiles;
+    delete g_profile;
+    delete g_hot_inline_threshold;
+    delete g_hot_call_threshold;
+    delete g_cold_inline_threshold;
+    delete g_cold_call_threshold;
+}
 }
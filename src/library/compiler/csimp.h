@@ -5,8 +5,21 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Author: Leonardo de Moura
 */
 #pragma once
+#include <memory>
+#include <string>
+#include <unordered_map>
 #include "kernel/environment.h"
 namespace lean {
+/* Call counts produced by an executable compiled with `-DLEAN_CALL_PROFILE`. See `lean.h`. */
+class call_profile {
+    std::unordered_map<std::string, uint64> m_counts;
+public:
+    call_profile(std::string const & fname);
+    /* Return the number of times the code generated for `fn` has been invoked.
+       Remark: if the arity of `fn` has been reduced, we also consider the auxiliary `_rarg` function. */
+    uint64 get_count(name const & fn) const;
+};
+
 struct csimp_cfg {
     /* If `m_inline` == false, then we will not inline `c` even if it is marked with the attribute `[inline]`. */
     bool     m_inline;
@@ -18,9 +31,25 @@ struct csimp_cfg {
     unsigned m_float_cases_threshold;
     /* We inline join-points that are smaller m_inline_threshold. */
     unsigned m_inline_jp_threshold;
+    /* Profile-guided inlining. When a profile is available, we also inline "hot" functions, i.e.,
+       functions invoked at least `m_hot_call_threshold` times, if their estimated cost is at most
+       `m_hot_inline_threshold`. The cost is the code size minus a discount for each argument that is a
+       lambda, literal or constructor application, since they usually enable further simplifications. */
+    std::shared_ptr<call_profile const> m_profile;
+    unsigned m_hot_inline_threshold;
+    unsigned m_hot_call_threshold;
+    /* When a profile is available, and the declarations being compiled have been invoked fewer than
+       `m_cold_call_threshold` times, we say they are "cold". In cold code, we do not inline functions whose
+       code size is greater than `m_cold_inline_threshold` even if they are marked with the attribute `[inline]`.
+       See `set_decls`. */
+    bool     m_cold;
+    unsigned m_cold_inline_threshold;
+    unsigned m_cold_call_threshold;
 public:
     csimp_cfg(options const & opts);
     csimp_cfg();
+    /* Set `m_cold` using the call counts of the declarations `cs` being compiled. */
+    void set_decls(names const & cs);
 };
 
 expr csimp_core(environment const & env, local_ctx const & lctx, expr const & e, bool before_erasure, csimp_cfg const & cfg);
@@ -30,4 +59,7 @@ inline expr csimp(environment const & env, expr const & e, csimp_cfg const & cfg
 inline expr cesimp(environment const & env, expr const & e, csimp_cfg const & cfg = csimp_cfg()) {
     return csimp_core(env, local_ctx(), e, false, cfg);
 }
+
+void initialize_csimp();
+void finalize_csimp();
 }
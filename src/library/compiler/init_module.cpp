@@ -8,6 +8,7 @@ Author: Leonardo de Moura
 #include "library/compiler/lcnf.h"
 #include "library/compiler/elim_dead_let.h"
 #include "library/compiler/cse.h"
+#include "library/compiler/csimp.h"
 #include "library/compiler/specialize.h"
 #include "library/compiler/llnf.h"
 #include "library/compiler/compiler.h"
@@ -15,6 +16,7 @@ Author: Leonardo de Moura
 #include "library/compiler/ll_infer_type.h"
 #include "library/compiler/ir.h"
 #include "library/compiler/ir_interpreter.h"
+#include "library/compiler/compiler_stats.h"
 
 namespace lean {
 void initialize_compiler_module() {
@@ -22,9 +24,11 @@ void initialize_compiler_module() {
     initialize_lcnf();
     initialize_elim_dead_let();
     initialize_cse();
+    initialize_csimp();
     initialize_specialize();
     initialize_llnf();
     initialize_compiler();
+    initialize_compiler_stats();
     initialize_borrowed_annotation();
     initialize_ll_infer_type();
     initialize_ir();
@@ -36,9 +40,11 @@ void finalize_compiler_module() {
     finalize_ir();
     finalize_ll_infer_type();
     finalize_borrowed_annotation();
+    finalize_compiler_stats();
     finalize_compiler();
     finalize_llnf();
     finalize_specialize();
+    finalize_csimp();
     finalize_cse();
     finalize_elim_dead_let();
     finalize_lcnf();
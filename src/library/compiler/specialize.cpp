@@ -5,7 +5,10 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Author: Leonardo de Moura
 */
 #include <algorithm>
+#include <string>
+#include <unordered_map>
 #include <lean/flet.h>
+#include "util/option_declarations.h"
 #include "kernel/instantiate.h"
 #include "kernel/for_each_fn.h"
 #include "kernel/abstract.h"
@@ -15,6 +18,10 @@ Author: Leonardo de Moura
 #include "library/compiler/csimp.h"
 
 namespace lean {
+static name * g_share_specializations = nullptr;
+
+bool is_share_specializations_enabled(options const & opts) { return opts.get_bool(*g_share_specializations, false); }
+
 extern "C" uint8 lean_has_specialize_attribute(object* env, object* n);
 extern "C" uint8 lean_has_nospecialize_attribute(object* env, object* n);
 
@@ -246,9 +253,130 @@ static optional<name> get_cached_specialization(environment const & env, expr co
     return to_optional<name>(lean_get_cached_specialization(env.to_obj_arg(), e.to_obj_arg()));
 }
 
+extern "C" object* lean_add_shared_specialization(object* env, object* fn, object* sym);
+
+static environment add_shared_specialization(environment const & env, name const & fn, name const & sym) {
+    object * r = lean_add_shared_specialization(env.to_obj_arg(), fn.to_obj_arg(), sym.to_obj_arg());
+    if (cnstr_tag(r) == 0) {
+        string_ref error(cnstr_get(r, 0), true);
+        dec_ref(r);
+        throw exception(error.data());
+    } else {
+        environment new_env(cnstr_get(r, 0), true);
+        dec_ref(r);
+        return new_env;
+    }
+}
+
+/* Structural 64-bit hash for specialization cache keys, parameterized by a seed.
+
+   The hash only depends on the key itself. Binder names, binder annotations and metadata are ignored,
+   and names are hashed using their string representation. Thus, two modules that do not import each other
+   produce the same hash for the same specialization (e.g., `List.foldl` at the same instance), and
+   we use it to produce a content-addressed C symbol for the specialization. */
+class spec_key_hasher {
+    uint64                                    m_seed;
+    std::unordered_map<lean_object *, uint64> m_cache;
+
+    static uint64 mix(uint64 h, uint64 v) {
+        /* splitmix64 finalizer */
+        uint64 z = h ^ (v + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2));
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    uint64 hash(std::string const & s) const {
+        /* FNV-1a */
+        uint64 h = 0xcbf29ce484222325ull ^ m_seed;
+        for (char c : s) {
+            h ^= static_cast<unsigned char>(c);
+            h *= 0x100000001b3ull;
+        }
+        return mix(m_seed, h);
+    }
+
+    uint64 hash(name const & n) const { return hash(n.escape()); }
+
+    uint64 hash(nat const & n) const { return hash(n.to_std_string()); }
+
+    uint64 hash(level const & l) const {
+        uint64 h = mix(m_seed, static_cast<uint64>(kind(l)));
+        switch (kind(l)) {
+        case level_kind::Zero:  return h;
+        case level_kind::Succ:  return mix(h, hash(succ_of(l)));
+        case level_kind::Max:   return mix(mix(h, hash(max_lhs(l))), hash(max_rhs(l)));
+        case level_kind::IMax:  return mix(mix(h, hash(imax_lhs(l))), hash(imax_rhs(l)));
+        case level_kind::Param: return mix(h, hash(param_id(l)));
+        case level_kind::MVar:  return mix(h, hash(mvar_id(l)));
+        }
+        lean_unreachable();
+    }
+
+    uint64 visit(expr const & e) {
+        auto it = m_cache.find(e.raw());
+        if (it != m_cache.end())
+            return it->second;
+        uint64 h = mix(m_seed, static_cast<uint64>(e.kind()));
+        switch (e.kind()) {
+        case expr_kind::BVar:   h = mix(h, hash(bvar_idx(e))); break;
+        case expr_kind::FVar:   h = mix(h, hash(fvar_name(e))); break;
+        case expr_kind::MVar:   h = mix(h, hash(mvar_name(e))); break;
+        case expr_kind::Sort:   h = mix(h, hash(sort_level(e))); break;
+        case expr_kind::Const:
+            h = mix(h, hash(const_name(e)));
+            for (level const & l : const_levels(e))
+                h = mix(h, hash(l));
+            break;
+        case expr_kind::Lit:
+            if (lit_value(e).kind() == literal_kind::Nat)
+                h = mix(h, hash(lit_value(e).get_nat()));
+            else
+                h = mix(h, hash(lit_value(e).get_string().to_std_string()));
+            break;
+        case expr_kind::App:    h = mix(mix(h, visit(app_fn(e))), visit(app_arg(e))); break;
+        case expr_kind::Lambda: case expr_kind::Pi:
+            h = mix(mix(h, visit(binding_domain(e))), visit(binding_body(e)));
+            break;
+        case expr_kind::Let:
+            h = mix(mix(mix(h, visit(let_type(e))), visit(let_value(e))), visit(let_body(e)));
+            break;
+        case expr_kind::MData:  return visit(mdata_expr(e));
+        case expr_kind::Proj:
+            h = mix(mix(mix(h, hash(proj_sname(e))), hash(proj_idx(e))), visit(proj_expr(e)));
+            break;
+        }
+        m_cache.insert(std::make_pair(e.raw(), h));
+        return h;
+    }
+public:
+    explicit spec_key_hasher(uint64 seed):m_seed(seed) {}
+    uint64 operator()(expr const & e) { return visit(e); }
+};
+
+/* Return the content-addressed C symbol for the specialization of `fn` with cache key `key`.
+
+   The linker silently keeps a single definition for all copies of a weak symbol, so two different keys
+   with the same symbol would be miscompiled. Thus, the symbol contains a 128-bit digest of the key,
+   consisting of two hashes with independent seeds. */
+static name mk_shared_specialization_symbol(name const & fn, expr const & key) {
+    uint64 h1 = spec_key_hasher(0)(key);
+    uint64 h2 = spec_key_hasher(0x6a09e667f3bcc908ull)(key);
+    char buf[33];
+    snprintf(buf, sizeof(buf), "%016llx%016llx",
+             static_cast<unsigned long long>(h1), static_cast<unsigned long long>(h2));
+    std::string fn_str = fn.escape("_");
+    for (char & c : fn_str) {
+        if (!isalnum(static_cast<unsigned char>(c)))
+            c = '_';
+    }
+    return name(std::string("lean_spec_") + buf + "_" + fn_str);
+}
+
 class specialize_fn {
     type_checker::state m_st;
     csimp_cfg           m_cfg;
+    bool                m_share;
     local_ctx           m_lctx;
     buffer<comp_decl>   m_new_decls;
     name                m_base_name;
@@ -895,6 +1023,17 @@ class specialize_fn {
         m_new_decls.push_back(comp_decl(n, code));
     }
 
+    /* Return true if the new declaration `n` has parameters.
+       Remark: declarations without parameters are compiled into closed terms that are initialized
+       by the module initializer, and we do not share them. */
+    bool has_params(name const & n) {
+        for (comp_decl const & d : m_new_decls) {
+            if (d.fst() == n)
+                return get_num_nested_lambdas(d.snd()) > 0;
+        }
+        return false;
+    }
+
     optional<expr> get_closed(expr const & e) {
         if (has_univ_param(e)) return none_expr();
         switch (e.kind()) {
@@ -997,6 +1136,10 @@ class specialize_fn {
             }
             if (gcache_enabled) {
                 m_st.env() = cache_specialization(env(), key, *new_fn_name);
+                if (m_share && has_params(*new_fn_name)) {
+                    m_st.env() = add_shared_specialization(env(), *new_fn_name,
+                                                           mk_shared_specialization_symbol(const_name(fn), key));
+                }
             }
         }
         expr r = mk_constant(*new_fn_name);
@@ -1043,8 +1186,8 @@ class specialize_fn {
     }
 
 public:
-    specialize_fn(environment const & env, csimp_cfg const & cfg):
-        m_st(env), m_cfg(cfg), m_at("_at"), m_spec("_spec") {}
+    specialize_fn(environment const & env, csimp_cfg const & cfg, bool share):
+        m_st(env), m_cfg(cfg), m_share(share), m_at("_at"), m_spec("_spec") {}
 
     pair<environment, comp_decls> operator()(comp_decl const & d) {
         m_base_name = d.fst();
@@ -1055,11 +1198,11 @@ public:
     }
 };
 
-pair<environment, comp_decls> specialize_core(environment const & env, comp_decl const & d, csimp_cfg const & cfg) {
-    return specialize_fn(env, cfg)(d);
+pair<environment, comp_decls> specialize_core(environment const & env, comp_decl const & d, csimp_cfg const & cfg, bool share) {
+    return specialize_fn(env, cfg, share)(d);
 }
 
-pair<environment, comp_decls> specialize(environment env, comp_decls const & ds, csimp_cfg const & cfg) {
+pair<environment, comp_decls> specialize(environment env, comp_decls const & ds, csimp_cfg const & cfg, bool share) {
     env = update_spec_info(env, ds);
     comp_decls r;
     for (comp_decl const & d : ds) {
@@ -1067,7 +1210,7 @@ pair<environment, comp_decls> specialize(environment env, comp_decls const & ds,
         if (has_specialize_attribute(env, d.fst())) {
             r = append(r, comp_decls(d));
         } else {
-            std::tie(env, new_ds) = specialize_core(env, d, cfg);
+            std::tie(env, new_ds) = specialize_core(env, d, cfg, share);
             r = append(r, new_ds);
         }
     }
@@ -1075,10 +1218,16 @@ pair<environment, comp_decls> specialize(environment env, comp_decls const & ds,
 }
 
 void initialize_specialize() {
+    g_share_specializations = new name{"compiler", "share_specializations"};
+    mark_persistent(g_share_specializations->raw());
+    register_bool_option(*g_share_specializations, false,
+                         "(compiler) use content-addressed weak C symbols for specializations, "
+                         "equivalent specializations created by different modules are merged by the linker");
     register_trace_class({"compiler", "spec_info"});
     register_trace_class({"compiler", "spec_candidate"});
 }
 
 void finalize_specialize() {
+    delete g_share_specializations;
 }
 }
@@ -9,7 +9,11 @@ Author: Leonardo de Moura
 #include "library/compiler/util.h"
 #include "library/compiler/csimp.h"
 namespace lean {
-pair<environment, comp_decls> specialize(environment env, comp_decls const & ds, csimp_cfg const & cfg);
+bool is_share_specializations_enabled(options const & opts);
+/* Specialize the given declarations. If `share == true`, then new specializations whose cache key is closed
+   are emitted using a content-addressed weak C symbol, and equivalent specializations created by modules
+   that do not import each other are merged by the linker. */
+pair<environment, comp_decls> specialize(environment env, comp_decls const & ds, csimp_cfg const & cfg, bool share = false);
 void initialize_specialize();
 void finalize_specialize();
 }
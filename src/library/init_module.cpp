@@ -17,6 +17,7 @@ Author: Leonardo de Moura
 #include "library/profiling.h"
 #include "library/time_task.h"
 #include "library/formatter.h"
+#include "library/module.h"
 
 namespace lean {
 void initialize_library_core_module() {
@@ -42,9 +43,11 @@ void initialize_library_module() {
     initialize_library_util();
     initialize_pp_options();
     initialize_time_task();
+    initialize_module();
 }
 
 void finalize_library_module() {
+    finalize_module();
     finalize_time_task();
     finalize_pp_options();
     finalize_library_util();
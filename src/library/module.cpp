@@ -12,6 +12,7 @@ Authors: Leonardo de Moura, Gabriel Ebner, Sebastian Ullrich
 #include <fstream>
 #include <algorithm>
 #include <sys/stat.h>
+#include <fcntl.h>
 #include <lean/thread.h>
 #include <lean/interrupt.h>
 #include <lean/sstream.h>
@@ -22,6 +23,9 @@ Authors: Leonardo de Moura, Gabriel Ebner, Sebastian Ullrich
 #include "util/buffer.h"
 #include "util/name_map.h"
 #include "util/file_lock.h"
+#include "util/option_declarations.h"
+#include "util/array_ref.h"
+#include "kernel/declaration.h"
 #include "library/module.h"
 #include "library/constants.h"
 #include "library/time_task.h"
@@ -33,24 +37,307 @@ Authors: Leonardo de Moura, Gabriel Ebner, Sebastian Ullrich
 #endif
 #endif
 
+#if defined(LEAN_ZLIB)
+#include <zlib.h>
+#endif
+
+#if !defined(LEAN_WINDOWS) && !defined(LEAN_EMSCRIPTEN)
+#define LEAN_MMAP_OLEAN
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#ifndef LEAN_DEFAULT_OLEAN_COMPRESS
+#define LEAN_DEFAULT_OLEAN_COMPRESS false
+#endif
+
 namespace lean {
 // manually padded to multiple of word size, see `initialize_module`
 static char const * g_olean_header   = "oleanfile!!!!!!!";
+/* The headers of the containers below have the same length as `g_olean_header`, and are followed by the interface
+   hash of the module (`uint64`, see `hash_module_interface`). */
+/* Compressed container. The hash is followed by the size of the compacted data
+   (`uint64`), the chunk size and number of chunks (`uint32`), the compressed size of each chunk (`uint32`),
+   and finally the chunks. Each chunk is compressed independently so that it can be inflated directly into
+   the buffer of the `compacted_region`. The digit is the version of the container format. */
+static char const * g_olean_zlib_header = "oleanzlib2!!!!!!";
+static unsigned const g_olean_chunk_size = 1u << 20;
+/* Uncompressed container. The hash is followed by the address the data was
+   compacted for (`uint64`, see `object_compactor`) and the number of `mpz` objects (`uint64`). If the file can be
+   mapped into memory so that the data is stored at this address, the objects are used in place, and only the
+   pages that are actually accessed are loaded. Otherwise, the data is read and relocated as usual. */
+static char const * g_olean_mapped_header = "oleanfile3!!!!!!";
+static size_t const g_olean_mapped_header_size = 16 + 3 * sizeof(uint64);
+
+static name * g_olean_compress = nullptr;
+
+bool get_olean_compress(options const & opts) {
+    return opts.get_bool(*g_olean_compress, LEAN_DEFAULT_OLEAN_COMPRESS);
+}
+
+/* Structural hash of object graphs. It does not depend on the addresses of the objects, so it can be stored in
+   .olean files. Shared objects are only visited once. */
+class object_hasher {
+    std::unordered_map<object *, uint64> m_cache;
+    std::vector<object *>                m_todo;
+    /* Mix the hash of `o` into `h`, return false if `o` has not been visited yet. */
+    bool mix_child(uint64 & h, object * o) {
+        if (lean_is_scalar(o)) {
+            h = hash(h, static_cast<uint64>(lean_unbox(o)));
+            return true;
+        }
+        auto it = m_cache.find(o);
+        if (it == m_cache.end()) {
+            m_todo.push_back(o);
+            return false;
+        }
+        h = hash(h, it->second);
+        return true;
+    }
+    static uint64 mix_bytes(uint64 h, void const * data, size_t sz) {
+        return hash(hash(h, static_cast<uint64>(sz)), static_cast<uint64>(hash_str(sz, static_cast<char const *>(data), 17)));
+    }
+public:
+    uint64 operator()(object * root) {
+        if (lean_is_scalar(root))
+            return lean_unbox(root);
+        m_todo.push_back(root);
+        while (!m_todo.empty()) {
+            object * o = m_todo.back();
+            if (m_cache.find(o) != m_cache.end()) {
+                m_todo.pop_back();
+                continue;
+            }
+            uint8 tag = lean_ptr_tag(o);
+            uint64 h  = tag + 1;
+            bool done = true;
+            if (tag <= LeanMaxCtorTag) {
+                object ** it  = lean_ctor_obj_cptr(o);
+                object ** end = it + lean_ctor_num_objs(o);
+                for (; it != end; it++)
+                    done = mix_child(h, *it) && done;
+                h = mix_bytes(h, end, reinterpret_cast<char *>(o) + lean_object_byte_size(o) - reinterpret_cast<char *>(end));
+            } else {
+                switch (tag) {
+                case LeanArray:
+                    for (size_t i = 0; i < lean_array_size(o); i++)
+                        done = mix_child(h, lean_array_get_core(o, i)) && done;
+                    break;
+                case LeanScalarArray:
+                    h = mix_bytes(h, lean_sarray_cptr(o), lean_sarray_size(o) * lean_sarray_elem_size(o));
+                    break;
+                case LeanString:
+                    h = mix_bytes(h, lean_string_cstr(o), lean_string_size(o));
+                    break;
+                case LeanMPZ: {
+                    std::string v = mpz_value(o).to_string();
+                    h = mix_bytes(h, v.c_str(), v.size());
+                    break;
+                }
+                case LeanThunk: done = mix_child(h, lean_thunk_get(o)); break;
+                case LeanRef:   done = mix_child(h, lean_to_ref(o)->m_value); break;
+                case LeanTask:  done = mix_child(h, lean_task_get(o)); break;
+                default:        throw exception("closures and external objects cannot be stored in .olean files");
+                }
+            }
+            if (done) {
+                m_cache.insert(std::make_pair(o, h));
+                m_todo.pop_back();
+            }
+        }
+        return m_cache.find(root)->second;
+    }
+};
+
+/* def findOLean (mod : Name) : IO String */
+extern "C" object * lean_find_olean(object * mod, object * w);
+
+/* Interface hashes of the .olean files visited while computing a hash. */
+typedef std::unordered_map<std::string, uint64> module_hash_cache;
+static uint64 read_module_hash(std::string const & olean_fn, module_hash_cache & cache);
+
+/* Return a hash of the interface of the module, i.e., of the module data without the values of theorems, which are
+   irrelevant for the modules importing it. Build tools use it to avoid rebuilding these modules when, e.g., only
+   proofs have changed (see `lean --hash`).
+   The modules importing it may also depend on the interface of its imports, e.g., by reducing, inlining or
+   specializing their definitions, or by executing their macros and elaborators. Thus, the stored interface hashes
+   of the imports are included, and the hash changes whenever the interface of a transitive import changes. */
+static uint64 hash_module_interface(object * mdata, module_hash_cache & cache) {
+    object_hasher hasher;
+    uint64 h = hasher(cnstr_get(mdata, 0));
+    for (object_ref const & import : array_ref<object_ref>(cnstr_get(mdata, 0), true)) {
+        name mod = cnstr_get_ref_t<name>(import, 0);
+        string_ref olean_fn = get_io_result<string_ref>(lean_find_olean(mod.to_obj_arg(), io_mk_world()));
+        h = hash(h, read_module_hash(olean_fn.to_std_string(), cache));
+    }
+    for (constant_info const & cinfo : array_ref<constant_info>(cnstr_get(mdata, 1), true)) {
+        if (cinfo.is_theorem()) {
+            h = hash(h, static_cast<uint64>(cinfo.kind()));
+            h = hash(h, hasher(cinfo.get_name().raw()));
+            h = hash(h, hasher(cinfo.get_lparams().raw()));
+            h = hash(h, hasher(cinfo.get_type().raw()));
+        } else {
+            h = hash(h, hasher(cinfo.raw()));
+        }
+    }
+    return hash(h, hasher(cnstr_get(mdata, 2)));
+}
+
+/* Allocate the buffer for the data of an .olean file using `malloc` as expected by `compacted_region`. */
+static char * alloc_olean_buffer(size_t size) {
+    char * buffer = static_cast<char *>(malloc(size));
+    if (buffer == nullptr)
+        throw exception(sstream() << "failed to allocate " << size << " bytes");
+    return buffer;
+}
+
+#if defined(LEAN_ZLIB)
+static void write_compressed(std::ofstream & out, object_compactor const & compactor, uint64 module_hash) {
+    char const * data = static_cast<char const *>(compactor.data());
+    uint64 size       = compactor.size();
+    uint32 num_chunks = static_cast<uint32>((size + g_olean_chunk_size - 1) / g_olean_chunk_size);
+    std::vector<uint32> chunk_sizes;
+    std::vector<std::vector<unsigned char>> chunks;
+    for (uint64 offset = 0; offset < size; offset += g_olean_chunk_size) {
+        uLong src_len = static_cast<uLong>(std::min<uint64>(g_olean_chunk_size, size - offset));
+        uLongf dest_len = compressBound(src_len);
+        chunks.emplace_back(dest_len);
+        if (compress2(chunks.back().data(), &dest_len, reinterpret_cast<Bytef const *>(data + offset), src_len,
+                      Z_DEFAULT_COMPRESSION) != Z_OK)
+            throw exception("compression failed");
+        chunks.back().resize(dest_len);
+        chunk_sizes.push_back(static_cast<uint32>(dest_len));
+    }
+    uint32 chunk_size = g_olean_chunk_size;
+    out.write(g_olean_zlib_header, strlen(g_olean_zlib_header));
+    out.write(reinterpret_cast<char const *>(&module_hash), sizeof(module_hash));
+    out.write(reinterpret_cast<char const *>(&size), sizeof(size));
+    out.write(reinterpret_cast<char const *>(&chunk_size), sizeof(chunk_size));
+    out.write(reinterpret_cast<char const *>(&num_chunks), sizeof(num_chunks));
+    out.write(reinterpret_cast<char const *>(chunk_sizes.data()), sizeof(uint32) * num_chunks);
+    for (auto const & chunk : chunks)
+        out.write(reinterpret_cast<char const *>(chunk.data()), chunk.size());
+}
+
+/* Read the rest of a compressed .olean file, decompressing one chunk at a time into the result.
+   The result is allocated using `malloc` as expected by `compacted_region`. */
+static char * read_compressed(std::ifstream & in, size_t remaining, size_t & size) {
+    uint64 data_size; uint32 chunk_size; uint32 num_chunks;
+    size_t prefix_size = sizeof(data_size) + sizeof(chunk_size) + sizeof(num_chunks);
+    if (remaining < prefix_size)
+        throw exception("invalid compressed data");
+    in.read(reinterpret_cast<char *>(&data_size), sizeof(data_size));
+    in.read(reinterpret_cast<char *>(&chunk_size), sizeof(chunk_size));
+    in.read(reinterpret_cast<char *>(&num_chunks), sizeof(num_chunks));
+    remaining -= prefix_size;
+    if (!in || chunk_size == 0 || num_chunks != (data_size + chunk_size - 1) / chunk_size ||
+        remaining < sizeof(uint32) * static_cast<uint64>(num_chunks))
+        throw exception("invalid compressed data");
+    std::vector<uint32> chunk_sizes(num_chunks);
+    in.read(reinterpret_cast<char *>(chunk_sizes.data()), sizeof(uint32) * num_chunks);
+    remaining -= sizeof(uint32) * num_chunks;
+    uint64 total = 0;
+    for (uint32 sz : chunk_sizes) total += sz;
+    if (!in || total != remaining)
+        throw exception("invalid compressed data");
+    char * buffer = alloc_olean_buffer(data_size);
+    std::vector<unsigned char> chunk;
+    uint64 offset = 0;
+    for (uint32 sz : chunk_sizes) {
+        chunk.resize(sz);
+        in.read(reinterpret_cast<char *>(chunk.data()), sz);
+        uLongf expected = static_cast<uLongf>(std::min<uint64>(chunk_size, data_size - offset));
+        uLongf dest_len = expected;
+        if (!in || uncompress(reinterpret_cast<Bytef *>(buffer + offset), &dest_len, chunk.data(), sz) != Z_OK ||
+            dest_len != expected) {
+            free(buffer);
+            throw exception("invalid compressed data");
+        }
+        offset += expected;
+    }
+    size = data_size;
+    return buffer;
+}
+#endif
+
+/* Return the address the data of the given .olean file is compacted for. It is derived from the file name, and
+   the mappings are aligned to 64KB in [2^44, 3*2^44). Address clashes are detected when mapping the file. */
+static void * get_olean_base_addr(std::string const & olean_fn) {
+    if (sizeof(void *) < 8)
+        return nullptr;
+    uint64 h    = hash_str(olean_fn.size(), olean_fn.c_str(), 11);
+    uint64 addr = (static_cast<uint64>(1) << 44) + (h % (1u << 29)) * (static_cast<uint64>(1) << 16);
+    return reinterpret_cast<void *>(static_cast<size_t>(addr + g_olean_mapped_header_size));
+}
+
+/* Compact the module data so that the declaration names come first, followed by the declaration types, the values
+   of definitions, the values of theorems, and then the remaining objects (e.g., environment extension entries).
+   Importing a module only accesses the names and the entries. Thus, when the .olean file is mapped into memory,
+   the pages containing declaration values are only loaded when they are used, e.g., by
+   `type_checker::unfold_definition`. */
+static void compact_module_data(object_compactor & compactor, object * mdata) {
+    array_ref<constant_info> cinfos(cnstr_get(mdata, 1), true);
+    buffer<object_ref> names, types, def_values, thm_values;
+    for (constant_info const & cinfo : cinfos) {
+        names.push_back(cinfo.get_name());
+        types.push_back(cinfo.get_type());
+        if (cinfo.is_definition())
+            def_values.push_back(cinfo.get_value());
+        else if (cinfo.is_theorem())
+            thm_values.push_back(cinfo.get_value());
+    }
+    compactor(array_ref<object_ref>(names).raw());
+    compactor(array_ref<object_ref>(types).raw());
+    compactor(array_ref<object_ref>(def_values).raw());
+    compactor(array_ref<object_ref>(thm_values).raw());
+    compactor(mdata);
+}
 
-extern "C" object * lean_save_module_data(object * fname, object * mdata, object *) {
+extern "C" object * lean_save_module_data(object * fname, object * mdata, uint8 compress, object *) {
     std::string olean_fn(string_cstr(fname));
     object_ref mdata_ref(mdata);
+#if !defined(LEAN_ZLIB)
+    if (compress)
+        return io_result_mk_error("compressed .olean files are not supported by this build");
+#endif
     try {
         exclusive_file_lock output_lock(olean_fn);
-        std::ofstream out(olean_fn, std::ios_base::binary);
+        /* Other processes may have mapped the current file into memory, so we replace it instead of updating it. */
+        std::string tmp_fn = olean_fn + ".tmp";
+        std::ofstream out(tmp_fn, std::ios_base::binary);
         if (out.fail()) {
-            return io_result_mk_error((sstream() << "failed to create file '" << olean_fn << "'").str());
+            return io_result_mk_error((sstream() << "failed to create file '" << tmp_fn << "'").str());
+        }
+        module_hash_cache cache;
+        uint64 module_hash = hash_module_interface(mdata_ref.raw(), cache);
+#if defined(LEAN_ZLIB)
+        if (compress) {
+            object_compactor compactor;
+            compact_module_data(compactor, mdata_ref.raw());
+            write_compressed(out, compactor, module_hash);
+        } else
+#endif
+        {
+            object_compactor compactor(get_olean_base_addr(olean_fn));
+            compact_module_data(compactor, mdata_ref.raw());
+            uint64 base_addr = reinterpret_cast<size_t>(compactor.base_addr());
+            uint64 num_mpzs  = compactor.num_mpzs();
+            out.write(g_olean_mapped_header, strlen(g_olean_mapped_header));
+            out.write(reinterpret_cast<char const *>(&module_hash), sizeof(module_hash));
+            out.write(reinterpret_cast<char const *>(&base_addr), sizeof(base_addr));
+            out.write(reinterpret_cast<char const *>(&num_mpzs), sizeof(num_mpzs));
+            out.write(static_cast<char const *>(compactor.data()), compactor.size());
         }
-        object_compactor compactor;
-        compactor(mdata_ref.raw());
-        out.write(g_olean_header, strlen(g_olean_header));
-        out.write(static_cast<char const *>(compactor.data()), compactor.size());
         out.close();
+        if (out.fail()) {
+            return io_result_mk_error((sstream() << "failed to write file '" << tmp_fn << "'").str());
+        }
+#if defined(LEAN_WINDOWS)
+        std::remove(olean_fn.c_str());
+#endif
+        if (std::rename(tmp_fn.c_str(), olean_fn.c_str()) != 0) {
+            return io_result_mk_error((sstream() << "failed to rename '" << tmp_fn << "' to '" << olean_fn << "'").str());
+        }
         return io_result_mk_ok(box(0));
     } catch (exception & ex) {
         return io_result_mk_error((sstream() << "failed to write '" << olean_fn << "': " << ex.what()).str());
@@ -73,27 +360,86 @@ extern "C" object * lean_read_module_data(object * fname, object *) {
         if (size < header_size) {
             return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "', invalid header").str());
         }
-        char * header = new char[header_size];
-        in.read(header, header_size);
-        if (strncmp(header, g_olean_header, header_size) != 0) {
+        std::string header(header_size, ' ');
+        in.read(&header[0], header_size);
+        char * buffer = nullptr;
+        size_t data_size;
+        void * base_addr = nullptr;
+        compacted_region * region = nullptr;
+        uint64 num_mpzs = 0;
+        if (header == g_olean_mapped_header) {
+            uint64 module_hash, base;
+            if (size < g_olean_mapped_header_size) {
+                return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "', invalid header").str());
+            }
+            in.read(reinterpret_cast<char *>(&module_hash), sizeof(module_hash));
+            in.read(reinterpret_cast<char *>(&base), sizeof(base));
+            in.read(reinterpret_cast<char *>(&num_mpzs), sizeof(num_mpzs));
+            base_addr = reinterpret_cast<void *>(static_cast<size_t>(base));
+            data_size = size - g_olean_mapped_header_size;
+#if defined(LEAN_MMAP_OLEAN)
+            char * mapping_addr = static_cast<char *>(base_addr) - g_olean_mapped_header_size;
+            int fd = base_addr ? open(olean_fn.c_str(), O_RDONLY) : -1;
+            if (fd >= 0) {
+                /* Without `MAP_FIXED`, the address is only a hint, and it is not used if it clashes with an existing mapping. */
+                void * mapping = mmap(mapping_addr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+                close(fd);
+                if (mapping == mapping_addr) {
+                    region = new compacted_region(data_size, base_addr, base_addr, mapping, size);
+                } else if (mapping != MAP_FAILED) {
+                    munmap(mapping, size);
+                }
+            }
+#endif
+            if (!region) {
+                buffer = alloc_olean_buffer(data_size);
+                in.read(buffer, data_size);
+                if (!in) {
+                    free(buffer);
+                    return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "'").str());
+                }
+            }
+        } else if (header == g_olean_header) {
+            data_size = size - header_size;
+            buffer = alloc_olean_buffer(data_size);
+            in.read(buffer, data_size);
+            if (!in) {
+                free(buffer);
+                return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "'").str());
+            }
+        } else if (header == g_olean_zlib_header) {
+#if defined(LEAN_ZLIB)
+            uint64 module_hash;
+            if (size < header_size + sizeof(module_hash)) {
+                return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "', invalid header").str());
+            }
+            in.read(reinterpret_cast<char *>(&module_hash), sizeof(module_hash));
+            buffer = read_compressed(in, size - header_size - sizeof(module_hash), data_size);
+#else
+            return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "', "
+                                      << "compressed .olean files are not supported by this build").str());
+#endif
+        } else {
             return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "', invalid header").str());
         }
-        delete[] header;
-        // use `malloc` here as expected by `compacted_region`
-        char * buffer = static_cast<char *>(malloc(size - header_size));
-        in.read(buffer, size - header_size);
-        if (!in) {
-            return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "'").str());
-        }
         in.close();
-        compacted_region * region = new compacted_region(size - header_size, buffer);
+        bool mapped = region != nullptr;
+        if (!mapped)
+            region = new compacted_region(data_size, buffer, base_addr);
 #if defined(__has_feature)
 #if __has_feature(address_sanitizer)
         // do not report as leak
         __lsan_ignore_object(region);
 #endif
 #endif
-        object * mod = region->read();
+        /* The module data is the last object graph in the region, see `compact_module_data` */
+        object * mod = nullptr;
+        if (mapped && num_mpzs == 0) {
+            mod = region->read_last();
+        } else {
+            while (object * o = region->read())
+                mod = o;
+        }
         object * mod_region = alloc_cnstr(0, 2, 0);
         cnstr_set(mod_region, 0, mod);
         cnstr_set(mod_region, 1, box_size_t(reinterpret_cast<size_t>(region)));
@@ -103,12 +449,73 @@ extern "C" object * lean_read_module_data(object * fname, object *) {
     }
 }
 
+extern "C" object * lean_compacted_region_free(usize region, object *);
+
+static uint64 read_module_hash(std::string const & olean_fn, module_hash_cache & cache) {
+    auto it = cache.find(olean_fn);
+    if (it != cache.end())
+        return it->second;
+    {
+        shared_file_lock olean_lock(olean_fn);
+        std::ifstream in(olean_fn, std::ios_base::binary);
+        if (in.fail())
+            throw exception(sstream() << "failed to open file '" << olean_fn << "'");
+        std::string header(strlen(g_olean_header), ' ');
+        in.read(&header[0], header.size());
+        if (in && (header == g_olean_mapped_header || header == g_olean_zlib_header)) {
+            uint64 module_hash;
+            in.read(reinterpret_cast<char *>(&module_hash), sizeof(module_hash));
+            if (!in)
+                throw exception(sstream() << "failed to read file '" << olean_fn << "', invalid header");
+            cache.insert(std::make_pair(olean_fn, module_hash));
+            return module_hash;
+        }
+        if (!in || header != g_olean_header)
+            throw exception(sstream() << "failed to read file '" << olean_fn << "', invalid header");
+    }
+    /* The hash is not stored in the original format. Remark: `r` must be released before the region is freed,
+       since it references the module data stored in the region. */
+    uint64 module_hash = 0;
+    usize region;
+    optional<exception> ex;
+    {
+        object_ref r = get_io_result<object_ref>(lean_read_module_data(mk_string(olean_fn), io_mk_world()));
+        region = unbox_size_t(cnstr_get(r.raw(), 1));
+        try {
+            module_hash = hash_module_interface(cnstr_get(r.raw(), 0), cache);
+        } catch (exception & e) {
+            ex = e;
+        }
+    }
+    consume_io_result(lean_compacted_region_free(region, io_mk_world()));
+    if (ex)
+        throw *ex;
+    cache.insert(std::make_pair(olean_fn, module_hash));
+    return module_hash;
+}
+
+uint64 read_module_hash(std::string const & olean_fn) {
+    module_hash_cache cache;
+    return read_module_hash(olean_fn, cache);
+}
+
 /*
-@[export lean.write_module_core]
-def writeModule (env : Environment) (fname : String) : IO Unit := */
-extern "C" object * lean_write_module(object * env, object * fname, object *);
+@[export lean_write_module]
+def writeModule (env : Environment) (fname : String) (compress : Bool := false) : IO Unit := */
+extern "C" object * lean_write_module(object * env, object * fname, uint8 compress, object *);
+
+void write_module(environment const & env, std::string const & olean_fn, bool compress) {
+    consume_io_result(lean_write_module(env.to_obj_arg(), mk_string(olean_fn), compress, io_mk_world()));
+}
+
+void initialize_module() {
+    g_olean_compress = new name{"olean", "compress"};
+    mark_persistent(g_olean_compress->raw());
+    register_bool_option(*g_olean_compress, LEAN_DEFAULT_OLEAN_COMPRESS,
+                         "(olean) write compressed .olean files, they are smaller but slower to import");
+}
 
-void write_module(environment const & env, std::string const & olean_fn) {
-    consume_io_result(lean_write_module(env.to_obj_arg(), mk_string(olean_fn), io_mk_world()));
+void finalize_module() {
+    delete g_olean_compress;
 }
 }
@@ -15,6 +15,15 @@ Authors: Leonardo de Moura, Gabriel Ebner, Sebastian Ullrich
 #include "kernel/environment.h"
 
 namespace lean {
-/** \brief Store module using \c env. */
-void write_module(environment const & env, std::string const & olean_fn);
+/** \brief Store module using \c env. If \c compress is true, the .olean file is written in the compressed
+    container format, see `g_olean_zlib_header`. */
+void write_module(environment const & env, std::string const & olean_fn, bool compress = false);
+/** \brief Return the interface hash of the module stored in the given .olean file. Modules importing it do not need
+    to be rebuilt if the hash does not change. */
+uint64 read_module_hash(std::string const & olean_fn);
+/** \brief Return the value of the `olean.compress` option. */
+bool get_olean_compress(options const & opts);
+
+void initialize_module();
+void finalize_module();
 }
@@ -43,10 +43,12 @@ time_task::time_task(std::string const & category, message_builder builder, name
     auto const & opts = builder.get_text_stream().get_options();
     if (get_profiler(opts)) {
         m_timeit = optional<xtimeit>(get_profiling_threshold(opts), [=](second_duration duration) mutable {
-            tout() << m_category;
+            // `tout()` is silent when the task is not run by the C++ elaborator, e.g. for `profileit`
+            std::ostream & out = get_global_ios().get_diagnostic_stream();
+            out << m_category;
             if (decl)
-                tout() << " of " << decl;
-            tout() << " took " << display_profiling_time{duration} << "\n";
+                out << " of " << decl;
+            out << " took " << display_profiling_time{duration} << "\n";
         });
         m_parent_task = g_current_time_task;
         g_current_time_task = this;
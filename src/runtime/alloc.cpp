@@ -366,6 +366,14 @@ void init_thread_heap() {
 extern "C" void * lean_alloc_small(unsigned sz, unsigned slot_idx) {
     page * p = g_heap->m_curr_page[slot_idx];
     void * r = p->m_header.m_free_list;
+    if (LEAN_UNLIKELY(r == nullptr)) {
+        /* Amortize deferred deallocation over page refills, see `lean_set_deferred_free`.
+           The objects being freed may allocate and free other objects (e.g., in finalizers),
+           and change the current page. So, we must reload it. */
+        lean_free_deferred();
+        p = g_heap->m_curr_page[slot_idx];
+        r = p->m_header.m_free_list;
+    }
     if (LEAN_UNLIKELY(r == nullptr)) {
         if (g_heap->m_page_free_list[slot_idx] == nullptr) {
             g_heap->import_objs();
@@ -0,0 +1,58 @@
+/*
+Copyright (c) 2020 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: agent
+*/
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include <lean/lean.h>
+#include <lean/thread.h>
+
+namespace lean {
+/* Call counters registered by functions compiled with `LEAN_CALL_PROFILE`, see `lean.h`. */
+static lean_call_counter * g_call_counters = nullptr;
+
+static mutex & get_call_counters_mutex() {
+    /* Remark: counters may be registered by module initializers, so we cannot rely on `initialize_*` functions here. */
+    static mutex * g_mutex = new mutex();
+    return *g_mutex;
+}
+
+static void save_call_profile() {
+    std::vector<std::pair<size_t, char const *>> cs;
+    {
+        lock_guard<mutex> _(get_call_counters_mutex());
+        for (lean_call_counter * c = g_call_counters; c != nullptr; c = c->m_next)
+            cs.emplace_back(c->m_count.load(std::memory_order_relaxed), c->m_name);
+    }
+    std::sort(cs.begin(), cs.end(), [](std::pair<size_t, char const *> const & c1, std::pair<size_t, char const *> const & c2) {
+            return c1.first > c2.first;
+        });
+    char const * fname = getenv("LEAN_CALL_PROFILE");
+    if (fname == nullptr)
+        fname = "lean_call_profile.txt";
+    FILE * out = fopen(fname, "w");
+    if (out == nullptr) {
+        fprintf(stderr, "failed to create call profile '%s'\n", fname);
+        return;
+    }
+    for (auto const & c : cs)
+        fprintf(out, "%zu %s\n", c.first, c.second);
+    fclose(out);
+}
+
+extern "C" void lean_register_call_counter(lean_call_counter * c) {
+    lock_guard<mutex> _(get_call_counters_mutex());
+    if (c->m_registered.load(std::memory_order_relaxed))
+        return;
+    if (g_call_counters == nullptr)
+        atexit(save_call_profile);
+    c->m_next       = g_call_counters;
+    g_call_counters = c;
+    c->m_registered.store(true, std::memory_order_release);
+}
+}
@@ -11,6 +11,9 @@ Author: Leonardo de Moura
 #include <lean/hash.h>
 #include <lean/lean.h>
 #include <lean/compact.h>
+#if !defined(LEAN_WINDOWS)
+#include <sys/mman.h>
+#endif
 
 #define LEAN_COMPACTOR_INIT_SZ 1024*1024
 #define LEAN_MAX_SHARING_TABLE_INITIAL_SIZE 1024*1024
@@ -62,11 +65,13 @@ struct terminator_object {
     lean_object * m_value;
 };
 
-object_compactor::object_compactor():
+object_compactor::object_compactor(void * base_addr):
     m_max_sharing_table(new max_sharing_table(this)),
     m_begin(malloc(LEAN_COMPACTOR_INIT_SZ)),
     m_end(m_begin),
-    m_capacity(static_cast<char*>(m_begin) + LEAN_COMPACTOR_INIT_SZ) {
+    m_capacity(static_cast<char*>(m_begin) + LEAN_COMPACTOR_INIT_SZ),
+    m_base_addr(base_addr),
+    m_num_mpzs(0) {
 }
 
 object_compactor::~object_compactor() {
@@ -102,7 +107,7 @@ void * object_compactor::alloc(size_t sz) {
 
 void object_compactor::save(object * o, object * new_o) {
     lean_assert(m_begin <= new_o && new_o < m_end);
-    m_obj_table.insert(std::make_pair(o, reinterpret_cast<object_offset>(reinterpret_cast<char*>(new_o) - reinterpret_cast<char*>(m_begin))));
+    m_obj_table.insert(std::make_pair(o, reinterpret_cast<object_offset>(static_cast<char*>(m_base_addr) + (reinterpret_cast<char*>(new_o) - reinterpret_cast<char*>(m_begin)))));
 }
 
 void object_compactor::save_max_sharing(object * o, object * new_o, size_t new_o_sz) {
@@ -172,7 +177,7 @@ void object_compactor::insert_string(object * o) {
     new_o->m_size     = sz;
     new_o->m_capacity = sz;
     new_o->m_length   = len;
-    memcpy(new_o->m_data, lean_to_string(o)->m_data, sz);
+    memcpy(new_o->m_data, lean_string_cstr(o), sz);
     save_max_sharing(o, (lean_object*)new_o, obj_sz);
 }
 
@@ -277,6 +282,7 @@ void object_compactor::insert_mpz(object * o) {
     object * new_o = (lean_object*)alloc(sz);
     lean_set_non_heap_header((lean_object*)new_o, sz, LeanMPZ, 0);
     save(o, (lean_object*)new_o);
+    m_num_mpzs++;
     void * data    = reinterpret_cast<char*>(new_o) + sizeof(mpz_object);
     memcpy(data, s.c_str(), s.size() + 1);
 }
@@ -353,17 +359,29 @@ void object_compactor::operator()(object * o) {
     insert_terminator(o);
 }
 
-compacted_region::compacted_region(size_t sz, void * data):
+compacted_region::compacted_region(size_t sz, void * data, void * base_addr):
     m_begin(data),
     m_next(data),
     m_end(static_cast<char*>(data)+sz),
+    m_base_addr(base_addr),
+    m_mapping(nullptr),
+    m_mapping_size(0),
     m_nested_mpzs(nullptr) {
 }
 
+compacted_region::compacted_region(size_t sz, void * data, void * base_addr, void * mapping, size_t mapping_size):
+    compacted_region(sz, data, base_addr) {
+    m_mapping      = mapping;
+    m_mapping_size = mapping_size;
+}
+
 compacted_region::compacted_region(object_compactor const & c):
     m_begin(malloc(c.size())),
     m_next(m_begin),
     m_end(static_cast<char*>(m_begin) + c.size()),
+    m_base_addr(c.base_addr()),
+    m_mapping(nullptr),
+    m_mapping_size(0),
     m_nested_mpzs(nullptr) {
     memcpy(m_begin, c.data(), c.size());
 }
@@ -373,12 +391,20 @@ compacted_region::~compacted_region() {
         m_nested_mpzs->m_value.~mpz();
         m_nested_mpzs = *reinterpret_cast<mpz_object**>(reinterpret_cast<char*>(m_nested_mpzs) + sizeof(mpz_object));
     }
-    free(m_begin);
+    if (m_mapping) {
+#if !defined(LEAN_WINDOWS)
+        munmap(m_mapping, m_mapping_size);
+#else
+        lean_unreachable();
+#endif
+    } else {
+        free(m_begin);
+    }
 }
 
 inline object * compacted_region::fix_object_ptr(object * o) {
     if (lean_is_scalar(o)) return o;
-    return reinterpret_cast<object*>(static_cast<char*>(m_begin) + reinterpret_cast<size_t>(o));
+    return reinterpret_cast<object*>(static_cast<char*>(m_begin) + (reinterpret_cast<char*>(o) - static_cast<char*>(m_base_addr)));
 }
 
 inline void compacted_region::move(size_t d) {
@@ -482,8 +508,24 @@ object * compacted_region::read() {
     }
 }
 
+object * compacted_region::read_last() {
+    lean_assert(m_begin == m_base_addr);
+    if (m_next == m_end)
+        return nullptr;
+    terminator_object * t = reinterpret_cast<terminator_object*>(static_cast<char*>(m_end) - sizeof(terminator_object));
+    lean_assert(lean_ptr_tag(reinterpret_cast<object*>(t)) == LeanReserved);
+    m_next = m_end;
+    return t->m_value;
+}
+
+static void delete_compacted_region(void * region) {
+    delete static_cast<compacted_region *>(region);
+}
+
 extern "C" obj_res lean_compacted_region_free(usize region, object *) {
-    delete reinterpret_cast<compacted_region *>(region);
+    /* Dead objects waiting to be freed, in the queue of any thread, may still point to the region. */
+    lean_flush_deferred();
+    lean_run_after_deferred_free(delete_compacted_region, reinterpret_cast<void *>(region));
     return lean_io_result_mk_ok(lean_box(0));
 }
 }
@@ -12,6 +12,7 @@ Author: Leonardo de Moura
 #include <lean/io.h>
 #include <lean/stack_overflow.h>
 #include <lean/process.h>
+#include <lean/sharecommon.h>
 
 namespace lean {
 extern "C" void lean_initialize_runtime_module() {
@@ -19,6 +20,7 @@ extern "C" void lean_initialize_runtime_module() {
     initialize_debug();
     initialize_object();
     initialize_io();
+    initialize_sharecommon();
     initialize_serializer();
     initialize_thread();
     initialize_process();
@@ -32,6 +34,7 @@ void finalize_runtime_module() {
     finalize_process();
     finalize_thread();
     finalize_serializer();
+    finalize_sharecommon();
     finalize_io();
     finalize_object();
     finalize_debug();
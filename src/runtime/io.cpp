@@ -25,6 +25,8 @@ Author: Leonardo de Moura
 #include <fstream>
 #include <iomanip>
 #include <string>
+#include <memory>
+#include <vector>
 #include <cstdlib>
 #include <cctype>
 #include <sys/stat.h>
@@ -89,6 +91,7 @@ obj_res io_result_mk_error(std::string const & msg) {
 static bool g_initializing = true;
 extern "C" void lean_io_mark_end_initialization() {
     g_initializing = false;
+    io_end_init_refs();
 }
 extern "C" obj_res lean_io_initializing(obj_arg) {
     return io_result_mk_ok(box(g_initializing));
@@ -380,6 +383,387 @@ extern "C" obj_res lean_io_prim_handle_put_str(b_obj_arg h, b_obj_arg s, obj_arg
     }
 }
 
+/* File descriptor handles (`IO.FS.FdHandle`).
+
+   Unlike `FILE*` handles, reads are served from a buffer owned by the handle, `getLine` creates the resulting string
+   directly from the buffer, and large reads and writes bypass the buffer. `pread` and `pwrite` do not use or move
+   the file position, and can be executed concurrently from different tasks. */
+
+#define LEAN_FD_BUFFER_SIZE 65536
+
+struct fd_handle {
+    int                     m_fd;
+    mutex                   m_mutex;
+    std::unique_ptr<char[]> m_rbuf;
+    size_t                  m_rbegin = 0;
+    size_t                  m_rend   = 0;
+    std::unique_ptr<char[]> m_wbuf;
+    size_t                  m_wsize  = 0;
+    bool                    m_eof    = false;
+    explicit fd_handle(int fd):m_fd(fd), m_rbuf(new char[LEAN_FD_BUFFER_SIZE]), m_wbuf(new char[LEAN_FD_BUFFER_SIZE]) {}
+};
+
+static lean_external_class * g_fd_handle_external_class = nullptr;
+
+static fd_handle * fd_get_handle(b_obj_arg h) {
+    return static_cast<fd_handle *>(lean_get_external_data(h));
+}
+
+static ssize_t fd_read_core(int fd, char * out, size_t n) {
+    while (true) {
+        ssize_t r = ::read(fd, out, n);
+        if (r >= 0 || errno != EINTR) return r;
+    }
+}
+
+/* Write all `n` bytes. Return `false` and set `errno` on failure. */
+static bool fd_write_core(int fd, char const * in, size_t n) {
+    while (n > 0) {
+        ssize_t r = ::write(fd, in, n);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        in += r;
+        n  -= r;
+    }
+    return true;
+}
+
+static bool fd_flush_core(fd_handle * h) {
+    bool ok = fd_write_core(h->m_fd, h->m_wbuf.get(), h->m_wsize);
+    h->m_wsize = 0;
+    return ok;
+}
+
+/* Move the file position back to the first unconsumed byte in the read buffer before writing. */
+static void fd_discard_read_buffer(fd_handle * h) {
+    if (h->m_rend > h->m_rbegin)
+        lseek(h->m_fd, -static_cast<off_t>(h->m_rend - h->m_rbegin), SEEK_CUR);
+    h->m_rbegin = h->m_rend = 0;
+}
+
+/* Read up to `n` bytes into `out`, stopping only at the end of the file. Return the number of bytes read, or -1 on failure. */
+static ssize_t fd_read(fd_handle * h, char * out, size_t n) {
+    if (h->m_wsize > 0 && !fd_flush_core(h)) return -1;
+    size_t r = 0;
+    while (r < n) {
+        if (h->m_rbegin < h->m_rend) {
+            size_t m = std::min(n - r, h->m_rend - h->m_rbegin);
+            memcpy(out + r, h->m_rbuf.get() + h->m_rbegin, m);
+            h->m_rbegin += m;
+            r += m;
+        } else if (n - r >= LEAN_FD_BUFFER_SIZE) {
+            /* Large reads go directly into the destination buffer. */
+            ssize_t m = fd_read_core(h->m_fd, out + r, n - r);
+            if (m < 0) return -1;
+            if (m == 0) { h->m_eof = true; break; }
+            r += m;
+        } else {
+            ssize_t m = fd_read_core(h->m_fd, h->m_rbuf.get(), LEAN_FD_BUFFER_SIZE);
+            if (m < 0) return -1;
+            if (m == 0) { h->m_eof = true; break; }
+            h->m_rbegin = 0;
+            h->m_rend   = m;
+        }
+    }
+    return r;
+}
+
+static bool fd_write(fd_handle * h, char const * in, size_t n) {
+    fd_discard_read_buffer(h);
+    if (h->m_wsize + n > LEAN_FD_BUFFER_SIZE && !fd_flush_core(h))
+        return false;
+    if (n >= LEAN_FD_BUFFER_SIZE)
+        return fd_write_core(h->m_fd, in, n);
+    memcpy(h->m_wbuf.get() + h->m_wsize, in, n);
+    h->m_wsize += n;
+    return true;
+}
+
+static ssize_t fd_pread(int fd, char * out, size_t n, uint64 off) {
+    size_t r = 0;
+    while (r < n) {
+#if defined(LEAN_WINDOWS)
+        ssize_t m = -1;
+        if (_lseeki64(fd, off + r, SEEK_SET) >= 0)
+            m = ::read(fd, out + r, n - r);
+#else
+        ssize_t m = ::pread(fd, out + r, n - r, off + r);
+#endif
+        if (m < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (m == 0) break;
+        r += m;
+    }
+    return r;
+}
+
+static bool fd_pwrite(int fd, char const * in, size_t n, uint64 off) {
+    size_t r = 0;
+    while (r < n) {
+#if defined(LEAN_WINDOWS)
+        ssize_t m = -1;
+        if (_lseeki64(fd, off + r, SEEK_SET) >= 0)
+            m = ::write(fd, in + r, n - r);
+#else
+        ssize_t m = ::pwrite(fd, in + r, n - r, off + r);
+#endif
+        if (m < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        r += m;
+    }
+    return true;
+}
+
+static void fd_handle_finalizer(void * p) {
+    fd_handle * h = static_cast<fd_handle *>(p);
+    fd_flush_core(h);
+    close(h->m_fd);
+    delete h;
+}
+
+static void fd_handle_foreach(void * /* mod */, b_obj_arg /* fn */) {
+}
+
+/* FdHandle.mk (filename : @& String) (mode : FS.Mode) : IO FdHandle */
+extern "C" obj_res lean_io_prim_fd_handle_mk(b_obj_arg filename, uint8 mode, obj_arg /* w */) {
+    int flags;
+    switch (mode) {
+    case 0:  flags = O_RDONLY; break;
+    case 1:  flags = O_WRONLY | O_CREAT | O_TRUNC; break;
+    case 2:  flags = O_RDWR; break;
+    default: flags = O_WRONLY | O_CREAT | O_APPEND; break;
+    }
+#if defined(LEAN_WINDOWS)
+    flags |= O_BINARY;
+#endif
+    int fd = open(lean_string_cstr(filename), flags, 0666);
+    if (fd < 0) {
+        return io_result_mk_error(decode_io_error(errno, filename));
+    } else {
+        return io_result_mk_ok(lean_alloc_external(g_fd_handle_external_class, new fd_handle(fd)));
+    }
+}
+
+/* FdHandle.isEof : (@& FdHandle) → IO Bool */
+extern "C" obj_res lean_io_prim_fd_handle_is_eof(b_obj_arg h0, obj_arg /* w */) {
+    fd_handle * h = fd_get_handle(h0);
+    lock_guard<mutex> _(h->m_mutex);
+    return io_result_mk_ok(box(h->m_eof && h->m_rbegin == h->m_rend));
+}
+
+/* FdHandle.flush : (@& FdHandle) → IO Unit */
+extern "C" obj_res lean_io_prim_fd_handle_flush(b_obj_arg h0, obj_arg /* w */) {
+    fd_handle * h = fd_get_handle(h0);
+    lock_guard<mutex> _(h->m_mutex);
+    if (fd_flush_core(h)) {
+        return io_result_mk_ok(box(0));
+    } else {
+        return io_result_mk_error(decode_io_error(errno, nullptr));
+    }
+}
+
+/* FdHandle.read : (@& FdHandle) → USize → IO ByteArray */
+extern "C" obj_res lean_io_prim_fd_handle_read(b_obj_arg h0, usize nbytes, obj_arg /* w */) {
+    fd_handle * h = fd_get_handle(h0);
+    lock_guard<mutex> _(h->m_mutex);
+    if (h->m_eof && h->m_rbegin == h->m_rend) {
+        return io_result_mk_error(g_io_error_eof);
+    }
+    obj_res res = lean_alloc_sarray(1, 0, nbytes);
+    ssize_t n   = fd_read(h, reinterpret_cast<char *>(lean_sarray_cptr(res)), nbytes);
+    if (n < 0) {
+        dec_ref(res);
+        return io_result_mk_error(decode_io_error(errno, nullptr));
+    }
+    lean_sarray_set_size(res, n);
+    return io_result_mk_ok(res);
+}
+
+/* FdHandle.readToByteArray : (@& FdHandle) → ByteArray → USize → IO ByteArray */
+extern "C" obj_res lean_io_prim_fd_handle_read_to_byte_array(b_obj_arg h0, obj_arg buf, usize nbytes, obj_arg /* w */) {
+    fd_handle * h = fd_get_handle(h0);
+    lock_guard<mutex> _(h->m_mutex);
+    size_t sz = lean_sarray_size(buf);
+    buf = lean_sarray_ensure_exclusive(lean_sarray_ensure_capacity(buf, sz + nbytes, /* exact */ false));
+    ssize_t n = fd_read(h, reinterpret_cast<char *>(lean_sarray_cptr(buf)) + sz, nbytes);
+    if (n < 0) {
+        dec_ref(buf);
+        return io_result_mk_error(decode_io_error(errno, nullptr));
+    }
+    lean_sarray_set_size(buf, sz + n);
+    return io_result_mk_ok(buf);
+}
+
+/* FdHandle.write : (@& FdHandle) → (@& ByteArray) → IO Unit */
+extern "C" obj_res lean_io_prim_fd_handle_write(b_obj_arg h0, b_obj_arg buf, obj_arg /* w */) {
+    fd_handle * h = fd_get_handle(h0);
+    lock_guard<mutex> _(h->m_mutex);
+    if (fd_write(h, reinterpret_cast<char const *>(lean_sarray_cptr(buf)), lean_sarray_size(buf))) {
+        return io_result_mk_ok(box(0));
+    } else {
+        return io_result_mk_error(decode_io_error(errno, nullptr));
+    }
+}
+
+/* FdHandle.getLine : (@& FdHandle) → IO String
+   The result includes the trailing `'\n'`, and it is empty only at the end of the file. */
+extern "C" obj_res lean_io_prim_fd_handle_get_line(b_obj_arg h0, obj_arg /* w */) {
+    fd_handle * h = fd_get_handle(h0);
+    lock_guard<mutex> _(h->m_mutex);
+    if (h->m_wsize > 0 && !fd_flush_core(h))
+        return io_result_mk_error(decode_io_error(errno, nullptr));
+    /* Only lines that cross a buffer boundary are accumulated in `acc`. */
+    std::string acc;
+    while (true) {
+        char const * begin = h->m_rbuf.get() + h->m_rbegin;
+        size_t avail       = h->m_rend - h->m_rbegin;
+        if (char const * nl = static_cast<char const *>(memchr(begin, '\n', avail))) {
+            size_t m     = nl - begin + 1;
+            h->m_rbegin += m;
+            if (acc.empty()) {
+                return io_result_mk_ok(lean_mk_string_from_bytes(begin, m));
+            } else {
+                acc.append(begin, m);
+                return io_result_mk_ok(lean_mk_string_from_bytes(acc.data(), acc.size()));
+            }
+        }
+        acc.append(begin, avail);
+        h->m_rbegin = h->m_rend = 0;
+        ssize_t m = fd_read_core(h->m_fd, h->m_rbuf.get(), LEAN_FD_BUFFER_SIZE);
+        if (m < 0) {
+            return io_result_mk_error(decode_io_error(errno, nullptr));
+        } else if (m == 0) {
+            h->m_eof = true;
+            return io_result_mk_ok(lean_mk_string_from_bytes(acc.data(), acc.size()));
+        }
+        h->m_rend = m;
+    }
+}
+
+/* FdHandle.putStr : (@& FdHandle) → (@& String) → IO Unit */
+extern "C" obj_res lean_io_prim_fd_handle_put_str(b_obj_arg h0, b_obj_arg s, obj_arg /* w */) {
+    fd_handle * h = fd_get_handle(h0);
+    lock_guard<mutex> _(h->m_mutex);
+    if (fd_write(h, lean_string_cstr(s), lean_string_size(s) - 1)) {
+        return io_result_mk_ok(box(0));
+    } else {
+        return io_result_mk_error(decode_io_error(errno, nullptr));
+    }
+}
+
+/* FdHandle.pread : (@& FdHandle) → (offset : UInt64) → USize → IO ByteArray */
+extern "C" obj_res lean_io_prim_fd_handle_pread(b_obj_arg h0, uint64 off, usize nbytes, obj_arg /* w */) {
+    fd_handle * h = fd_get_handle(h0);
+    {
+        lock_guard<mutex> _(h->m_mutex);
+        if (h->m_wsize > 0 && !fd_flush_core(h))
+            return io_result_mk_error(decode_io_error(errno, nullptr));
+    }
+    obj_res res = lean_alloc_sarray(1, 0, nbytes);
+    ssize_t n   = fd_pread(h->m_fd, reinterpret_cast<char *>(lean_sarray_cptr(res)), nbytes, off);
+    if (n < 0) {
+        dec_ref(res);
+        return io_result_mk_error(decode_io_error(errno, nullptr));
+    }
+    lean_sarray_set_size(res, n);
+    return io_result_mk_ok(res);
+}
+
+/* FdHandle.pwrite : (@& FdHandle) → (offset : UInt64) → (@& ByteArray) → IO Unit */
+extern "C" obj_res lean_io_prim_fd_handle_pwrite(b_obj_arg h0, uint64 off, b_obj_arg buf, obj_arg /* w */) {
+    fd_handle * h = fd_get_handle(h0);
+    {
+        lock_guard<mutex> _(h->m_mutex);
+        if (h->m_wsize > 0 && !fd_flush_core(h))
+            return io_result_mk_error(decode_io_error(errno, nullptr));
+    }
+    if (fd_pwrite(h->m_fd, reinterpret_cast<char const *>(lean_sarray_cptr(buf)), lean_sarray_size(buf), off)) {
+        return io_result_mk_ok(box(0));
+    } else {
+        return io_result_mk_error(decode_io_error(errno, nullptr));
+    }
+}
+
+// =======================================
+// Memory-mapped files
+
+#if !defined(LEAN_WINDOWS)
+/* `lean_io_prim_mmap` reserves one extra page in front of the file contents.
+   The object header is stored at the end of this page, and the file is mapped right after it. */
+static size_t mmap_page_size() {
+    static size_t r = sysconf(_SC_PAGESIZE);
+    return r;
+}
+
+extern "C" void lean_free_mapped_sarray(lean_object * o) {
+    size_t page = mmap_page_size();
+    munmap(reinterpret_cast<char*>(lean_sarray_cptr(o)) - page, page + lean_sarray_size(o));
+}
+#else
+extern "C" void lean_free_mapped_sarray(lean_object *) {
+    lean_unreachable();
+}
+#endif
+
+/* mmap : (@& String) → IO ByteArray
+
+   The file is mapped using `MAP_PRIVATE`. Thus, destructive updates to the resulting array are not written back
+   to the file. On Windows, the file contents are read into a regular byte array. */
+extern "C" obj_res lean_io_prim_mmap(b_obj_arg filename, obj_arg /* w */) {
+    int flags = O_RDONLY;
+#if defined(LEAN_WINDOWS)
+    flags |= O_BINARY;
+#endif
+    int fd = open(lean_string_cstr(filename), flags);
+    if (fd < 0)
+        return io_result_mk_error(decode_io_error(errno, filename));
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int e = errno;
+        close(fd);
+        return io_result_mk_error(decode_io_error(e, filename));
+    }
+    size_t sz = st.st_size;
+    if (sz == 0) {
+        close(fd);
+        return io_result_mk_ok(lean_alloc_sarray(1, 0, 0));
+    }
+#if defined(LEAN_WINDOWS)
+    object * r = lean_alloc_sarray(1, 0, sz);
+    ssize_t n  = fd_pread(fd, reinterpret_cast<char*>(lean_sarray_cptr(r)), sz, 0);
+    int e      = errno;
+    close(fd);
+    if (n < 0) {
+        lean_dec_ref(r);
+        return io_result_mk_error(decode_io_error(e, filename));
+    }
+    lean_sarray_set_size(r, n);
+    return io_result_mk_ok(r);
+#else
+    size_t page = mmap_page_size();
+    char * base = static_cast<char*>(mmap(nullptr, page + sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (base == MAP_FAILED || mmap(base + page, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        int e = errno;
+        if (base != MAP_FAILED) munmap(base, page + sz);
+        close(fd);
+        return io_result_mk_error(decode_io_error(e, filename));
+    }
+    close(fd);
+    lean_sarray_object * r = reinterpret_cast<lean_sarray_object*>(base + page - sizeof(lean_sarray_object));
+    lean_set_st_header(reinterpret_cast<lean_object*>(r), LeanScalarArray, 1);
+    r->m_size     = sz;
+    r->m_capacity = 0;
+    lean_assert(lean_sarray_is_mapped(reinterpret_cast<lean_object*>(r)));
+    return io_result_mk_ok(reinterpret_cast<lean_object*>(r));
+#endif
+}
+
 /* timeit {α : Type} (msg : @& String) (fn : IO α) : IO α */
 extern "C" obj_res lean_io_timeit(b_obj_arg msg, obj_arg fn, obj_arg w) {
     auto start = std::chrono::steady_clock::now();
@@ -533,8 +917,43 @@ static inline atomic<object*> * mt_ref_val_addr(object * o) {
   a value `val` into a global `ST.Ref`, we have to mark `va`l as a multi-threaded
   object as we do for multi-threaded `ST.Ref`s. It makes sense since
   the global `ST.Ref` may be used to communicate data between threads.
+
+  However, initialization is single threaded, and many initializers update
+  the global `ST.Ref`s created by previous ones (e.g., to register builtin
+  parsers and attributes). Marking the values as persistent or multi-threaded
+  would force each update to copy them. Thus, `lean_mark_persistent` does not
+  mark the values of refs during initialization, and we treat the refs as
+  single threaded until `io_end_init_refs` marks their values as multi-threaded.
 */
-static inline bool ref_maybe_mt(b_obj_arg ref) { return lean_is_mt(ref) || lean_is_persistent(ref); }
+static bool g_init_refs_active = true;
+static std::vector<object *> * g_init_refs = nullptr;
+
+bool io_register_init_ref(object * ref) {
+    if (!g_init_refs_active)
+        return false;
+    if (g_init_refs == nullptr)
+        g_init_refs = new std::vector<object *>();
+    g_init_refs->push_back(ref);
+    return true;
+}
+
+void io_end_init_refs() {
+    if (!g_init_refs_active)
+        return;
+    g_init_refs_active = false;
+    if (g_init_refs != nullptr) {
+        for (object * ref : *g_init_refs) {
+            if (object * val = lean_to_ref(ref)->m_value)
+                mark_mt(val);
+        }
+        delete g_init_refs;
+        g_init_refs = nullptr;
+    }
+}
+
+static inline bool ref_maybe_mt(b_obj_arg ref) {
+    return lean_is_mt(ref) || (lean_is_persistent(ref) && !g_init_refs_active);
+}
 
 extern "C" obj_res lean_st_ref_get(b_obj_arg ref, obj_arg) {
     if (ref_maybe_mt(ref)) {
@@ -708,6 +1127,7 @@ void initialize_io() {
     g_io_error_eof = lean_mk_io_error_eof(lean_box(0));
     mark_persistent(g_io_error_eof);
     g_io_handle_external_class = lean_register_external_class(io_handle_finalizer, io_handle_foreach);
+    g_fd_handle_external_class = lean_register_external_class(fd_handle_finalizer, fd_handle_foreach);
 #if defined(LEAN_WINDOWS)
     _setmode(_fileno(stdout), _O_BINARY);
     _setmode(_fileno(stderr), _O_BINARY);
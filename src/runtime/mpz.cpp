@@ -30,6 +30,20 @@ mpz::mpz(int64 v) {
         mpz_neg(m_val, m_val);
 }
 
+#ifdef LEAN_MPZ_TWO_LIMB
+mpz mpz::of_uint128(unsigned __int128 v, bool is_neg) {
+    mpz r;
+    mp_limb_t lo = static_cast<mp_limb_t>(v);
+    mp_limb_t hi = static_cast<mp_limb_t>(v >> 64);
+    mp_limb_t * d = mpz_limbs_write(r.m_val, 2);
+    d[0] = lo;
+    d[1] = hi;
+    mp_size_t n = hi != 0 ? 2 : (lo != 0 ? 1 : 0);
+    mpz_limbs_finish(r.m_val, is_neg ? -n : n);
+    return r;
+}
+#endif
+
 size_t mpz::get_size_t() const {
     // GMP only features accessors up to `unsigned long`, which is smaller than `size_t` on Windows.
     // So we directly access the lowest mpz word instead.
@@ -9,6 +9,10 @@ Author: Leonardo de Moura
 #include <vector>
 #include <deque>
 #include <cmath>
+#include <limits>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include <lean/object.h>
 #include <lean/thread.h>
 #include <lean/utf8.h>
@@ -17,6 +21,7 @@ Author: Leonardo de Moura
 #include <lean/hash.h>
 #include <lean/flet.h>
 #include <lean/interrupt.h>
+#include <lean/io.h>
 #include "util/buffer.h" // move to runtime
 
 // see `Task.Priority.max`
@@ -98,7 +103,9 @@ static inline void lean_dealloc(lean_object * o, size_t sz) {
 extern "C" void lean_free_object(lean_object * o) {
     switch (lean_ptr_tag(o)) {
     case LeanArray:       return lean_dealloc(o, lean_array_byte_size(o));
-    case LeanScalarArray: return lean_dealloc(o, lean_sarray_byte_size(o));
+    case LeanScalarArray:
+        if (lean_sarray_is_mapped(o)) return lean_free_mapped_sarray(o);
+        return lean_dealloc(o, lean_sarray_byte_size(o));
     case LeanString:      return lean_dealloc(o, lean_string_byte_size(o));
     case LeanMPZ:         to_mpz(o)->m_value.~mpz(); return lean_free_small_object(o);
     default:              return lean_free_small_object(o);
@@ -155,6 +162,8 @@ extern "C" lean_object * lean_alloc_object(size_t sz) {
          object * o = pop_back(g_to_free);
          lean_del_core(o, g_to_free);
      }
+#else
+    lean_free_deferred();
 #endif
 #ifdef LEAN_SMALL_ALLOCATOR
     return (lean_object*)alloc(sz);
@@ -191,9 +200,18 @@ static void lean_del_core(object * o, object * & todo) {
             break;
         }
         case LeanScalarArray:
-            lean_dealloc(o, lean_sarray_byte_size(o));
+            if (lean_sarray_is_mapped(o))
+                lean_free_mapped_sarray(o);
+            else
+                lean_dealloc(o, lean_sarray_byte_size(o));
             break;
         case LeanString:
+            if (lean_string_is_rope(o)) {
+                lean_string_rope_object * r = lean_to_string_rope(o);
+                if (object * f = r->m_flat) dec(f, todo);
+                dec(r->m_left, todo);
+                if (object * c = r->m_right) dec(c, todo);
+            }
             lean_dealloc(o, lean_string_byte_size(o));
             break;
         case LeanMPZ:
@@ -222,10 +240,216 @@ static void lean_del_core(object * o, object * & todo) {
     }
 }
 
+// =======================================
+// Deferred deallocation
+
+/* When `g_del_budget > 0`, `lean_del` frees at most `g_del_budget` objects, and the remaining dead objects
+   are stored in the thread local queue `g_deferred`. See `lean_set_deferred_free`. */
+static unsigned g_del_budget       = 0;
+static unsigned g_del_alloc_budget = 0;
+static bool     g_del_background   = false;
+LEAN_THREAD_PTR(object, g_deferred);
+LEAN_THREAD_VALUE(bool, g_freeing_deferred, false);
+LEAN_THREAD_VALUE(bool, g_deferred_finalizer, false);
+/* Number of threads whose queue `g_deferred` is not empty. */
+static atomic<unsigned> g_num_deferred_queues(0);
+
+static void run_after_deferred_free_actions();
+
+/* Free at most `budget` objects from the thread local queue. */
+static void free_deferred(unsigned budget) {
+    /* `lean_del_core` may invoke finalizers of external objects, and they may allocate memory. */
+    if (g_freeing_deferred || g_deferred == nullptr)
+        return;
+    {
+        flet<bool> set(g_freeing_deferred, true);
+        while (g_deferred && budget > 0) {
+            object * o = pop_back(g_deferred);
+            lean_del_core(o, g_deferred);
+            budget--;
+        }
+    }
+    if (g_deferred == nullptr && --g_num_deferred_queues == 0)
+        run_after_deferred_free_actions();
+}
+
+static void finalize_deferred(void *) {
+    free_deferred(std::numeric_limits<unsigned>::max());
+}
+
+extern "C" void lean_free_deferred() {
+    if (LEAN_UNLIKELY(g_deferred != nullptr))
+        free_deferred(g_del_alloc_budget);
+}
+
+#if defined(LEAN_MULTI_THREAD)
+/* Background thread for freeing multi-threaded object graphs. Recall that multi-threaded objects
+   only contain references to multi-threaded and persistent objects. Thus, their reference counters
+   can be safely updated by the reclaimer thread. */
+class deferred_free_reclaimer {
+    mutex                 m_mutex;
+    condition_variable    m_queue_cv;
+    condition_variable    m_idle_cv;
+    /* Each element is a list of dead objects. */
+    std::vector<object *> m_queue;
+    bool                  m_busy{false};
+
+    void run() {
+        unique_lock<mutex> lock(m_mutex);
+        while (true) {
+            if (m_queue.empty()) {
+                m_busy = false;
+                m_idle_cv.notify_all();
+                lock.unlock();
+                run_after_deferred_free_actions();
+                lock.lock();
+                if (m_queue.empty())
+                    m_queue_cv.wait(lock);
+                continue;
+            }
+            m_busy = true;
+            object * todo = m_queue.back();
+            m_queue.pop_back();
+            lock.unlock();
+            while (todo) {
+                object * o = pop_back(todo);
+                lean_del_core(o, todo);
+            }
+            lock.lock();
+        }
+    }
+public:
+    deferred_free_reclaimer() {
+        lthread([this]() {
+                save_stack_info(false);
+                run();
+            });
+        // `lthread` will be implicitly freed, which frees up its control resources but does not terminate the thread
+    }
+
+    void add(object * todo) {
+        unique_lock<mutex> lock(m_mutex);
+        m_queue.push_back(todo);
+        m_busy = true;
+        m_queue_cv.notify_one();
+    }
+
+    void wait_idle() {
+        unique_lock<mutex> lock(m_mutex);
+        while (m_busy)
+            m_idle_cv.wait(lock);
+    }
+
+    bool is_idle() {
+        unique_lock<mutex> lock(m_mutex);
+        return !m_busy;
+    }
+};
+
+/* The reclaimer thread runs until the process terminates. Thus, we never delete it. */
+static deferred_free_reclaimer * g_reclaimer = nullptr;
+#endif
+
+extern "C" void lean_set_deferred_free(unsigned budget, unsigned alloc_budget, bool background) {
+    g_del_budget       = budget;
+    g_del_alloc_budget = alloc_budget;
+#if defined(LEAN_MULTI_THREAD)
+    g_del_background   = budget > 0 && background;
+    if (g_del_background && !g_reclaimer)
+        g_reclaimer = new deferred_free_reclaimer();
+#else
+    (void)background;
+#endif
+}
+
+extern "C" void lean_flush_deferred() {
+    free_deferred(std::numeric_limits<unsigned>::max());
+#if defined(LEAN_MULTI_THREAD)
+    if (g_reclaimer)
+        g_reclaimer->wait_idle();
+#endif
+}
+
+/* Actions waiting for the deferred deallocation queues of all threads to be empty, see `lean_run_after_deferred_free`.
+   Remark: the queues of other threads cannot be flushed by the current thread since they contain single threaded objects. */
+static std::vector<std::pair<void (*)(void *), void *>> * g_after_deferred_free = nullptr;
+
+static mutex & get_after_deferred_free_mutex() {
+    static mutex * g_mutex = new mutex();
+    return *g_mutex;
+}
+
+/* Return true if there are no dead objects waiting to be freed. We must hold `get_after_deferred_free_mutex()`. */
+static bool all_deferred_freed() {
+    if (g_num_deferred_queues != 0)
+        return false;
+#if defined(LEAN_MULTI_THREAD)
+    if (g_reclaimer && !g_reclaimer->is_idle())
+        return false;
+#endif
+    return true;
+}
+
+static void run_after_deferred_free_actions() {
+    std::vector<std::pair<void (*)(void *), void *>> actions;
+    {
+        lock_guard<mutex> lock(get_after_deferred_free_mutex());
+        if (g_after_deferred_free == nullptr || !all_deferred_freed())
+            return;
+        actions.swap(*g_after_deferred_free);
+    }
+    for (auto const & a : actions)
+        a.first(a.second);
+}
+
+extern "C" void lean_run_after_deferred_free(void (*fn)(void *), void * data) {
+    {
+        lock_guard<mutex> lock(get_after_deferred_free_mutex());
+        if (!all_deferred_freed()) {
+            if (g_after_deferred_free == nullptr)
+                g_after_deferred_free = new std::vector<std::pair<void (*)(void *), void *>>();
+            g_after_deferred_free->emplace_back(fn, data);
+            return;
+        }
+    }
+    fn(data);
+}
+
+static void del_deferred(object * o) {
+#if defined(LEAN_MULTI_THREAD)
+    if (g_del_background && lean_is_mt(o)) {
+        /* We free the graph in the current thread, and send it to the reclaimer if it is too big. */
+        object * todo = nullptr;
+        unsigned budget = g_del_budget;
+        while (true) {
+            lean_del_core(o, todo);
+            if (todo == nullptr)
+                return;
+            if (--budget == 0)
+                break;
+            o = pop_back(todo);
+        }
+        g_reclaimer->add(todo);
+        return;
+    }
+#endif
+    if (!g_deferred_finalizer) {
+        g_deferred_finalizer = true;
+        register_thread_finalizer(finalize_deferred, nullptr);
+    }
+    /* Remark: if we are already freeing the queue, it has already been counted. */
+    if (g_deferred == nullptr && !g_freeing_deferred)
+        g_num_deferred_queues++;
+    push_back(g_deferred, o);
+    free_deferred(g_del_budget);
+}
+
 extern "C" void lean_del(object * o) {
 #ifdef LEAN_LAZY_RC
     push_back(g_to_free, o);
 #else
+    if (LEAN_UNLIKELY(g_del_budget > 0))
+        return del_deferred(o);
     object * todo = nullptr;
     while (true) {
         lean_del_core(o, todo);
@@ -292,9 +516,69 @@ static obj_res mk_thunk_3_2(lean_cfun3 fn, obj_arg a1, obj_arg a2) {
     return lean_mk_thunk(mk_closure_3_2(fn, a1, a2));
 }
 
+#if defined(LEAN_MULTI_THREAD)
+/* Threads waiting for a thunk being evaluated by another thread block on a condition variable
+   selected by hashing the thunk address. A waiter announces itself by storing `LEAN_THUNK_WAITER`
+   at `m_closure`, and the evaluator only takes the bucket lock when this marker is present.
+   Remark: `LEAN_THUNK_WAITER` is a scalar, and is ignored by `dec`, `mark_mt` and `mark_persistent`. */
+#define LEAN_THUNK_WAITER lean_box(0)
+#define LEAN_THUNK_NUM_BUCKETS 64
+#define LEAN_THUNK_SPIN 64
+
+struct thunk_bucket {
+    mutex              m_mutex;
+    condition_variable m_cv;
+};
+
+static thunk_bucket g_thunk_buckets[LEAN_THUNK_NUM_BUCKETS];
+
+static thunk_bucket & get_thunk_bucket(b_obj_arg t) {
+    return g_thunk_buckets[hash_ptr(t) % LEAN_THUNK_NUM_BUCKETS];
+}
+
+static b_obj_res thunk_wait(b_obj_arg t) {
+    lean_thunk_object * o = lean_to_thunk(t);
+    /* The closure is usually cheap. So, we spin for a little bit before blocking. */
+    for (unsigned i = 0; i < LEAN_THUNK_SPIN; i++) {
+        if (object * v = o->m_value) return v;
+        this_thread::yield();
+    }
+    thunk_bucket & b = get_thunk_bucket(t);
+    {
+        unique_lock<mutex> lock(b.m_mutex);
+        object * expected = nullptr;
+        o->m_closure.compare_exchange_strong(expected, LEAN_THUNK_WAITER);
+        while (!o->m_value)
+            b.m_cv.wait(lock);
+    }
+    /* The evaluator may have finished before we stored the marker. */
+    object * expected = LEAN_THUNK_WAITER;
+    o->m_closure.compare_exchange_strong(expected, nullptr);
+    return o->m_value;
+}
+
+static void thunk_notify(b_obj_arg t) {
+    if (lean_to_thunk(t)->m_closure.exchange(nullptr) == LEAN_THUNK_WAITER) {
+        thunk_bucket & b = get_thunk_bucket(t);
+        lock_guard<mutex> lock(b.m_mutex);
+        b.m_cv.notify_all();
+    }
+}
+#endif
+
 extern "C" b_obj_res lean_thunk_get_core(b_obj_arg t) {
-    object * c = lean_to_thunk(t)->m_closure.exchange(nullptr);
+    object * c;
+#if defined(LEAN_MULTI_THREAD)
+    c = lean_to_thunk(t)->m_closure;
+    while (c != nullptr && c != LEAN_THUNK_WAITER) {
+        if (lean_to_thunk(t)->m_closure.compare_exchange_weak(c, nullptr))
+            break;
+    }
+    if (c != nullptr && c != LEAN_THUNK_WAITER) {
+#else
+    c = lean_to_thunk(t)->m_closure.exchange(nullptr);
     if (c != nullptr) {
+#endif
         /* Recall that a closure uses the standard calling convention.
            `thunk_get` "consumes" the result `r` by storing it at `to_thunk(t)->m_value`.
            Then, it returns a reference to this result to the caller.
@@ -306,18 +590,40 @@ extern "C" b_obj_res lean_thunk_get_core(b_obj_arg t) {
         lean_assert(r != nullptr); /* Closure must return a valid lean object */
         lean_assert(lean_to_thunk(t)->m_value == nullptr);
         lean_to_thunk(t)->m_value = r;
+#if defined(LEAN_MULTI_THREAD)
+        thunk_notify(t);
+#endif
         return r;
     } else {
-        lean_assert(c == nullptr);
-        /* There is another thread executing the closure. We keep waiting for the m_value to be
+        /* There is another thread executing the closure. We wait for the m_value to be
            set by another thread. */
+#if defined(LEAN_MULTI_THREAD)
+        return thunk_wait(t);
+#else
         while (!lean_to_thunk(t)->m_value) {
             this_thread::yield();
         }
         return lean_to_thunk(t)->m_value;
+#endif
     }
 }
 
+static obj_res thunk_get_async_fn(obj_arg t, obj_arg /* u */) {
+    object * r = lean_thunk_get(t);
+    lean_inc(r);
+    lean_dec(t);
+    return r;
+}
+
+extern "C" obj_res lean_thunk_get_async_core(obj_arg t, unsigned prio) {
+    if (object * v = lean_to_thunk(t)->m_value) {
+        lean_inc(v);
+        lean_dec(t);
+        return lean_task_pure(v);
+    }
+    return lean_task_spawn_core(mk_closure_2_1(thunk_get_async_fn, t), prio, false);
+}
+
 static obj_res thunk_map_fn_closure(obj_arg f, obj_arg t, obj_arg /* u */) {
     b_obj_res v = lean_thunk_get(t);
     lean_inc(v);
@@ -494,9 +800,16 @@ extern "C" void lean_mark_persistent(object * o) {
             } else {
                 switch (tag) {
                 case LeanScalarArray:
-                case LeanString:
                 case LeanMPZ:
                     break;
+                case LeanString:
+                    if (lean_string_is_rope(o)) {
+                        lean_string_rope_object * r = lean_to_string_rope(o);
+                        if (object * f = r->m_flat) todo.push_back(f);
+                        todo.push_back(r->m_left);
+                        if (object * c = r->m_right) todo.push_back(c);
+                    }
+                    break;
                 case LeanExternal: {
                     object * fn = lean_alloc_closure((void*)mark_persistent_fn, 1, 0);
                     lean_to_external(o)->m_class->m_foreach(lean_to_external(o)->m_data, fn);
@@ -523,6 +836,9 @@ extern "C" void lean_mark_persistent(object * o) {
                     if (object * v = lean_to_thunk(o)->m_value) todo.push_back(v);
                     break;
                 case LeanRef:
+                    /* The value of a ref created during initialization is marked by `io_end_init_refs` */
+                    if (io_register_init_ref(o))
+                        break;
                     if (object * v = lean_to_ref(o)->m_value) todo.push_back(v);
                     break;
                 default:
@@ -573,9 +889,16 @@ extern "C" void lean_mark_mt(object * o) {
             } else {
                 switch (tag) {
                 case LeanScalarArray:
-                case LeanString:
                 case LeanMPZ:
                     break;
+                case LeanString:
+                    if (lean_string_is_rope(o)) {
+                        lean_string_rope_object * r = lean_to_string_rope(o);
+                        if (object * f = r->m_flat) todo.push_back(f);
+                        todo.push_back(r->m_left);
+                        if (object * c = r->m_right) todo.push_back(c);
+                    }
+                    break;
                 case LeanExternal: {
                     object * fn = lean_alloc_closure((void*)mark_mt_fn, 1, 0);
                     lean_to_external(o)->m_class->m_foreach(lean_to_external(o)->m_data, fn);
@@ -903,6 +1226,7 @@ static task_manager * g_task_manager = nullptr;
 
 extern "C" void lean_init_task_manager_using(unsigned num_workers) {
     lean_assert(g_task_manager == nullptr);
+    io_end_init_refs();
 #if defined(LEAN_MULTI_THREAD)
     g_task_manager = new task_manager(num_workers);
 #endif
@@ -914,6 +1238,7 @@ extern "C" void lean_init_task_manager() {
 
 scoped_task_manager::scoped_task_manager(unsigned num_workers) {
     lean_assert(g_task_manager == nullptr);
+    io_end_init_refs();
 #if defined(LEAN_MULTI_THREAD)
     if (num_workers > 0) {
         g_task_manager = new task_manager(num_workers);
@@ -1076,6 +1401,13 @@ object * alloc_mpz(mpz const & m) {
     return (lean_object*)o;
 }
 
+object * alloc_mpz(mpz && m) {
+    void * mem = lean_alloc_small_object(sizeof(mpz_object));
+    mpz_object * o = new (mem) mpz_object(std::move(m));
+    lean_set_st_header((lean_object*)o, LeanMPZ, 0);
+    return (lean_object*)o;
+}
+
 object * mpz_to_nat_core(mpz const & m) {
     lean_assert(!m.is_size_t() || m.get_size_t() > LEAN_MAX_SMALL_NAT);
     return alloc_mpz(m);
@@ -1108,12 +1440,67 @@ extern "C" object * lean_big_uint64_to_nat(uint64_t n) {
     }
 }
 
+#ifdef LEAN_MPZ_TWO_LIMB
+/* Natural numbers and integers whose absolute value fits in two limbs are processed using 128-bit machine arithmetic.
+   We only use GMP for larger values, or when the result overflows. */
+typedef unsigned __int128 uint128;
+typedef __int128 int128;
+
+static inline bool nat_to_uint128(b_obj_arg a, uint128 & r) {
+    if (lean_is_scalar(a)) {
+        r = lean_unbox(a);
+        return true;
+    }
+    return mpz_value(a).get_abs_uint128(r);
+}
+
+static obj_res uint128_to_nat(uint128 v) {
+    if (v <= LEAN_MAX_SMALL_NAT)
+        return lean_box(static_cast<size_t>(v));
+    else
+        return alloc_mpz(mpz::of_uint128(v));
+}
+
+/* We only use integers in the range `(-2^127, 2^127)` as inputs. Thus, `v / w` and `v % w` never overflow. */
+static inline bool int_to_int128(b_obj_arg a, int128 & r) {
+    if (lean_is_scalar(a)) {
+        r = lean_scalar_to_int(a);
+        return true;
+    }
+    mpz const & m = mpz_value(a);
+    uint128 v;
+    if (!m.get_abs_uint128(v) || (v >> 127) != 0)
+        return false;
+    r = m.is_neg() ? -static_cast<int128>(v) : static_cast<int128>(v);
+    return true;
+}
+
+static obj_res int128_to_int(int128 v) {
+    if (LEAN_MIN_SMALL_INT <= v && v <= LEAN_MAX_SMALL_INT)
+        return lean_box(static_cast<unsigned>(static_cast<int>(v)));
+    else if (v < 0)
+        return alloc_mpz(mpz::of_uint128(-static_cast<uint128>(v), true));
+    else
+        return alloc_mpz(mpz::of_uint128(static_cast<uint128>(v)));
+}
+#endif
+
 extern "C" object * lean_nat_big_succ(object * a) {
+#ifdef LEAN_MPZ_TWO_LIMB
+    uint128 n;
+    if (nat_to_uint128(a, n) && n + 1 != 0)
+        return uint128_to_nat(n + 1);
+#endif
     return mpz_to_nat_core(mpz_value(a) + 1);
 }
 
 extern "C" object * lean_nat_big_add(object * a1, object * a2) {
     lean_assert(!lean_is_scalar(a1) || !lean_is_scalar(a2));
+#ifdef LEAN_MPZ_TWO_LIMB
+    uint128 n1, n2, r;
+    if (nat_to_uint128(a1, n1) && nat_to_uint128(a2, n2) && !__builtin_add_overflow(n1, n2, &r))
+        return uint128_to_nat(r);
+#endif
     if (lean_is_scalar(a1))
         return mpz_to_nat_core(mpz::of_size_t(lean_unbox(a1)) + mpz_value(a2));
     else if (lean_is_scalar(a2))
@@ -1124,6 +1511,11 @@ extern "C" object * lean_nat_big_add(object * a1, object * a2) {
 
 extern "C" object * lean_nat_big_sub(object * a1, object * a2) {
     lean_assert(!lean_is_scalar(a1) || !lean_is_scalar(a2));
+#ifdef LEAN_MPZ_TWO_LIMB
+    uint128 n1, n2;
+    if (nat_to_uint128(a1, n1) && nat_to_uint128(a2, n2))
+        return n1 < n2 ? lean_box(0) : uint128_to_nat(n1 - n2);
+#endif
     if (lean_is_scalar(a1)) {
         lean_assert(mpz::of_size_t(lean_unbox(a1)) < mpz_value(a2));
         return lean_box(0);
@@ -1140,6 +1532,11 @@ extern "C" object * lean_nat_big_sub(object * a1, object * a2) {
 
 extern "C" object * lean_nat_big_mul(object * a1, object * a2) {
     lean_assert(!lean_is_scalar(a1) || !lean_is_scalar(a2));
+#ifdef LEAN_MPZ_TWO_LIMB
+    uint128 n1, n2, r;
+    if (nat_to_uint128(a1, n1) && nat_to_uint128(a2, n2) && !__builtin_mul_overflow(n1, n2, &r))
+        return uint128_to_nat(r);
+#endif
     if (lean_is_scalar(a1))
         return mpz_to_nat(mpz::of_size_t(lean_unbox(a1)) * mpz_value(a2));
     else if (lean_is_scalar(a2))
@@ -1149,11 +1546,20 @@ extern "C" object * lean_nat_big_mul(object * a1, object * a2) {
 }
 
 extern "C" object * lean_nat_overflow_mul(size_t a1, size_t a2) {
+#ifdef LEAN_MPZ_TWO_LIMB
+    return uint128_to_nat(static_cast<uint128>(a1) * a2);
+#else
     return mpz_to_nat(mpz::of_size_t(a1) * mpz::of_size_t(a2));
+#endif
 }
 
 extern "C" object * lean_nat_big_div(object * a1, object * a2) {
     lean_assert(!lean_is_scalar(a1) || !lean_is_scalar(a2));
+#ifdef LEAN_MPZ_TWO_LIMB
+    uint128 n1, n2;
+    if (nat_to_uint128(a1, n1) && nat_to_uint128(a2, n2) && n2 != 0)
+        return uint128_to_nat(n1 / n2);
+#endif
     if (lean_is_scalar(a1)) {
         lean_assert(mpz_value(a2) != 0);
         lean_assert(mpz::of_size_t(lean_unbox(a1)) / mpz_value(a2) == 0);
@@ -1169,6 +1575,11 @@ extern "C" object * lean_nat_big_div(object * a1, object * a2) {
 
 extern "C" object * lean_nat_big_mod(object * a1, object * a2) {
     lean_assert(!lean_is_scalar(a1) || !lean_is_scalar(a2));
+#ifdef LEAN_MPZ_TWO_LIMB
+    uint128 n1, n2;
+    if (nat_to_uint128(a1, n1) && nat_to_uint128(a2, n2) && n2 != 0)
+        return uint128_to_nat(n1 % n2);
+#endif
     if (lean_is_scalar(a1)) {
         lean_assert(mpz_value(a2) != 0);
         return a1;
@@ -1189,6 +1600,11 @@ extern "C" bool lean_nat_big_eq(object * a1, object * a2) {
         lean_assert(mpz_value(a1) != mpz::of_size_t(lean_unbox(a2)));
         return false;
     } else {
+#ifdef LEAN_MPZ_TWO_LIMB
+        uint128 n1, n2;
+        if (nat_to_uint128(a1, n1) && nat_to_uint128(a2, n2))
+            return n1 == n2;
+#endif
         return mpz_value(a1) == mpz_value(a2);
     }
 }
@@ -1201,6 +1617,11 @@ extern "C" bool lean_nat_big_le(object * a1, object * a2) {
         lean_assert(mpz_value(a1) > mpz::of_size_t(lean_unbox(a2)));
         return false;
     } else {
+#ifdef LEAN_MPZ_TWO_LIMB
+        uint128 n1, n2;
+        if (nat_to_uint128(a1, n1) && nat_to_uint128(a2, n2))
+            return n1 <= n2;
+#endif
         return mpz_value(a1) <= mpz_value(a2);
     }
 }
@@ -1213,6 +1634,11 @@ extern "C" bool lean_nat_big_lt(object * a1, object * a2) {
         lean_assert(mpz_value(a1) > mpz::of_size_t(lean_unbox(a2)));
         return false;
     } else {
+#ifdef LEAN_MPZ_TWO_LIMB
+        uint128 n1, n2;
+        if (nat_to_uint128(a1, n1) && nat_to_uint128(a2, n2))
+            return n1 < n2;
+#endif
         return mpz_value(a1) < mpz_value(a2);
     }
 }
@@ -1304,6 +1730,11 @@ extern "C" object * lean_int_big_neg(object * a) {
 }
 
 extern "C" object * lean_int_big_add(object * a1, object * a2) {
+#ifdef LEAN_MPZ_TWO_LIMB
+    int128 v1, v2, r;
+    if (int_to_int128(a1, v1) && int_to_int128(a2, v2) && !__builtin_add_overflow(v1, v2, &r))
+        return int128_to_int(r);
+#endif
     if (lean_is_scalar(a1))
         return mpz_to_int(lean_scalar_to_int(a1) + mpz_value(a2));
     else if (lean_is_scalar(a2))
@@ -1313,6 +1744,11 @@ extern "C" object * lean_int_big_add(object * a1, object * a2) {
 }
 
 extern "C" object * lean_int_big_sub(object * a1, object * a2) {
+#ifdef LEAN_MPZ_TWO_LIMB
+    int128 v1, v2, r;
+    if (int_to_int128(a1, v1) && int_to_int128(a2, v2) && !__builtin_sub_overflow(v1, v2, &r))
+        return int128_to_int(r);
+#endif
     if (lean_is_scalar(a1))
         return mpz_to_int(lean_scalar_to_int(a1) - mpz_value(a2));
     else if (lean_is_scalar(a2))
@@ -1322,6 +1758,11 @@ extern "C" object * lean_int_big_sub(object * a1, object * a2) {
 }
 
 extern "C" object * lean_int_big_mul(object * a1, object * a2) {
+#ifdef LEAN_MPZ_TWO_LIMB
+    int128 v1, v2, r;
+    if (int_to_int128(a1, v1) && int_to_int128(a2, v2) && !__builtin_mul_overflow(v1, v2, &r))
+        return int128_to_int(r);
+#endif
     if (lean_is_scalar(a1))
         return mpz_to_int(lean_scalar_to_int(a1) * mpz_value(a2));
     else if (lean_is_scalar(a2))
@@ -1331,6 +1772,11 @@ extern "C" object * lean_int_big_mul(object * a1, object * a2) {
 }
 
 extern "C" object * lean_int_big_div(object * a1, object * a2) {
+#ifdef LEAN_MPZ_TWO_LIMB
+    int128 v1, v2;
+    if (int_to_int128(a1, v1) && int_to_int128(a2, v2) && v2 != 0)
+        return int128_to_int(v1 / v2);
+#endif
     if (lean_is_scalar(a1))
         return mpz_to_int(lean_scalar_to_int(a1) / mpz_value(a2));
     else if (lean_is_scalar(a2))
@@ -1340,6 +1786,11 @@ extern "C" object * lean_int_big_div(object * a1, object * a2) {
 }
 
 extern "C" object * lean_int_big_mod(object * a1, object * a2) {
+#ifdef LEAN_MPZ_TWO_LIMB
+    int128 v1, v2;
+    if (int_to_int128(a1, v1) && int_to_int128(a2, v2) && v2 != 0)
+        return int128_to_int(v1 % v2);
+#endif
     if (lean_is_scalar(a1))
         return mpz_to_int(mpz(lean_scalar_to_int(a1)) % mpz_value(a2));
     else if (lean_is_scalar(a2))
@@ -1466,13 +1917,133 @@ extern "C" lean_obj_res lean_float_to_string(double a) {
 // =======================================
 // Strings
 
-static inline char * w_string_cstr(object * o) { lean_assert(lean_is_string(o)); return lean_to_string(o)->m_data; }
+static inline char * w_string_cstr(object * o) {
+    lean_assert(lean_is_string(o) && !lean_string_is_rope(o));
+    return lean_to_string(o)->m_data;
+}
+
+/* Concatenation nodes and slices are only used for strings with at least `LEAN_STRING_ROPE_MIN_SIZE` bytes.
+   Smaller strings are copied. */
+#define LEAN_STRING_ROPE_MIN_SIZE 256
+
+/* Copy the bytes `[b, b+n)` of `s` to `out`. `s` may be a concatenation node or a slice (see `lean_string_rope_object`). */
+static void string_copy_bytes(b_obj_arg s, size_t b, size_t n, char * out) {
+    struct segment { object * m_str; size_t m_begin; size_t m_size; char * m_out; };
+    /* We use an explicit stack because `lean_string_append` produces long left-nested concatenations. */
+    std::vector<segment> todo;
+    todo.push_back(segment{s, b, n, out});
+    while (!todo.empty()) {
+        segment g = todo.back();
+        todo.pop_back();
+        while (g.m_size > 0) {
+            if (!lean_string_is_rope(g.m_str)) {
+                memcpy(g.m_out, lean_to_string(g.m_str)->m_data + g.m_begin, g.m_size);
+                break;
+            }
+            lean_string_rope_object * r = lean_to_string_rope(g.m_str);
+            if (object * f = r->m_flat) {
+                memcpy(g.m_out, lean_to_string(f)->m_data + g.m_begin, g.m_size);
+                break;
+            }
+            if (r->m_right == nullptr) {
+                g.m_str    = r->m_left;
+                g.m_begin += r->m_offset;
+                continue;
+            }
+            size_t left_sz = lean_string_size(r->m_left) - 1;
+            if (g.m_begin + g.m_size <= left_sz) {
+                g.m_str = r->m_left;
+            } else if (g.m_begin >= left_sz) {
+                g.m_str    = r->m_right;
+                g.m_begin -= left_sz;
+            } else {
+                size_t n1 = left_sz - g.m_begin;
+                todo.push_back(segment{r->m_right, 0, g.m_size - n1, g.m_out + n1});
+                g.m_str  = r->m_left;
+                g.m_size = n1;
+            }
+        }
+    }
+}
+
+extern "C" char const * lean_string_rope_cstr(b_obj_arg o) {
+    lean_string_rope_object * r = lean_to_string_rope(o);
+    object * flat = r->m_flat;
+    if (flat == nullptr) {
+        size_t sz = lean_string_size(o);
+        flat      = lean_alloc_string(sz, sz, lean_string_len(o));
+        string_copy_bytes(o, 0, sz - 1, w_string_cstr(flat));
+        w_string_cstr(flat)[sz - 1] = 0;
+        if (lean_is_st(o)) {
+            /* No other thread can be accessing `o`. So, we replace its children with the flat string. */
+            r->m_flat = flat;
+            lean_inc_ref(flat);
+            object * left  = r->m_left;
+            object * right = r->m_right;
+            r->m_left   = flat;
+            r->m_right  = nullptr;
+            r->m_offset = 0;
+            lean_dec(left);
+            if (right) lean_dec(right);
+        } else {
+            /* Other threads may be reading the children of `o`, and may also be flattening it. */
+            lean_mark_mt(flat);
+            object * expected = nullptr;
+            if (!r->m_flat.compare_exchange_strong(expected, flat)) {
+                lean_dec_ref(flat);
+                flat = expected;
+            }
+        }
+    }
+    return lean_to_string(flat)->m_data;
+}
+
+static obj_res mk_string_concat(obj_arg s1, obj_arg s2) {
+    lean_string_rope_object * r = (lean_string_rope_object*)lean_alloc_object(sizeof(lean_string_rope_object));
+    lean_set_st_header((lean_object*)r, LeanString, 0);
+    r->m_size     = lean_string_size(s1) + lean_string_size(s2) - 1;
+    r->m_capacity = 0;
+    r->m_length   = lean_string_len(s1) + lean_string_len(s2);
+    r->m_flat     = nullptr;
+    r->m_left     = s1;
+    r->m_right    = s2;
+    r->m_offset   = 0;
+    return (lean_object*)r;
+}
+
+/* Slice `[b, b+sz)` of `s`. The new object takes ownership of `s`. */
+static obj_res mk_string_slice(obj_arg s, size_t b, size_t sz, size_t len) {
+    if (lean_string_is_rope(s) && lean_to_string_rope(s)->m_right == nullptr) {
+        /* Avoid slices of slices. */
+        object * p = lean_to_string_rope(s)->m_left;
+        b += lean_to_string_rope(s)->m_offset;
+        lean_inc(p);
+        lean_dec(s);
+        s = p;
+    }
+    lean_string_rope_object * r = (lean_string_rope_object*)lean_alloc_object(sizeof(lean_string_rope_object));
+    lean_set_st_header((lean_object*)r, LeanString, 0);
+    r->m_size     = sz + 1;
+    r->m_capacity = 0;
+    r->m_length   = len;
+    r->m_flat     = nullptr;
+    r->m_left     = s;
+    r->m_right    = nullptr;
+    r->m_offset   = b;
+    return (lean_object*)r;
+}
 
 static object * string_ensure_capacity(object * o, size_t extra) {
     lean_assert(is_exclusive(o));
     size_t sz  = string_size(o);
     size_t cap = string_capacity(o);
-    if (sz + extra > cap) {
+    if (lean_string_is_rope(o)) {
+        object * new_o = alloc_string(sz, sz + sz + extra, string_len(o));
+        string_copy_bytes(o, 0, sz - 1, w_string_cstr(new_o));
+        w_string_cstr(new_o)[sz - 1] = 0;
+        lean_dec_ref(o);
+        return new_o;
+    } else if (sz + extra > cap) {
         object * new_o = alloc_string(sz, cap + sz + extra, string_len(o));
         lean_assert(string_capacity(new_o) >= sz + extra);
         memcpy(w_string_cstr(new_o), string_cstr(o), sz);
@@ -1485,7 +2056,7 @@ static object * string_ensure_capacity(object * o, size_t extra) {
 
 extern "C" object * lean_mk_string(char const * s) {
     size_t sz  = strlen(s);
-    size_t len = utf8_strlen(s);
+    size_t len = utf8_strlen(s, sz);
     size_t rsz = sz + 1;
     object * r = lean_alloc_string(rsz, rsz, len);
     memcpy(w_string_cstr(r), s, sz+1);
@@ -1521,7 +2092,7 @@ object * mk_string(std::string const & s) {
 
 std::string string_to_std(b_obj_arg o) {
     lean_assert(string_size(o) > 0);
-    return std::string(w_string_cstr(o), lean_string_size(o) - 1);
+    return std::string(lean_string_cstr(o), lean_string_size(o) - 1);
 }
 
 static size_t mk_capacity(size_t sz) {
@@ -1534,7 +2105,7 @@ extern "C" object * lean_string_push(object * s, unsigned c) {
     object * r;
     if (!lean_is_exclusive(s)) {
         r = lean_alloc_string(sz, mk_capacity(sz+5), len);
-        memcpy(w_string_cstr(r), lean_string_cstr(s), sz - 1);
+        string_copy_bytes(s, 0, sz - 1, w_string_cstr(r));
         lean_dec_ref(s);
     } else {
         r = string_ensure_capacity(s, 5);
@@ -1554,15 +2125,21 @@ extern "C" object * lean_string_append(object * s1, object * s2) {
     size_t new_len  = len1 + len2;
     unsigned new_sz = sz1 + sz2 - 1;
     object * r;
-    if (!lean_is_exclusive(s1)) {
+    if (sz2 == 1) {
+        return s1;
+    } else if (!lean_is_exclusive(s1) && new_sz > LEAN_STRING_ROPE_MIN_SIZE) {
+        /* Copying `s1` would be necessary. We create a concatenation node instead, and copy its contents on demand. */
+        lean_inc_ref(s2);
+        return mk_string_concat(s1, s2);
+    } else if (!lean_is_exclusive(s1)) {
         r = lean_alloc_string(new_sz, mk_capacity(new_sz), new_len);
-        memcpy(w_string_cstr(r), lean_string_cstr(s1), sz1 - 1);
+        string_copy_bytes(s1, 0, sz1 - 1, w_string_cstr(r));
         dec_ref(s1);
     } else {
         lean_assert(s1 != s2);
         r = string_ensure_capacity(s1, sz2-1);
     }
-    memcpy(w_string_cstr(r) + sz1 - 1, lean_string_cstr(s2), sz2 - 1);
+    string_copy_bytes(s2, 0, sz2 - 1, w_string_cstr(r) + sz1 - 1);
     lean_to_string(r)->m_size   = new_sz;
     lean_to_string(r)->m_length = new_len;
     w_string_cstr(r)[new_sz - 1] = 0;
@@ -1737,6 +2314,15 @@ extern "C" obj_res lean_string_utf8_extract(b_obj_arg s, b_obj_arg b0, b_obj_arg
     if (e < sz && !is_utf8_first_byte(str[e])) e = sz;
     usize new_sz = e - b;
     lean_assert(new_sz > 0);
+    if (new_sz == sz) {
+        lean_inc_ref(s);
+        return s;
+    }
+    if (new_sz >= LEAN_STRING_ROPE_MIN_SIZE && 2*new_sz >= sz) {
+        /* We only create slices containing at least half of `s` to bound the amount of memory retained by them. */
+        lean_inc_ref(s);
+        return mk_string_slice(s, b, new_sz, utf8_strlen(str + b, new_sz));
+    }
     obj_res r = lean_alloc_string(new_sz+1, new_sz+1, 0);
     memcpy(w_string_cstr(r), lean_string_cstr(s) + b, new_sz);
     w_string_cstr(r)[new_sz] = 0;
@@ -1777,10 +2363,10 @@ extern "C" obj_res lean_string_utf8_set(obj_arg s, b_obj_arg i0, uint32 c) {
     usize i  = lean_unbox(i0);
     usize sz = lean_string_size(s) - 1;
     if (i >= sz) return s;
-    char * str = w_string_cstr(s);
-    if (lean_is_exclusive(s)) {
+    char const * str = lean_string_cstr(s);
+    if (lean_is_exclusive(s) && !lean_string_is_rope(s)) {
         if (static_cast<unsigned char>(str[i]) < 128 && c < 128) {
-            str[i] = c;
+            w_string_cstr(s)[i] = c;
             return s;
         }
     }
@@ -1795,15 +2381,130 @@ extern "C" obj_res lean_string_utf8_set(obj_arg s, b_obj_arg i0, uint32 c) {
     return mk_string(new_s);
 }
 
+extern "C" obj_res lean_mk_string_from_bytes(char const * s, size_t sz) {
+    size_t rsz = sz + 1;
+    obj_res r  = lean_alloc_string(rsz, rsz, utf8_strlen(s, sz));
+    memcpy(w_string_cstr(r), s, sz);
+    w_string_cstr(r)[sz] = 0;
+    return r;
+}
+
+extern "C" uint8 lean_string_validate_utf8(b_obj_arg a) {
+    return validate_utf8(lean_sarray_cptr(a), lean_sarray_size(a));
+}
+
+/* Return the offset of the first occurrence of `p` (of size `m > 0`) in `s`, or `n` if there is none.
+   The SSE2 version compares the first and last bytes of `p` with 16 candidate positions at a time,
+   and only invokes `memcmp` on the positions where both match. */
+static size_t find_substr(char const * s, size_t n, char const * p, size_t m) {
+    lean_assert(m > 0);
+    if (m > n) return n;
+    size_t last = n - m;
+    size_t i    = 0;
+#if defined(__SSE2__)
+    __m128i first_byte = _mm_set1_epi8(p[0]);
+    __m128i last_byte  = _mm_set1_epi8(p[m-1]);
+    for (; i + 16 <= last + 1; i += 16) {
+        __m128i b0 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(s + i));
+        __m128i b1 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(s + i + m - 1));
+        int mask   = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(b0, first_byte), _mm_cmpeq_epi8(b1, last_byte)));
+        while (mask != 0) {
+            size_t j = i + __builtin_ctz(mask);
+            if (memcmp(s + j, p, m) == 0)
+                return j;
+            mask &= mask - 1;
+        }
+    }
+#endif
+    while (i <= last) {
+        char const * q = static_cast<char const *>(memchr(s + i, p[0], last - i + 1));
+        if (q == nullptr)
+            return n;
+        i = q - s;
+        if (memcmp(q, p, m) == 0)
+            return i;
+        i++;
+    }
+    return n;
+}
+
+extern "C" obj_res lean_string_find_substr(b_obj_arg s, b_obj_arg p, b_obj_arg b0) {
+    if (!lean_is_scalar(b0)) {
+        /* See comment at string_utf8_get */
+        return mk_option_none();
+    }
+    usize b  = lean_unbox(b0);
+    usize sz = lean_string_size(s) - 1;
+    usize m  = lean_string_size(p) - 1;
+    if (b > sz) return mk_option_none();
+    if (m == 0) return mk_option_some(lean_box(b));
+    size_t r = find_substr(lean_string_cstr(s) + b, sz - b, lean_string_cstr(p), m);
+    if (r == sz - b) return mk_option_none();
+    return mk_option_some(lean_box(b + r));
+}
+
+extern "C" obj_res lean_string_lines(b_obj_arg s) {
+    char const * str = lean_string_cstr(s);
+    usize sz         = lean_string_size(s) - 1;
+    buffer<object *> lines;
+    usize b = 0;
+    while (true) {
+        char const * q = static_cast<char const *>(memchr(str + b, '\n', sz - b));
+        usize e        = q == nullptr ? sz : q - str;
+        usize line_e   = e > b && str[e-1] == '\r' ? e - 1 : e;
+        lines.push_back(lean_mk_string_from_bytes(str + b, line_e - b));
+        if (q == nullptr)
+            break;
+        b = e + 1;
+    }
+    obj_res r = lean_box(0);
+    unsigned i = lines.size();
+    while (i > 0) {
+        --i;
+        obj_res new_r = lean_alloc_ctor(1, 2, 0);
+        lean_ctor_set(new_r, 0, lines[i]);
+        lean_ctor_set(new_r, 1, r);
+        r = new_r;
+    }
+    return r;
+}
+
 extern "C" usize lean_string_hash(b_obj_arg s) {
     usize sz = lean_string_size(s) - 1;
     char const * str = lean_string_cstr(s);
     return hash_str(sz, str, 11);
 }
 
+extern "C" uint64 lean_string_hash64(b_obj_arg s) {
+    usize sz = lean_string_size(s) - 1;
+    char const * str = lean_string_cstr(s);
+    return hash_str64(sz, str, 11);
+}
+
+/* We must hash the same characters used by `Substring.toString`. See `lean_string_utf8_extract`. */
+extern "C" uint64 lean_substring_hash64(b_obj_arg ss) {
+    b_obj_arg s  = lean_ctor_get(ss, 0);
+    b_obj_arg b0 = lean_ctor_get(ss, 1);
+    b_obj_arg e0 = lean_ctor_get(ss, 2);
+    if (!lean_is_scalar(b0) || !lean_is_scalar(e0))
+        return lean_string_hash64(s);
+    usize b = lean_unbox(b0);
+    usize e = lean_unbox(e0);
+    char const * str = lean_string_cstr(s);
+    usize sz = lean_string_size(s) - 1;
+    if (b >= e || b >= sz || !is_utf8_first_byte(str[b])) return hash_str64(0, str, 11);
+    if (e > sz) e = sz;
+    if (e < sz && !is_utf8_first_byte(str[e])) e = sz;
+    return hash_str64(e - b, str + b, 11);
+}
+
 // =======================================
 // ByteArray & FloatArray
 
+extern "C" uint64 lean_byte_array_hash(b_obj_arg a) {
+    return hash_str64(lean_sarray_size(a), reinterpret_cast<char const *>(lean_sarray_cptr(a)), 11);
+}
+
 size_t lean_nat_to_size_t(obj_arg n) {
     if (lean_is_scalar(n)) {
         return lean_unbox(n);
@@ -1819,7 +2520,11 @@ size_t lean_nat_to_size_t(obj_arg n) {
 extern "C" obj_res lean_copy_sarray(obj_arg a, size_t cap) {
     unsigned esz   = lean_sarray_elem_size(a);
     size_t sz      = lean_sarray_size(a);
-    lean_assert(cap >= sz);
+    if (cap < sz) {
+        /* `a` is a memory-mapped array, and its capacity is 0 */
+        lean_assert(lean_sarray_is_mapped(a));
+        cap = sz;
+    }
     object * r     = lean_alloc_sarray(esz, sz, cap);
     uint8 * it     = lean_sarray_cptr(a);
     uint8 * dest   = lean_sarray_cptr(r);
@@ -1886,7 +2591,9 @@ extern "C" obj_res lean_byte_array_push(obj_arg a, uint8 b) {
     return r;
 }
 
-    extern "C" obj_res lean_byte_array_copy_slice(b_obj_arg src, obj_arg o_src_off, obj_arg dest, obj_arg o_dest_off, obj_arg o_len, bool exact) {
+/* Copy the slice `[src_off, src_off + len)` of `src` to `dest` at `dest_off`. Offsets and lengths are in elements. */
+static obj_res sarray_copy_slice(b_obj_arg src, obj_arg o_src_off, obj_arg dest, obj_arg o_dest_off, obj_arg o_len, bool exact) {
+    size_t esz = lean_sarray_elem_size(src);
     size_t ssz = lean_sarray_size(src);
     size_t dsz = lean_sarray_size(dest);
     size_t src_off = lean_nat_to_size_t(o_src_off);
@@ -1902,10 +2609,47 @@ extern "C" obj_res lean_byte_array_push(obj_arg a, uint8 b) {
     object * r = lean_sarray_ensure_exclusive(lean_sarray_ensure_capacity(dest, new_dsz, exact));
     lean_to_sarray(r)->m_size = new_dsz;
     // `r` is exclusive, so the ranges definitely cannot overlap
-    memcpy(lean_sarray_cptr(r) + dest_off, lean_sarray_cptr(src) + src_off, len);
+    memcpy(lean_sarray_cptr(r) + dest_off*esz, lean_sarray_cptr(src) + src_off*esz, len*esz);
     return r;
 }
 
+extern "C" obj_res lean_byte_array_copy_slice(b_obj_arg src, obj_arg o_src_off, obj_arg dest, obj_arg o_dest_off, obj_arg o_len, uint8 exact) {
+    return sarray_copy_slice(src, o_src_off, dest, o_dest_off, o_len, exact);
+}
+
+extern "C" obj_res lean_byte_array_fill(obj_arg a, b_obj_arg b0, b_obj_arg e0, uint8 v) {
+    size_t sz = lean_sarray_size(a);
+    if (!lean_is_scalar(b0)) return a;
+    size_t b = lean_unbox(b0);
+    size_t e = lean_is_scalar(e0) ? std::min(lean_unbox(e0), sz) : sz;
+    if (b >= e) return a;
+    object * r = lean_sarray_ensure_exclusive(a);
+    memset(lean_sarray_cptr(r) + b, v, e - b);
+    return r;
+}
+
+extern "C" obj_res lean_byte_array_index_of(b_obj_arg a, uint8 v, b_obj_arg b0) {
+    size_t sz = lean_sarray_size(a);
+    if (!lean_is_scalar(b0) || lean_unbox(b0) >= sz) return mk_option_none();
+    size_t b = lean_unbox(b0);
+    uint8 const * it = lean_sarray_cptr(a);
+    void const * p   = memchr(it + b, v, sz - b);
+    if (p == nullptr) return mk_option_none();
+    return mk_option_some(lean_box(static_cast<uint8 const *>(p) - it));
+}
+
+extern "C" uint8 lean_byte_array_beq(b_obj_arg a1, b_obj_arg a2) {
+    size_t sz = lean_sarray_size(a1);
+    return sz == lean_sarray_size(a2) && memcmp(lean_sarray_cptr(a1), lean_sarray_cptr(a2), sz) == 0;
+}
+
+extern "C" uint8 lean_byte_array_dec_lt(b_obj_arg a1, b_obj_arg a2) {
+    size_t sz1 = lean_sarray_size(a1);
+    size_t sz2 = lean_sarray_size(a2);
+    int c = memcmp(lean_sarray_cptr(a1), lean_sarray_cptr(a2), std::min(sz1, sz2));
+    return c < 0 || (c == 0 && sz1 < sz2);
+}
+
 extern "C" obj_res lean_copy_float_array(obj_arg a) {
     return lean_copy_sarray(a, lean_sarray_capacity(a));
 }
@@ -1946,6 +2690,67 @@ extern "C" obj_res lean_float_array_push(obj_arg a, double d) {
     return r;
 }
 
+extern "C" obj_res lean_float_array_copy_slice(b_obj_arg src, obj_arg o_src_off, obj_arg dest, obj_arg o_dest_off, obj_arg o_len, uint8 exact) {
+    return sarray_copy_slice(src, o_src_off, dest, o_dest_off, o_len, exact);
+}
+
+/* The reductions below use four partial sums `r_0, ..., r_3`, where `r_k` accumulates the elements at positions `i` s.t.
+   `i % 4 == k`, and return `(r_0 + r_2) + (r_1 + r_3)`. The SSE2 and portable versions produce the same result. */
+extern "C" double lean_float_array_sum(b_obj_arg a) {
+    double const * it = lean_float_array_cptr(a);
+    size_t n = lean_sarray_size(a);
+    size_t i = 0;
+    double r;
+#if defined(__SSE2__)
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    for (; i + 4 <= n; i += 4) {
+        acc0 = _mm_add_pd(acc0, _mm_loadu_pd(it + i));
+        acc1 = _mm_add_pd(acc1, _mm_loadu_pd(it + i + 2));
+    }
+    double tmp[2];
+    _mm_storeu_pd(tmp, _mm_add_pd(acc0, acc1));
+    r = tmp[0] + tmp[1];
+#else
+    double r0 = 0.0, r1 = 0.0, r2 = 0.0, r3 = 0.0;
+    for (; i + 4 <= n; i += 4) {
+        r0 += it[i]; r1 += it[i+1]; r2 += it[i+2]; r3 += it[i+3];
+    }
+    r = (r0 + r2) + (r1 + r3);
+#endif
+    for (; i < n; i++)
+        r += it[i];
+    return r;
+}
+
+extern "C" double lean_float_array_dot(b_obj_arg a1, b_obj_arg a2) {
+    double const * it1 = lean_float_array_cptr(a1);
+    double const * it2 = lean_float_array_cptr(a2);
+    size_t n = std::min(lean_sarray_size(a1), lean_sarray_size(a2));
+    size_t i = 0;
+    double r;
+#if defined(__SSE2__)
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    for (; i + 4 <= n; i += 4) {
+        acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_loadu_pd(it1 + i), _mm_loadu_pd(it2 + i)));
+        acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_loadu_pd(it1 + i + 2), _mm_loadu_pd(it2 + i + 2)));
+    }
+    double tmp[2];
+    _mm_storeu_pd(tmp, _mm_add_pd(acc0, acc1));
+    r = tmp[0] + tmp[1];
+#else
+    double r0 = 0.0, r1 = 0.0, r2 = 0.0, r3 = 0.0;
+    for (; i + 4 <= n; i += 4) {
+        r0 += it1[i]*it2[i]; r1 += it1[i+1]*it2[i+1]; r2 += it1[i+2]*it2[i+2]; r3 += it1[i+3]*it2[i+3];
+    }
+    r = (r0 + r2) + (r1 + r3);
+#endif
+    for (; i < n; i++)
+        r += it1[i]*it2[i];
+    return r;
+}
+
 // =======================================
 // Array functions for generated code
 
@@ -2005,6 +2810,64 @@ extern "C" object * lean_array_push(obj_arg a, obj_arg v) {
     return r;
 }
 
+/* Insert `v` at position `i` of `a`. Pre: `i <= lean_array_size(a)`.
+   When `a` must be copied, the capacity of the new array is the smallest power of two greater than its size.
+   Thus, arrays that are only extended using `Array.insertAt` never use more than twice the space they need.
+   This is important for the inner nodes of `PersistentHashMap`. */
+extern "C" object * lean_array_insert_at(obj_arg a, b_obj_arg i, obj_arg v) {
+    size_t sz = lean_array_size(a);
+    lean_assert(lean_is_scalar(i) && lean_unbox(i) <= sz);
+    size_t j  = lean_unbox(i);
+    object * r;
+    if (lean_is_exclusive(a) && lean_array_capacity(a) > sz) {
+        r = a;
+        object ** it = lean_array_cptr(r);
+        memmove(it + j + 1, it + j, sizeof(object*) * (sz - j));
+    } else {
+        size_t cap = 1;
+        while (cap <= sz) cap *= 2;
+        r = lean_alloc_array(sz, cap);
+        object ** src  = lean_array_cptr(a);
+        object ** dest = lean_array_cptr(r);
+        memcpy(dest, src, sizeof(object*) * j);
+        memcpy(dest + j + 1, src + j, sizeof(object*) * (sz - j));
+        if (lean_is_exclusive(a)) {
+            /* the elements were moved to `r` */
+            lean_free_object(a);
+        } else {
+            for (size_t k = 0; k < sz; k++) lean_inc(src[k]);
+            lean_dec(a);
+        }
+    }
+    lean_array_cptr(r)[j] = v;
+    lean_to_array(r)->m_size = sz + 1;
+    return r;
+}
+
+// =======================================
+// Flat hash maps (see `Std.FlatHashMap`)
+
+extern "C" obj_res lean_flat_hash_map_mk_ctrl(b_obj_arg n) {
+    if (!lean_is_scalar(n)) lean_panic_out_of_memory();
+    size_t sz  = lean_unbox(n);
+    object * r = lean_alloc_sarray(1, sz, sz);
+    memset(lean_sarray_cptr(r), 0x80, sz);
+    return r;
+}
+
+extern "C" obj_res lean_flat_hash_map_mk_slots(b_obj_arg n) {
+    if (!lean_is_scalar(n)) lean_panic_out_of_memory();
+    size_t sz  = lean_unbox(n);
+    object * r = lean_alloc_array(sz, sz);
+    object ** it = lean_array_cptr(r);
+    for (size_t i = 0; i < sz; i++) it[i] = lean_box(0);
+    return r;
+}
+
+extern "C" obj_res lean_flat_hash_map_clear_slot(obj_arg a, b_obj_arg i) {
+    return lean_array_set(a, i, lean_box(0));
+}
+
 // =======================================
 // Runtime info
 
@@ -5,8 +5,11 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Author: Leonardo de Moura
 */
 #include <vector>
+#include <unordered_map>
 #include <lean/object.h>
 #include <lean/hash.h>
+#include <lean/thread.h>
+#include <lean/sharecommon.h>
 
 namespace lean {
 
@@ -150,6 +153,115 @@ public:
     }
 };
 
+/* Maximal sharing table that can be used by multiple tasks at the same time.
+   Objects are stored in shards selected using their fingerprint (i.e., `lean_sharecommon_hash`),
+   and each shard is protected by its own lock. All objects stored in the table are multi-threaded. */
+#define LEAN_SHARECOMMON_NUM_SHARDS 64
+
+class sharecommon_table {
+    struct shard {
+        mutex                                    m_mutex;
+        std::unordered_multimap<usize, object *> m_objs;
+    };
+    shard m_shards[LEAN_SHARECOMMON_NUM_SHARDS];
+public:
+    ~sharecommon_table() {
+        for (shard & s : m_shards) {
+            for (auto const & p : s.m_objs)
+                lean_dec(p.second);
+        }
+    }
+
+    /* If the table contains an object equivalent to `o`, return it wrapped in `Option.some`.
+       Otherwise, insert `o` into the table and return `Option.none`. In this case, the caller
+       must transfer a reference to `o` to the table. */
+    obj_res find_or_insert(b_obj_arg o) {
+        usize fp = lean_sharecommon_hash(o);
+        shard & s = m_shards[fp % LEAN_SHARECOMMON_NUM_SHARDS];
+        lock_guard<mutex> lock(s.m_mutex);
+        auto range = s.m_objs.equal_range(fp);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (lean_sharecommon_eq(it->second, o)) {
+                lean_inc(it->second);
+                return mk_option_some(it->second);
+            }
+        }
+        /* Other threads may access `o` as soon as it is in the table. */
+        lean_mark_mt(o);
+        s.m_objs.emplace(fp, o);
+        return lean_box(0);
+    }
+
+    void for_each(b_obj_arg fn) {
+        for (shard & s : m_shards) {
+            lock_guard<mutex> lock(s.m_mutex);
+            for (auto const & p : s.m_objs) {
+                lean_inc(fn);
+                lean_inc(p.second);
+                lean_apply_1(fn, p.second);
+            }
+        }
+    }
+};
+
+static lean_external_class * g_sharecommon_table_class = nullptr;
+
+static void sharecommon_table_finalizer(void * t) {
+    delete static_cast<sharecommon_table *>(t);
+}
+
+static void sharecommon_table_foreach(void * t, b_obj_arg fn) {
+    static_cast<sharecommon_table *>(t)->for_each(fn);
+}
+
+// constant mkConcurrentState : IO ConcurrentState
+extern "C" obj_res lean_sharecommon_mk_cstate(obj_arg) {
+    return lean_io_result_mk_ok(lean_alloc_external(g_sharecommon_table_class, new sharecommon_table()));
+}
+
+/* The map from objects to their maximally shared representation is local to each `shareCommon` invocation,
+   and only the set of maximally shared objects is shared between tasks. */
+class sharecommon_cstate {
+    sharecommon_table &                    m_table;
+    std::unordered_map<object *, object *> m_map;
+public:
+    sharecommon_cstate(b_obj_arg s):m_table(*static_cast<sharecommon_table *>(lean_get_external_data(s))) {}
+
+    ~sharecommon_cstate() {
+        for (auto const & p : m_map) {
+            lean_dec(p.first);
+            lean_dec(p.second);
+        }
+    }
+
+    obj_res pack(obj_arg a) {
+        return a;
+    }
+
+    obj_res map_find(b_obj_arg k) {
+        auto it = m_map.find(k);
+        if (it == m_map.end())
+            return lean_box(0);
+        lean_inc(it->second);
+        return mk_option_some(it->second);
+    }
+
+    void map_insert(obj_arg k, obj_arg v) {
+        if (!m_map.emplace(k, v).second) {
+            lean_dec(k);
+            lean_dec(v);
+        }
+    }
+
+    obj_res set_find(b_obj_arg o) {
+        return m_table.find_or_insert(o);
+    }
+
+    void set_insert(obj_arg /* o */) {
+        /* `set_find` has already inserted `o`, and the table takes ownership of this reference. */
+    }
+};
+
 template<typename state>
 class sharecommon_fn {
     state                     m_state;
@@ -251,7 +363,7 @@ class sharecommon_fn {
         new_a->m_size     = sz;
         new_a->m_capacity = sz;
         new_a->m_length   = len;
-        memcpy(new_a->m_data, lean_to_string(a)->m_data, sz);
+        memcpy(new_a->m_data, lean_string_cstr(a), sz);
         save(a, (lean_object*)new_a);
     }
 
@@ -328,4 +440,16 @@ extern "C" obj_res lean_state_sharecommon(obj_arg s, obj_arg a) {
 extern "C" obj_res lean_persistent_state_sharecommon(obj_arg s, obj_arg a) {
     return sharecommon_fn<sharecommon_pstate>(s)(a);
 }
+
+// def ConcurrentState.shareCommon {α} (s : @& ConcurrentState) (a : α) : α
+extern "C" obj_res lean_concurrent_state_sharecommon(b_obj_arg s, obj_arg a) {
+    return sharecommon_fn<sharecommon_cstate>(s)(a);
+}
+
+void initialize_sharecommon() {
+    g_sharecommon_table_class = lean_register_external_class(sharecommon_table_finalizer, sharecommon_table_foreach);
+}
+
+void finalize_sharecommon() {
+}
 };
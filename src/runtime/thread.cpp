@@ -18,6 +18,7 @@ Author: Leonardo de Moura
 #include <lean/exception.h>
 #include <lean/alloc.h>
 #include <lean/stack_overflow.h>
+#include <lean/io.h>
 
 #ifndef LEAN_DEFAULT_THREAD_STACK_SIZE
 #define LEAN_DEFAULT_THREAD_STACK_SIZE 8*1024*1024 // 8Mb
@@ -142,7 +143,11 @@ struct lthread::imp {
     }
 };
 #endif
-lthread::lthread(std::function<void(void)> const & p):m_imp(new imp(p)) {}
+lthread::lthread(std::function<void(void)> const & p) {
+    /* `io_end_init_refs` must be executed before another thread may access the global refs. */
+    io_end_init_refs();
+    m_imp.reset(new imp(p));
+}
 
 lthread::~lthread() {}
 
@@ -5,7 +5,12 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Author: Leonardo de Moura
 */
 #include <cstdlib>
+#include <cstdint>
+#include <cstring>
 #include <string>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include <lean/debug.h>
 #include <lean/optional.h>
 #include <lean/utf8.h>
@@ -42,10 +47,37 @@ size_t utf8_strlen(char const * str) {
     return r;
 }
 
+size_t utf8_ascii_prefix(char const * str, size_t sz) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 16 <= sz; i += 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<__m128i const *>(str + i));
+        int mask      = _mm_movemask_epi8(chunk);
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+#endif
+    for (; i + 8 <= sz; i += 8) {
+        uint64_t chunk;
+        memcpy(&chunk, str + i, 8);
+        if ((chunk & 0x8080808080808080ull) != 0)
+            break;
+    }
+    while (i < sz && (static_cast<unsigned char>(str[i]) & 0x80) == 0)
+        i++;
+    return i;
+}
+
 size_t utf8_strlen(char const * str, size_t sz) {
     size_t r = 0;
     size_t i = 0;
     while (i < sz) {
+        /* ASCII fast path */
+        size_t n = utf8_ascii_prefix(str + i, sz - i);
+        r += n;
+        i += n;
+        if (i >= sz)
+            break;
         unsigned d = get_utf8_size(str[i]);
         r++;
         i += d;
@@ -53,6 +85,44 @@ size_t utf8_strlen(char const * str, size_t sz) {
     return r;
 }
 
+bool validate_utf8(uchar const * str, size_t sz) {
+    size_t i = 0;
+    while (i < sz) {
+        i += utf8_ascii_prefix(reinterpret_cast<char const *>(str) + i, sz - i);
+        if (i >= sz)
+            break;
+        unsigned c = str[i];
+        if ((c & 0xe0) == 0xc0) {
+            /* one continuation (128 to 2047) */
+            if (i + 1 >= sz || !is_utf8_next(str[i+1]))
+                return false;
+            unsigned r = ((c & 0x1f) << 6) | (str[i+1] & 0x3f);
+            if (r < 128)
+                return false;
+            i += 2;
+        } else if ((c & 0xf0) == 0xe0) {
+            /* two continuations (2048 to 55295 and 57344 to 65535) */
+            if (i + 2 >= sz || !is_utf8_next(str[i+1]) || !is_utf8_next(str[i+2]))
+                return false;
+            unsigned r = ((c & 0x0f) << 12) | ((str[i+1] & 0x3f) << 6) | (str[i+2] & 0x3f);
+            if (r < 2048 || (r >= 55296 && r <= 57343))
+                return false;
+            i += 3;
+        } else if ((c & 0xf8) == 0xf0) {
+            /* three continuations (65536 to 1114111) */
+            if (i + 3 >= sz || !is_utf8_next(str[i+1]) || !is_utf8_next(str[i+2]) || !is_utf8_next(str[i+3]))
+                return false;
+            unsigned r = ((c & 0x07) << 18) | ((str[i+1] & 0x3f) << 12) | ((str[i+2] & 0x3f) << 6) | (str[i+3] & 0x3f);
+            if (r < 65536 || r > 1114111)
+                return false;
+            i += 4;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
 size_t utf8_strlen(std::string const & str) {
     return utf8_strlen(str.data(), str.size());
 }
@@ -38,7 +38,9 @@ Author: Leonardo de Moura
 #include "library/print.h"
 #include "initialize/init.h"
 #include "library/compiler/ir_interpreter.h"
+#include "library/compiler/compiler_stats.h"
 #include "util/path.h"
+#include "util/name_hash_map.h"
 #ifdef _MSC_VER
 #include <io.h>
 #define STDOUT_FILENO 1
@@ -58,6 +60,25 @@ Author: Leonardo de Moura
 #include <dlfcn.h>
 #endif
 
+#if !defined(LEAN_WINDOWS) && !defined(LEAN_EMSCRIPTEN)
+#define LEAN_DAEMON_SUPPORT
+#define LEAN_MAKE_SUPPORT
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <climits>
+#include <queue>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#endif
+
 #if defined(LEAN_LLVM)
 #include <llvm/Support/TargetSelect.h>
 #endif
@@ -176,6 +197,17 @@ using namespace lean; // NOLINT
 #ifndef LEAN_SERVER_DEFAULT_MAX_HEARTBEAT
 #define LEAN_SERVER_DEFAULT_MAX_HEARTBEAT 100000
 #endif
+/* Bound on the number of objects freed by a single `lean_del` in server mode, see `lean_set_deferred_free`. */
+#ifndef LEAN_SERVER_DEFAULT_DEL_BUDGET
+#define LEAN_SERVER_DEFAULT_DEL_BUDGET 4096
+#endif
+#ifndef LEAN_SERVER_DEFAULT_DEL_ALLOC_BUDGET
+#define LEAN_SERVER_DEFAULT_DEL_ALLOC_BUDGET 256
+#endif
+/* Maximum number of imported environments kept in memory by `lean --daemon`. */
+#ifndef LEAN_DAEMON_MAX_CACHED_ENVS
+#define LEAN_DAEMON_MAX_CACHED_ENVS 8
+#endif
 
 static void display_header(std::ostream & out) {
     out << "Lean (version " << get_version_string() << ", " << LEAN_STR(LEAN_BUILD_TYPE) << ")\n";
@@ -206,6 +238,19 @@ static void display_help(std::ostream & out) {
 #endif
     std::cout << "  --plugin=file      load and initialize shared library for registering linters etc.\n";
     std::cout << "  --deps             just print dependencies of a Lean input\n";
+    std::cout << "  --hash             print the interface hash of the given .olean files, the modules importing\n"
+              << "                     a module only need to be rebuilt when it changes\n";
+#if defined(LEAN_MAKE_SUPPORT)
+    std::cout << "  --make             build the .olean files of the packages given as input files, e.g., `Init.lean`,\n"
+              << "                     in the directory given by `--o`, and the .c files in the directory given by `--c`,\n"
+              << "                     using at most `-j` concurrent processes\n";
+#endif
+#if defined(LEAN_DAEMON_SUPPORT)
+    std::cout << "  --daemon=socket    start lean in daemon mode, accepting requests on the Unix domain socket `socket`,\n"
+              << "                     and keeping the imported environments in memory\n";
+    std::cout << "  --connect=socket   process the remaining arguments using the lean daemon listening on `socket`\n"
+              << "                     (must be the first argument)\n";
+#endif
 #if defined(LEAN_JSON)
     std::cout << "  --json             print JSON-formatted structured error messages\n";
     std::cout << "  --server           start lean in server mode\n";
@@ -234,6 +279,7 @@ static struct option g_long_options[] = {
     {"threads",      required_argument, 0, 'j'},
     {"quiet",        no_argument,       0, 'q'},
     {"deps",         no_argument,       0, 'd'},
+    {"hash",         no_argument,       0, 'H'},
     {"timeout",      optional_argument, 0, 'T'},
     {"c",            optional_argument, 0, 'c'},
     {"exitOnPanic",  no_argument,       0, 'e'},
@@ -245,6 +291,12 @@ static struct option g_long_options[] = {
     {"tstack",       required_argument, 0, 's'},
 #endif
     {"plugin",       required_argument, 0, 'p'},
+#if defined(LEAN_MAKE_SUPPORT)
+    {"make",         no_argument,       0, 'm'},
+#endif
+#if defined(LEAN_DAEMON_SUPPORT)
+    {"daemon",       required_argument, 0, 'X'},
+#endif
 #ifdef LEAN_DEBUG
     {"debug",        required_argument, 0, 'B'},
 #endif
@@ -345,6 +397,22 @@ pair_ref<environment, pair_ref<messages, module_stx>> run_new_frontend(std::stri
         lean_run_frontend(mk_string(input), opts.to_obj_arg(), mk_string(file_name), main_module_name.to_obj_arg(), io_mk_world()));
 }
 
+extern "C" object * lean_run_frontend_with_env(object * env, object * input, object * opts, object * filename, object * main_module_name, object * w);
+pair_ref<environment, pair_ref<messages, module_stx>> run_new_frontend_with_env(environment const & env, std::string const & input, options const & opts, std::string const & file_name, name const & main_module_name) {
+    return get_io_result<pair_ref<environment, pair_ref<messages, module_stx>>>(
+        lean_run_frontend_with_env(env.to_obj_arg(), mk_string(input), opts.to_obj_arg(), mk_string(file_name), main_module_name.to_obj_arg(), io_mk_world()));
+}
+
+extern "C" object * lean_import_modules(object * imports, object * opts, uint32 trust_level, object * w);
+environment import_modules(object_ref const & imports, options const & opts) {
+    return get_io_result<environment>(lean_import_modules(imports.to_obj_arg(), opts.to_obj_arg(), 0, io_mk_world()));
+}
+
+extern "C" object * lean_get_imported_olean_files(object * env, object * w);
+list_ref<string_ref> get_imported_olean_files(environment const & env) {
+    return get_io_result<list_ref<string_ref>>(lean_get_imported_olean_files(env.to_obj_arg(), io_mk_world()));
+}
+
 extern "C" object* lean_init_search_path(object* opt_path, object* w);
 void init_search_path() {
     get_io_scalar_result<unsigned>(lean_init_search_path(mk_option_none(), io_mk_world()));
@@ -408,38 +476,30 @@ void check_optarg(char const * option_name) {
     }
 }
 
-int main(int argc, char ** argv) {
-#if defined(LEAN_EMSCRIPTEN)
-    EM_ASM(
-        var lean_path = process.env['LEAN_PATH'];
-        if (lean_path) {
-            ENV['LEAN_PATH'] = lean_path;
-        }
-
-        try {
-            // emscripten cannot mount all of / in the vfs,
-            // we can only mount subdirectories...
-            FS.mount(NODEFS, { root: '/home' }, '/home');
-            FS.mkdir('/root');
-            FS.mount(NODEFS, { root: '/root' }, '/root');
+/* Environment containing the imports of the input file. It is set by `lean --daemon` in the process handling a request. */
+static environment * g_daemon_env = nullptr;
 
-            FS.chdir(process.cwd());
-        } catch (e) {
-            console.log(e);
-        });
+#if defined(LEAN_DAEMON_SUPPORT)
+static int run_daemon(char const * socket_path);
 #endif
-#if LEAN_WINDOWS
-    // "best practice" according to https://docs.microsoft.com/en-us/windows/win32/api/errhandlingapi/nf-errhandlingapi-seterrormode
-    SetErrorMode(SEM_FAILCRITICALERRORS);
+static std::string hash_to_string(uint64 h) {
+    char buffer[17];
+    snprintf(buffer, sizeof(buffer), "%016llx", static_cast<unsigned long long>(h));
+    return buffer;
+}
+
+#if defined(LEAN_MAKE_SUPPORT)
+static int run_make(std::vector<std::string> const & roots, std::string const & olean_dir, optional<std::string> const & c_dir,
+                    std::vector<std::string> const & lean_args, optional<unsigned> const & num_jobs);
 #endif
-    auto init_start = std::chrono::steady_clock::now();
-    ::initializer init;
-    second_duration init_time = std::chrono::steady_clock::now() - init_start;
+
+static int lean_main(int argc, char ** argv, second_duration init_time) {
     bool run = false;
     optional<std::string> olean_fn;
     bool use_stdin = false;
     unsigned trust_lvl = LEAN_BELIEVER_TRUST_LEVEL + 1;
     bool only_deps = false;
+    bool only_hash = false;
     bool stats = false;
     unsigned num_threads    = 0;
 #if defined(LEAN_MULTI_THREAD)
@@ -465,6 +525,11 @@ int main(int argc, char ** argv) {
     std::string native_output;
     optional<std::string> c_output;
     optional<std::string> root_dir;
+    optional<std::string> daemon_socket;
+    bool make = false;
+    bool explicit_num_threads = false;
+    /* options forwarded to the processes started by `--make` */
+    std::vector<std::string> make_lean_args;
     while (true) {
         int c = getopt_long(argc, argv, g_opt_str, g_long_options, NULL);
         if (c == -1)
@@ -472,9 +537,11 @@ int main(int argc, char ** argv) {
         switch (c) {
             case 'e':
                 lean_set_exit_on_panic(true);
+                make_lean_args.push_back("--exitOnPanic");
                 break;
             case 'j':
                 num_threads = static_cast<unsigned>(atoi(optarg));
+                explicit_num_threads = true;
                 break;
             case 'v':
                 display_header(std::cout);
@@ -508,21 +575,28 @@ int main(int argc, char ** argv) {
             case 'M':
                 check_optarg("M");
                 opts = opts.update(get_max_memory_opt_name(), static_cast<unsigned>(atoi(optarg)));
+                make_lean_args.push_back(std::string("--memory=") + optarg);
                 break;
             case 'T':
                 check_optarg("T");
                 opts = opts.update(get_timeout_opt_name(), static_cast<unsigned>(atoi(optarg)));
+                make_lean_args.push_back(std::string("--timeout=") + optarg);
                 break;
             case 't':
                 check_optarg("t");
                 trust_lvl = atoi(optarg);
+                make_lean_args.push_back(std::string("--trust=") + optarg);
                 break;
             case 'q':
                 opts = opts.update(lean::get_verbose_opt_name(), false);
+                make_lean_args.push_back("--quiet");
                 break;
             case 'd':
                 only_deps = true;
                 break;
+            case 'H':
+                only_hash = true;
+                break;
             case 'a':
                 stats = true;
                 break;
@@ -530,6 +604,7 @@ int main(int argc, char ** argv) {
                 try {
                     check_optarg("D");
                     opts = set_config_option(opts, optarg);
+                    make_lean_args.push_back(std::string("-D") + optarg);
                 } catch (lean::exception & ex) {
                     std::cerr << ex.what() << std::endl;
                     return 1;
@@ -543,6 +618,7 @@ int main(int argc, char ** argv) {
 #endif
             case 'P':
                 opts = opts.update("profiler", true);
+                make_lean_args.push_back("--profile");
                 break;
 #if defined(LEAN_DEBUG)
             case 'B':
@@ -554,6 +630,17 @@ int main(int argc, char ** argv) {
                 check_optarg("p");
                 load_plugin(optarg);
                 break;
+#if defined(LEAN_MAKE_SUPPORT)
+            case 'm':
+                make = true;
+                break;
+#endif
+#if defined(LEAN_DAEMON_SUPPORT)
+            case 'X':
+                check_optarg("daemon");
+                daemon_socket = optarg;
+                break;
+#endif
             default:
                 std::cerr << "Unknown command line option\n";
                 display_help(std::cerr);
@@ -573,10 +660,45 @@ int main(int argc, char ** argv) {
         set_max_heartbeat_thousands(timeout);
     }
 
+    if (opts.get_bool("server")) {
+        lean_set_deferred_free(LEAN_SERVER_DEFAULT_DEL_BUDGET, LEAN_SERVER_DEFAULT_DEL_ALLOC_BUDGET, true);
+    }
+
     if (get_profiler(opts)) {
         report_profiling_time("initialization", init_time);
     }
 
+#if defined(LEAN_DAEMON_SUPPORT)
+    if (daemon_socket)
+        return run_daemon(daemon_socket->c_str());
+#endif
+#if defined(LEAN_MAKE_SUPPORT)
+    if (make) {
+        if (!olean_fn || olean_fn->empty()) {
+            std::cerr << "--make requires the output directory `--o=dir`\n";
+            return 1;
+        }
+        try {
+            return run_make(std::vector<std::string>(argv + optind, argv + argc), *olean_fn, c_output, make_lean_args,
+                            explicit_num_threads ? optional<unsigned>(num_threads) : optional<unsigned>());
+        } catch (lean::throwable & ex) {
+            std::cerr << "error: " << ex.what() << std::endl;
+            return 1;
+        }
+    }
+#endif
+
+    if (only_hash) {
+        try {
+            for (int i = optind; i < argc; i++)
+                std::cout << hash_to_string(read_module_hash(argv[i])) << "\n";
+            return 0;
+        } catch (lean::throwable & ex) {
+            std::cerr << "error: " << ex.what() << std::endl;
+            return 1;
+        }
+    }
+
     environment env(trust_lvl);
     scoped_task_manager scope_task_man(num_threads);
     optional<name> main_module_name;
@@ -635,7 +757,9 @@ int main(int argc, char ** argv) {
         bool ok = true;
         if (!main_module_name)
             main_module_name = name("_stdin");
-        pair_ref<environment, pair_ref<messages, module_stx>> r = run_new_frontend(contents, opts, mod_fn, *main_module_name);
+        pair_ref<environment, pair_ref<messages, module_stx>> r = g_daemon_env ?
+            run_new_frontend_with_env(*g_daemon_env, contents, opts, mod_fn, *main_module_name) :
+            run_new_frontend(contents, opts, mod_fn, *main_module_name);
         env = r.fst();
         buffer<message> cpp_msgs;
         // HACK: convert Lean Message into C++ message
@@ -672,7 +796,7 @@ int main(int argc, char ** argv) {
             time_task t(".olean serialization",
                         message_builder(environment(), get_global_ios(), mod_fn, pos_info(),
                                         message_severity::INFORMATION));
-            write_module(env, *olean_fn);
+            write_module(env, *olean_fn, get_olean_compress(opts));
         }
 
         if (c_output && ok) {
@@ -684,12 +808,14 @@ int main(int argc, char ** argv) {
             time_task _("C code generation",
                         message_builder(environment(), get_global_ios(), mod_fn, pos_info(),
                                         message_severity::INFORMATION));
-            out << lean::ir::emit_c(env, *main_module_name).data();
+            out << lean::ir::emit_c(env, opts, *main_module_name).data();
             out.close();
         }
 
-        if (!json_output)
+        if (!json_output) {
             display_cumulative_profiling_times(std::cerr);
+            display_cumulative_compiler_stats(std::cerr);
+        }
 
         return ok ? 0 : 1;
     } catch (lean::throwable & ex) {
@@ -699,3 +825,806 @@ int main(int argc, char ** argv) {
     }
     return 1;
 }
+
+#if defined(LEAN_DAEMON_SUPPORT)
+/*
+Daemon mode
+
+`lean --daemon=socket` listens on the Unix domain socket `socket`, and `lean --connect=socket args` asks it to run
+`lean args`. The client sends its working directory, `LEAN_PATH`, and `args`, and passes its standard file
+descriptors using `SCM_RIGHTS`. The daemon then forks a process that runs `lean args` using these file descriptors,
+and sends its exit code back to the client. Thus, the client behaves like `lean args`, but the modules are only
+initialized once.
+
+Before forking, the daemon imports the header of the input file, and the forked process uses this environment
+instead of importing it again. Imported environments are cached using the working directory, `LEAN_PATH`, the `-D`
+options and the imports as key, and are reused as long as the imported .olean files have the same modification time
+and size. At most `LEAN_DAEMON_MAX_CACHED_ENVS` environments are kept in memory.
+
+Request format: a `uint32` payload size (sent together with the file descriptors), followed by the payload, i.e.,
+the working directory, `LEAN_PATH=...` (or an empty string if `LEAN_PATH` is not set), and the arguments, each of
+them terminated by `\0`. The response is the `int32` exit code.
+*/
+
+static bool write_all(int fd, void const * data, size_t n) {
+    char const * p = static_cast<char const *>(data);
+    while (n > 0) {
+        ssize_t r = write(fd, p, n);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        p += r; n -= r;
+    }
+    return true;
+}
+
+static bool read_all(int fd, void * data, size_t n) {
+    char * p = static_cast<char *>(data);
+    while (n > 0) {
+        ssize_t r = read(fd, p, n);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        p += r; n -= r;
+    }
+    return true;
+}
+
+/* Make sure the next `getopt_long` call starts parsing a new command line. */
+static void reset_getopt() {
+#if defined(__APPLE__)
+    optreset = 1;
+    optind   = 1;
+#else
+    optind   = 0;
+#endif
+}
+
+static bool init_socket_addr(sockaddr_un & addr, char const * socket_path) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        std::cerr << "error: socket path is too long '" << socket_path << "'\n";
+        return false;
+    }
+    strcpy(addr.sun_path, socket_path); // NOLINT
+    return true;
+}
+
+static int run_daemon_client(char const * socket_path, int argc, char ** argv) {
+    sockaddr_un addr;
+    if (!init_socket_addr(addr, socket_path))
+        return 1;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+        std::cerr << "error: failed to connect to lean daemon at '" << socket_path << "': " << strerror(errno) << "\n";
+        return 1;
+    }
+    std::string payload;
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd))) {
+        std::cerr << "error: failed to retrieve current working directory: " << strerror(errno) << "\n";
+        return 1;
+    }
+    payload += cwd;
+    payload += '\0';
+    if (char const * lean_path = getenv("LEAN_PATH")) {
+        payload += "LEAN_PATH=";
+        payload += lean_path;
+    }
+    payload += '\0';
+    for (int i = 0; i < argc; i++) {
+        payload += argv[i];
+        payload += '\0';
+    }
+    uint32 size = payload.size();
+    iovec iov = { &size, sizeof(size) };
+    union { char m_buf[CMSG_SPACE(3 * sizeof(int))]; cmsghdr m_align; } ctrl;
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = ctrl.m_buf;
+    msg.msg_controllen = sizeof(ctrl.m_buf);
+    cmsghdr * cmsg     = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level   = SOL_SOCKET;
+    cmsg->cmsg_type    = SCM_RIGHTS;
+    cmsg->cmsg_len     = CMSG_LEN(3 * sizeof(int));
+    int fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    if (sendmsg(fd, &msg, 0) != static_cast<ssize_t>(sizeof(size)) || !write_all(fd, payload.data(), payload.size())) {
+        std::cerr << "error: failed to send request to lean daemon: " << strerror(errno) << "\n";
+        return 1;
+    }
+    int32_t exit_code;
+    if (!read_all(fd, &exit_code, sizeof(exit_code))) {
+        std::cerr << "error: lean daemon closed the connection\n";
+        return 1;
+    }
+    close(fd);
+    return exit_code;
+}
+
+struct daemon_request {
+    std::string              m_cwd;
+    std::string              m_lean_path;
+    std::vector<std::string> m_args;
+    int                      m_fds[3] = { -1, -1, -1 };
+};
+
+static bool receive_daemon_request(int conn, daemon_request & req) {
+    uint32 size;
+    iovec iov = { &size, sizeof(size) };
+    union { char m_buf[CMSG_SPACE(3 * sizeof(int))]; cmsghdr m_align; } ctrl;
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = ctrl.m_buf;
+    msg.msg_controllen = sizeof(ctrl.m_buf);
+    ssize_t n;
+    do { n = recvmsg(conn, &msg, 0); } while (n < 0 && errno == EINTR);
+    cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+    if (n <= 0 || !cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int)))
+        return false;
+    memcpy(req.m_fds, CMSG_DATA(cmsg), sizeof(req.m_fds));
+    if (!read_all(conn, reinterpret_cast<char *>(&size) + n, sizeof(size) - n))
+        return false;
+    std::string payload(size, '\0');
+    if (!read_all(conn, &payload[0], size))
+        return false;
+    std::vector<std::string> strs;
+    size_t begin = 0;
+    for (size_t i = 0; i < payload.size(); i++) {
+        if (payload[i] == '\0') {
+            strs.push_back(payload.substr(begin, i - begin));
+            begin = i + 1;
+        }
+    }
+    if (strs.size() < 2)
+        return false;
+    req.m_cwd       = strs[0];
+    req.m_lean_path = strs[1];
+    req.m_args.assign(strs.begin() + 2, strs.end());
+    return true;
+}
+
+static void close_request_fds(daemon_request & req) {
+    for (int & fd : req.m_fds) {
+        if (fd >= 0) close(fd);
+        fd = -1;
+    }
+}
+
+struct daemon_file_stamp {
+    std::string m_fname;
+    time_t      m_mtime_sec;
+    long        m_mtime_nsec;
+    off_t       m_size;
+};
+
+static bool get_file_stamp(std::string const & fname, daemon_file_stamp & s) {
+    struct stat st;
+    if (stat(fname.c_str(), &st) != 0)
+        return false;
+    s.m_fname     = fname;
+    s.m_mtime_sec = st.st_mtime;
+#if defined(__APPLE__)
+    s.m_mtime_nsec = st.st_mtimespec.tv_nsec;
+#else
+    s.m_mtime_nsec = st.st_mtim.tv_nsec;
+#endif
+    s.m_size      = st.st_size;
+    return true;
+}
+
+static bool is_up_to_date(daemon_file_stamp const & s) {
+    daemon_file_stamp curr;
+    return get_file_stamp(s.m_fname, curr) && curr.m_mtime_sec == s.m_mtime_sec &&
+        curr.m_mtime_nsec == s.m_mtime_nsec && curr.m_size == s.m_size;
+}
+
+struct daemon_env_entry {
+    std::string                    m_key;
+    std::vector<daemon_file_stamp> m_files;
+    environment                    m_env;
+};
+
+/* Return the environment for the header of the input file of `req`, or `none` if `lean args` does not process
+   a file, or the search path or the header cannot be loaded. In the latter case, the error is reported by the
+   forked process. The current directory and `LEAN_PATH` must have been set for `req`. */
+static optional<environment> get_daemon_env(daemon_request const & req, std::vector<daemon_env_entry> & cache) {
+    std::vector<std::string> args_copy = req.m_args;
+    std::vector<char *> argv;
+    argv.push_back(const_cast<char *>("lean"));
+    for (std::string & arg : args_copy)
+        argv.push_back(&arg[0]);
+    argv.push_back(nullptr);
+    int argc = argv.size() - 1;
+    std::string key = req.m_cwd + '\0' + req.m_lean_path;
+    options opts;
+    reset_getopt();
+    opterr = 0;
+    try {
+        init_search_path();
+        while (true) {
+            int c = getopt_long(argc, argv.data(), g_opt_str, g_long_options, NULL);
+            if (c == -1)
+                break;
+            switch (c) {
+            case 'D':
+                opts = set_config_option(opts, optarg);
+                key += '\0';
+                key += optarg;
+                break;
+            case 'd': case 'H': case 'i': case 'v': case 'g': case 'h': case 'X': case '?':
+                return optional<environment>();
+            }
+        }
+        if (optind >= argc)
+            return optional<environment>();
+        std::string fname = argv[optind];
+        std::string contents = read_file(fname);
+        object_ref imports; position pos(0, 0); message_log import_log;
+        std::tie(imports, pos, import_log) = parse_imports(contents, fname);
+        if (import_log.has_errors())
+            return optional<environment>();
+        for (object_ref const & import : list_ref<object_ref>(imports.raw(), true)) {
+            key += '\0';
+            key += cnstr_get_ref_t<name>(import, 0).to_string();
+            if (lean_ctor_get_uint8(import.raw(), sizeof(void *)))
+                key += " (runtime)";
+        }
+        for (auto it = cache.begin(); it != cache.end(); ++it) {
+            if (it->m_key == key) {
+                bool up_to_date = std::all_of(it->m_files.begin(), it->m_files.end(), is_up_to_date);
+                daemon_env_entry entry = *it;
+                cache.erase(it);
+                if (!up_to_date) {
+                    environment_free_regions(std::move(entry.m_env));
+                    break;
+                }
+                cache.push_back(entry);
+                return optional<environment>(entry.m_env);
+            }
+        }
+        environment env = import_modules(imports, opts);
+        std::vector<daemon_file_stamp> files;
+        for (string_ref const & fname : get_imported_olean_files(env)) {
+            daemon_file_stamp s;
+            if (!get_file_stamp(fname.to_std_string(), s))
+                return optional<environment>(env);
+            files.push_back(s);
+        }
+        if (cache.size() >= LEAN_DAEMON_MAX_CACHED_ENVS) {
+            environment_free_regions(std::move(cache.front().m_env));
+            cache.erase(cache.begin());
+        }
+        cache.push_back(daemon_env_entry { key, files, env });
+        return optional<environment>(env);
+    } catch (lean::throwable &) {
+        return optional<environment>();
+    }
+}
+
+/* Self-pipe used to wake up the daemon's `poll` loop when a forked process terminates. */
+static int g_sigchld_pipe[2];
+
+static void daemon_sigchld_handler(int) {
+    int saved_errno = errno;
+    char c = 0;
+    if (write(g_sigchld_pipe[1], &c, 1) < 0) {}
+    errno = saved_errno;
+}
+
+/* Process `req` in a new process, and return its pid. */
+static pid_t fork_daemon_request(daemon_request & req, optional<environment> const & env, int lfd, int conn) {
+    std::cout.flush();
+    std::cerr.flush();
+    pid_t pid = fork();
+    if (pid != 0)
+        return pid;
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+    close(lfd);
+    close(conn);
+    close(g_sigchld_pipe[0]);
+    close(g_sigchld_pipe[1]);
+    for (int i = 0; i < 3; i++) {
+        dup2(req.m_fds[i], i);
+        if (req.m_fds[i] > 2)
+            close(req.m_fds[i]);
+    }
+    if (env)
+        g_daemon_env = new environment(*env);
+    std::vector<char *> argv;
+    argv.push_back(const_cast<char *>("lean"));
+    for (std::string & arg : req.m_args)
+        argv.push_back(&arg[0]);
+    argv.push_back(nullptr);
+    reset_getopt();
+    opterr = 1;
+    int exit_code = lean_main(argv.size() - 1, argv.data(), second_duration(0));
+    std::cout.flush();
+    std::cerr.flush();
+    _exit(exit_code);
+}
+
+static int run_daemon(char const * socket_path) {
+    sockaddr_un addr;
+    if (!init_socket_addr(addr, socket_path))
+        return 1;
+    int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (lfd < 0) {
+        std::cerr << "error: failed to create socket: " << strerror(errno) << "\n";
+        return 1;
+    }
+    if (connect(lfd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0) {
+        std::cerr << "error: a lean daemon is already listening at '" << socket_path << "'\n";
+        return 1;
+    }
+    close(lfd);
+    lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socket_path);
+    if (lfd < 0 || bind(lfd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || listen(lfd, SOMAXCONN) != 0) {
+        std::cerr << "error: failed to listen at '" << socket_path << "': " << strerror(errno) << "\n";
+        return 1;
+    }
+    if (pipe(g_sigchld_pipe) != 0) {
+        std::cerr << "error: failed to create pipe: " << strerror(errno) << "\n";
+        return 1;
+    }
+    fcntl(g_sigchld_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(g_sigchld_pipe[1], F_SETFL, O_NONBLOCK);
+    fcntl(lfd, F_SETFD, FD_CLOEXEC);
+    fcntl(g_sigchld_pipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(g_sigchld_pipe[1], F_SETFD, FD_CLOEXEC);
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGCHLD, daemon_sigchld_handler);
+    std::vector<daemon_env_entry> cache;
+    /* connections waiting for the exit code of a forked process */
+    std::unordered_map<pid_t, int> pending;
+    while (true) {
+        pollfd fds[2] = { { lfd, POLLIN, 0 }, { g_sigchld_pipe[0], POLLIN, 0 } };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            std::cerr << "error: poll failed: " << strerror(errno) << "\n";
+            return 1;
+        }
+        if (fds[1].revents & POLLIN) {
+            char buf[64];
+            while (read(g_sigchld_pipe[0], buf, sizeof(buf)) > 0) {}
+            int status;
+            pid_t pid;
+            while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+                auto it = pending.find(pid);
+                if (it == pending.end())
+                    continue;
+                int32_t exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+                write_all(it->second, &exit_code, sizeof(exit_code));
+                close(it->second);
+                pending.erase(it);
+            }
+        }
+        if (fds[0].revents & POLLIN) {
+            int conn = accept(lfd, nullptr, nullptr);
+            if (conn < 0)
+                continue;
+            fcntl(conn, F_SETFD, FD_CLOEXEC);
+            daemon_request req;
+            if (!receive_daemon_request(conn, req) || chdir(req.m_cwd.c_str()) != 0) {
+                close_request_fds(req);
+                close(conn);
+                continue;
+            }
+            if (req.m_lean_path.empty())
+                unsetenv("LEAN_PATH");
+            else
+                setenv("LEAN_PATH", req.m_lean_path.c_str() + strlen("LEAN_PATH="), 1);
+            optional<environment> env = get_daemon_env(req, cache);
+            pid_t pid = fork_daemon_request(req, env, lfd, conn);
+            close_request_fds(req);
+            if (pid < 0) {
+                close(conn);
+                continue;
+            }
+            pending[pid] = conn;
+        }
+    }
+}
+#endif
+
+#if defined(LEAN_MAKE_SUPPORT)
+/*
+Build mode
+
+`lean --make --o=olean_dir [--c=c_dir] pkg_1.lean ... pkg_n.lean` builds the .olean files (and .c files if `--c` is
+provided) of the modules of the packages `pkg_i`, i.e., `pkg_i.lean` and the .lean files in the directory `pkg_i/`.
+It uses the same output layout as `lean.mk`. Each module is processed by a separate `lean` process.
+
+The import graph of all packages is computed upfront, so that a module can be processed as soon as its imports have
+been built, even if they belong to a different package. Among the modules that are ready, we first start the one with
+the most expensive path to a module that is not imported by any other module (i.e., the critical path), where the cost
+of a module is estimated using the size of its source file. At most `-j` processes are executed concurrently.
+By default, we use the `-j` option of `make` when `lean --make` is invoked from a Makefile, and the number of
+hardware threads otherwise.
+
+A module is only processed if its .olean file is missing or older than its source file, its imported .olean files,
+or the `lean` executable. For the imported modules that are part of the build graph, the `.hash` file next to their
+.olean file is used instead, which is only updated when their interface hash changes (see `lean --hash`). Thus,
+modules are not rebuilt when, e.g., only proofs in the modules they import changed. When `--c` is provided, we also
+produce the `.depend` files used by `lean.mk`, so that `leanmake` can compile and link the generated C files without
+invoking `lean --deps` for each module.
+*/
+
+/* def findOLeans (deps : List Import) : IO (List String) */
+extern "C" object * lean_find_oleans(object * deps, object * w);
+static list_ref<string_ref> find_oleans(object_ref const & deps) {
+    return get_io_result<list_ref<string_ref>>(lean_find_oleans(deps.to_obj_arg(), io_mk_world()));
+}
+
+struct make_module {
+    name                     m_name;
+    std::string              m_root;        // package root directory
+    std::string              m_src;
+    std::string              m_olean;
+    std::string              m_c;           // empty if no C code is generated
+    std::string              m_depend;      // contents of the `.depend` file
+    std::vector<std::string> m_dep_files;   // `.hash` files of the imports in the build graph, .olean files of the others
+    std::vector<unsigned>    m_rdeps;       // modules in the build graph importing this one
+    unsigned                 m_num_pending = 0; // number of imports in the build graph that have not been built yet
+    uint64_t                 m_cost        = 0;
+    uint64_t                 m_priority    = 0; // cost of the most expensive path starting at this module
+};
+
+struct make_job {
+    unsigned    m_module;
+    pid_t       m_pid;
+    int         m_fd;      // standard output and error of the process
+    std::string m_output;
+};
+
+static optional<int64_t> get_mtime_ns(std::string const & fname) {
+    struct stat st;
+    if (stat(fname.c_str(), &st) != 0)
+        return optional<int64_t>();
+#if defined(__APPLE__)
+    return optional<int64_t>(static_cast<int64_t>(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec);
+#else
+    return optional<int64_t>(static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec);
+#endif
+}
+
+static void make_dirs(std::string const & dir) {
+    for (size_t i = 1; i <= dir.size(); i++) {
+        if (i == dir.size() || dir[i] == '/')
+            mkdir(dir.substr(0, i).c_str(), 0777);
+    }
+}
+
+static std::string strip_lean_ext(std::string const & fname) {
+    return fname.substr(0, fname.size() - strlen(".lean"));
+}
+
+static name rel_path_to_module_name(std::string const & rel) {
+    name r;
+    size_t begin = 0;
+    for (size_t i = 0; i <= rel.size(); i++) {
+        if (i == rel.size() || rel[i] == '/') {
+            r = name(r, rel.substr(begin, i - begin).c_str());
+            begin = i + 1;
+        }
+    }
+    return r;
+}
+
+/* Return the value `N` of the `-jN` option of the enclosing `make` process, if any. */
+static optional<unsigned> get_make_num_jobs() {
+    char const * flags = getenv("MAKEFLAGS");
+    if (!flags)
+        return optional<unsigned>();
+    std::istringstream in(flags);
+    std::string flag;
+    while (in >> flag) {
+        if (flag.compare(0, 2, "-j") == 0 && flag.size() > 2 && std::isdigit(flag[2]))
+            return optional<unsigned>(std::max(atoi(flag.c_str() + 2), 1));
+    }
+    return optional<unsigned>();
+}
+
+/* Return true if the .olean (and .c) file of `m` must be regenerated. */
+static bool make_needs_rebuild(make_module const & m, int64_t exe_mtime) {
+    optional<int64_t> olean_mtime = get_mtime_ns(m.m_olean);
+    if (!olean_mtime || *olean_mtime < exe_mtime || (!m.m_c.empty() && !get_mtime_ns(m.m_c)))
+        return true;
+    optional<int64_t> src_mtime = get_mtime_ns(m.m_src);
+    if (!src_mtime || *src_mtime > *olean_mtime)
+        return true;
+    for (std::string const & dep : m.m_dep_files) {
+        optional<int64_t> dep_mtime = get_mtime_ns(dep);
+        if (!dep_mtime || *dep_mtime > *olean_mtime)
+            return true;
+    }
+    return false;
+}
+
+static std::string olean_to_hash_file(std::string const & olean_fn) {
+    return olean_fn.substr(0, olean_fn.size() - strlen(".olean")) + ".hash";
+}
+
+/* Write the interface hash of the .olean file of `m` to its `.hash` file, unless it is unchanged. */
+static void make_update_hash_file(make_module const & m) {
+    std::string hash_fn  = olean_to_hash_file(m.m_olean);
+    std::string new_hash = hash_to_string(read_module_hash(m.m_olean)) + "\n";
+    std::string old_hash;
+    try { old_hash = read_file(hash_fn); } catch (exception &) {}
+    if (old_hash != new_hash)
+        std::ofstream(hash_fn) << new_hash;
+}
+
+static bool start_make_job(make_module const & m, std::vector<std::string> const & lean_args, make_job & job) {
+    std::vector<std::string> args;
+    args.push_back(get_exe_location());
+    args.insert(args.end(), lean_args.begin(), lean_args.end());
+    args.push_back("--root=" + m.m_root);
+    args.push_back("--o=" + m.m_olean);
+    if (!m.m_c.empty())
+        args.push_back("--c=" + m.m_c + ".tmp");
+    args.push_back(m.m_src);
+    std::vector<char *> argv;
+    for (std::string & arg : args)
+        argv.push_back(&arg[0]);
+    argv.push_back(nullptr);
+    int fds[2];
+    if (pipe(fds) != 0)
+        return false;
+    std::cout.flush();
+    std::cerr.flush();
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        dup2(fds[1], STDERR_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+    close(fds[1]);
+    if (pid < 0) {
+        close(fds[0]);
+        return false;
+    }
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    job.m_pid = pid;
+    job.m_fd  = fds[0];
+    job.m_output.clear();
+    return true;
+}
+
+/* Wait until one of the jobs terminates, remove it from `jobs`, and return it together with its exit status. */
+static std::pair<make_job, int> wait_make_job(std::vector<make_job> & jobs) {
+    std::vector<pollfd> fds;
+    while (true) {
+        fds.clear();
+        for (make_job const & job : jobs)
+            fds.push_back(pollfd { job.m_fd, POLLIN, 0 });
+        if (poll(fds.data(), fds.size(), -1) < 0 && errno != EINTR)
+            throw exception(sstream() << "poll failed: " << strerror(errno));
+        for (size_t i = 0; i < fds.size(); i++) {
+            if (!fds[i].revents)
+                continue;
+            char buf[4096];
+            ssize_t n = read(jobs[i].m_fd, buf, sizeof(buf));
+            if (n > 0) {
+                jobs[i].m_output.append(buf, n);
+            } else if (n == 0 || errno != EINTR) {
+                make_job job = jobs[i];
+                jobs.erase(jobs.begin() + i);
+                close(job.m_fd);
+                int status;
+                while (waitpid(job.m_pid, &status, 0) < 0 && errno == EINTR) {}
+                int exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+                return std::make_pair(job, exit_code);
+            }
+        }
+    }
+}
+
+static int run_make(std::vector<std::string> const & roots, std::string const & olean_dir, optional<std::string> const & c_dir,
+                    std::vector<std::string> const & lean_args, optional<unsigned> const & num_jobs) {
+    /* Make sure the output directory is in the search path, and that `findOLean` knows where the .olean files
+       of the packages will be located even before they are built (see `lean.mk`). */
+    std::string lean_path = getenv("LEAN_PATH") ? getenv("LEAN_PATH") : "";
+    setenv("LEAN_PATH", (lean_path + ":" + olean_dir).c_str(), 1);
+    init_search_path();
+    std::vector<make_module> modules;
+    name_hash_map<unsigned> module_idx;
+    std::unordered_map<std::string, std::string> pkg_roots;
+    for (std::string const & root : roots) {
+        if (!has_file_ext(root, ".lean"))
+            throw exception(sstream() << "invalid package '" << root << "', file name must end with '.lean'");
+        std::string root_dir = dirname(root);
+        std::string pkg      = stem(root);
+        std::string prefix   = root_dir == "." ? "" : root_dir + "/";
+        pkg_roots[pkg]       = root_dir;
+        make_dirs(olean_dir + "/" + pkg);
+        std::vector<std::string> files = { root };
+        if (is_directory(prefix + pkg))
+            find_files(prefix + pkg, ".lean", files);
+        for (std::string const & file : files) {
+            make_module m;
+            std::string rel = strip_lean_ext(file.substr(prefix.size()));
+            m.m_name  = rel_path_to_module_name(rel);
+            m.m_root  = root_dir;
+            m.m_src   = file;
+            m.m_olean = olean_dir + "/" + rel + ".olean";
+            if (c_dir)
+                m.m_c = *c_dir + "/" + rel + ".c";
+            module_idx[m.m_name] = modules.size();
+            modules.push_back(m);
+        }
+    }
+    std::unordered_set<std::string> graph_oleans;
+    for (make_module const & m : modules)
+        graph_oleans.insert(m.m_olean);
+    for (unsigned i = 0; i < modules.size(); i++) {
+        make_module & m = modules[i];
+        std::string contents = read_file(m.m_src);
+        m.m_cost = contents.size();
+        object_ref imports; position pos(0, 0); message_log import_log;
+        std::tie(imports, pos, import_log) = parse_imports(contents, m.m_src);
+        for (object_ref const & import : list_ref<object_ref>(imports.raw(), true)) {
+            name mod = cnstr_get_ref_t<name>(import, 0);
+            if (pkg_roots.find(mod.get_root().to_string()) == pkg_roots.end())
+                continue;
+            auto it = module_idx.find(mod);
+            if (it == module_idx.end())
+                throw exception(sstream() << m.m_src << ": unknown module '" << mod << "'");
+            modules[it->second].m_rdeps.push_back(i);
+            m.m_num_pending++;
+        }
+        m.m_depend = m.m_olean + ":";
+        for (string_ref const & dep : find_oleans(imports)) {
+            std::string dep_file = dep.to_std_string();
+            if (graph_oleans.count(dep_file))
+                dep_file = olean_to_hash_file(dep_file);
+            m.m_dep_files.push_back(dep_file);
+            m.m_depend += " " + dep_file;
+        }
+        m.m_depend += "\n";
+    }
+    /* Compute the priorities in reverse topological order. */
+    std::vector<unsigned> order;
+    std::vector<unsigned> num_pending;
+    for (make_module const & m : modules)
+        num_pending.push_back(m.m_num_pending);
+    for (unsigned i = 0; i < modules.size(); i++) {
+        if (num_pending[i] == 0)
+            order.push_back(i);
+    }
+    for (unsigned j = 0; j < order.size(); j++) {
+        for (unsigned r : modules[order[j]].m_rdeps) {
+            if (--num_pending[r] == 0)
+                order.push_back(r);
+        }
+    }
+    if (order.size() < modules.size()) {
+        for (unsigned i = 0; i < modules.size(); i++) {
+            if (num_pending[i] > 0)
+                throw exception(sstream() << "import cycle involving '" << modules[i].m_name << "'");
+        }
+    }
+    for (auto it = order.rbegin(); it != order.rend(); ++it) {
+        make_module & m = modules[*it];
+        uint64_t max_rdep = 0;
+        for (unsigned r : m.m_rdeps)
+            max_rdep = std::max(max_rdep, modules[r].m_priority);
+        m.m_priority = m.m_cost + max_rdep;
+    }
+
+    unsigned max_jobs  = std::max(num_jobs ? *num_jobs : get_make_num_jobs().value_or(hardware_concurrency()), 1u);
+    int64_t  exe_mtime = get_mtime_ns(get_exe_location()).value_or(0);
+    std::priority_queue<std::pair<uint64_t, unsigned>> ready;
+    auto mark_done = [&](unsigned i) {
+        for (unsigned r : modules[i].m_rdeps) {
+            if (--modules[r].m_num_pending == 0)
+                ready.push(std::make_pair(modules[r].m_priority, r));
+        }
+    };
+    for (unsigned i = 0; i < modules.size(); i++) {
+        if (modules[i].m_num_pending == 0)
+            ready.push(std::make_pair(modules[i].m_priority, i));
+    }
+    std::vector<make_job> jobs;
+    bool ok = true;
+    while (true) {
+        while (ok && !ready.empty() && jobs.size() < max_jobs) {
+            unsigned i = ready.top().second;
+            ready.pop();
+            make_module const & m = modules[i];
+            bool rebuild = make_needs_rebuild(m, exe_mtime);
+            if (c_dir) {
+                std::string depend_fn = *c_dir + "/" + strip_lean_ext(m.m_src.substr(m.m_root == "." ? 0 : m.m_root.size() + 1)) + ".depend";
+                make_dirs(dirname(depend_fn));
+                std::string old_depend;
+                try { old_depend = read_file(depend_fn); } catch (exception &) {}
+                /* The `.depend` file must be newer than the source file, otherwise `lean.mk` regenerates it,
+                   and then rebuilds the module because the `.depend` file is newer than the .olean file. */
+                if (rebuild || old_depend != m.m_depend) {
+                    std::ofstream(depend_fn) << m.m_depend;
+                    rebuild = true;
+                }
+            }
+            if (!rebuild) {
+                if (!get_mtime_ns(olean_to_hash_file(m.m_olean)))
+                    make_update_hash_file(m);
+                mark_done(i);
+                continue;
+            }
+            std::cout << "[    ] Building " << m.m_src << std::endl;
+            make_dirs(dirname(m.m_olean));
+            if (!m.m_c.empty())
+                make_dirs(dirname(m.m_c));
+            make_job job;
+            job.m_module = i;
+            if (!start_make_job(m, lean_args, job)) {
+                std::cerr << "error: failed to start process for '" << m.m_src << "': " << strerror(errno) << "\n";
+                ok = false;
+                break;
+            }
+            jobs.push_back(job);
+        }
+        if (jobs.empty())
+            break;
+        std::pair<make_job, int> r = wait_make_job(jobs);
+        make_module const & m = modules[r.first.m_module];
+        std::cout << r.first.m_output;
+        if (r.second != 0) {
+            std::cerr << "error: failed to build '" << m.m_src << "'\n";
+            ok = false;
+            continue;
+        }
+        if (!m.m_c.empty())
+            std::rename((m.m_c + ".tmp").c_str(), m.m_c.c_str());
+        /* make sure the .olean file is newer than the .depend and .c files to prevent `make` from rebuilding it */
+        utimensat(AT_FDCWD, m.m_olean.c_str(), nullptr, 0);
+        make_update_hash_file(m);
+        mark_done(r.first.m_module);
+    }
+    return ok ? 0 : 1;
+}
+#endif
+
+int main(int argc, char ** argv) {
+#if defined(LEAN_EMSCRIPTEN)
+    EM_ASM(
+        var lean_path = process.env['LEAN_PATH'];
+        if (lean_path) {
+            ENV['LEAN_PATH'] = lean_path;
+        }
+
+        try {
+            // emscripten cannot mount all of / in the vfs,
+            // we can only mount subdirectories...
+            FS.mount(NODEFS, { root: '/home' }, '/home');
+            FS.mkdir('/root');
+            FS.mount(NODEFS, { root: '/root' }, '/root');
+
+            FS.chdir(process.cwd());
+        } catch (e) {
+            console.log(e);
+        });
+#endif
+#if LEAN_WINDOWS
+    // "best practice" according to https://docs.microsoft.com/en-us/windows/win32/api/errhandlingapi/nf-errhandlingapi-seterrormode
+    SetErrorMode(SEM_FAILCRITICALERRORS);
+#endif
+#if defined(LEAN_DAEMON_SUPPORT)
+    if (argc >= 2 && strncmp(argv[1], "--connect=", 10) == 0)
+        return run_daemon_client(argv[1] + 10, argc - 2, argv + 2);
+#endif
+    auto init_start = std::chrono::steady_clock::now();
+    ::initializer init;
+    second_duration init_time = std::chrono::steady_clock::now() - init_start;
+    return lean_main(argc, argv, init_time);
+}
@@ -0,0 +1,20 @@
+#lang lean4
+/- Arithmetic on natural numbers and integers just above 2^63, where every operation leaves the scalar fast path. -/
+
+def modulus : Nat := 18446744073709551557 -- 2^64 - 59
+def mult : Nat := 6364136223846793005
+
+def loop : Nat → Nat → Nat → Int → Nat × Nat × Int
+| 0,   x, s, d => (x, s, d)
+| n+1, x, s, d =>
+  let x := (x * mult + 1442695040888963407) % modulus;
+  let d := if x % 2 == 0 then d + Int.ofNat x else d - Int.ofNat x;
+  loop n x (s + x / 3) d
+
+def main (xs : List String) : IO UInt32 := do
+let n := xs.head!.toNat!;
+let (x, s, d) := loop n (2^63 + 12345) 0 0;
+IO.println x;
+IO.println s;
+IO.println d;
+pure 0
@@ -0,0 +1,216 @@
+#!/usr/bin/env python3
+"""Frontend, kernel and compiler throughput on representative stdlib modules.
+
+    stdlib_bench.py run [--lean LEAN] [--runs N] [-o OUT.json] [MODULE...]
+    stdlib_bench.py compare BASE.json NEW.json [--threshold PCT] [--alpha P] [-o OUT.json]
+
+`run` re-elaborates each module of the stdlib of the given `lean` executable, writing the .olean and C files to a
+temporary directory, and then imports the module from the stdlib. The times reported by `-Dprofiler=true` are
+recorded per category together with the wall-clock time, the peak RSS and the elaboration time of each command.
+`compare` applies Welch's t-test to each metric of two result files, and fails if any metric regressed
+significantly. Only the Python standard library is required, in contrast to the temci-based suites in this folder.
+"""
+
+import argparse
+import json
+import math
+import os
+import re
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+MODULES = [
+    'Init.Data.Array.Basic',
+    'Std.Data.RBMap',
+    'Lean.Parser.Term',
+    'Lean.Meta.ExprDefEq',
+    'Lean.Elab.App',
+]
+
+# profiler categories, see `profileit` and `time_task`
+CATEGORIES = {
+    'import': 'import',
+    'parsing': 'parsing',
+    'elaboration': 'elaboration',
+    'typeclass inference': 'typeclass inference',
+    'type checking': 'kernel',
+    'compilation': 'compilation',
+    'C code generation': 'C code generation',
+    '.olean serialization': '.olean write',
+}
+
+def parse_time(num, unit):
+    return float(num) * (1e-3 if unit == 'ms' else 1)
+
+def parse_profile(out):
+    """Return the cumulative times per category, and the elaboration times of the individual commands."""
+    cum = {}
+    _, sep, tail = out.partition('cumulative profiling times:\n')
+    if sep:
+        for m in re.finditer(r'^\t(.+) (-?[\d.e+]+)(m?s)$', tail, re.MULTILINE):
+            cum[m.group(1)] = parse_time(m.group(2), m.group(3))
+    cmds = [parse_time(m.group(1), m.group(2))
+            for m in re.finditer(r'^elaboration took (-?[\d.e+]+)(m?s)$', out, re.MULTILINE)]
+    return cum, cmds
+
+def run_lean(lean, args, cwd, env):
+    """Run `lean` with the profiler enabled, and return its output, wall-clock time and peak RSS in MB."""
+    start = time.perf_counter()
+    p = subprocess.Popen([lean, '-Dprofiler=true', '-Dprofiler.threshold=0'] + args, cwd=cwd, env=env,
+                         stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+    out = p.stdout.read()
+    _, status, rusage = os.wait4(p.pid, 0)
+    wall = time.perf_counter() - start
+    p.returncode = os.waitstatus_to_exitcode(status)
+    p.stdout.close()
+    if p.returncode != 0:
+        sys.exit(f"'{lean} {' '.join(args)}' failed:\n{out}")
+    return out, wall, rusage.ru_maxrss / 1024
+
+def measure(lean, src_dir, mod, tmp):
+    samples = {}
+    src = os.path.join(*mod.split('.')) + '.lean'
+    base = os.path.join(tmp, mod)
+    out, wall, maxrss = run_lean(lean, ['-o', base + '.olean', f'--c={base}.c', src], src_dir, os.environ)
+    cum, cmds = parse_profile(out)
+    samples['wall'] = wall
+    samples['peak RSS [MB]'] = maxrss
+    for cat, name in CATEGORIES.items():
+        samples[name] = cum.get(cat, 0.0)
+    samples['elaboration per command (median)'] = statistics.median(cmds) if cmds else 0.0
+    samples['elaboration per command (max)'] = max(cmds) if cmds else 0.0
+    samples['.olean size [KB]'] = os.path.getsize(base + '.olean') / 1024
+    # LEAN_PATH maps packages to directories, so read the .olean files of the module and its imports from the stdlib
+    with open(os.path.join(tmp, 'Bench.lean'), 'w') as f:
+        f.write(f'import {mod}\n')
+    out, _, _ = run_lean(lean, ['Bench.lean'], tmp, os.environ)
+    cum, _ = parse_profile(out)
+    samples['.olean read'] = cum.get('import', 0.0)
+    return samples
+
+def run(args):
+    lean = shutil.which(args.lean) or sys.exit(f"'{args.lean}' not found")
+    lean = os.path.abspath(lean)
+    src_dir = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', '..', 'src')
+    version = subprocess.run([lean, '--version'], stdout=subprocess.PIPE, universal_newlines=True).stdout.strip()
+    result = {'lean': lean, 'version': version, 'runs': args.runs, 'benchmarks': {}}
+    for mod in args.modules or MODULES:
+        bench = result['benchmarks'][mod] = {}
+        for i in range(args.runs):
+            print(f'{mod} ({i + 1}/{args.runs})', file=sys.stderr)
+            with tempfile.TemporaryDirectory() as tmp:
+                for metric, value in measure(lean, src_dir, mod, tmp).items():
+                    bench.setdefault(metric, []).append(value)
+    write_json(result, args.output)
+
+# Welch's t-test
+
+def betacf(a, b, x):
+    """Continued fraction of the incomplete beta function (Numerical Recipes)."""
+    tiny = 1e-300
+    c, d = 1.0, 1.0 - (a + b) * x / (a + 1)
+    d = 1 / (d if abs(d) > tiny else tiny)
+    h = d
+    for m in range(1, 300):
+        for num in (m * (b - m) * x / ((a + 2 * m - 1) * (a + 2 * m)),
+                    -(a + m) * (a + b + m) * x / ((a + 2 * m) * (a + 2 * m + 1))):
+            d = 1 + num * d
+            d = 1 / (d if abs(d) > tiny else tiny)
+            c = 1 + num / c
+            c = c if abs(c) > tiny else tiny
+            h *= d * c
+        if abs(d * c - 1) < 1e-12:
+            break
+    return h
+
+def betainc(a, b, x):
+    """Regularized incomplete beta function I_x(a, b)."""
+    if x <= 0 or x >= 1:
+        return max(0.0, min(1.0, x))
+    lbt = math.lgamma(a + b) - math.lgamma(a) - math.lgamma(b) + a * math.log(x) + b * math.log(1 - x)
+    if x < (a + 1) / (a + b + 2):
+        return math.exp(lbt) * betacf(a, b, x) / a
+    return 1 - math.exp(lbt) * betacf(b, a, 1 - x) / b
+
+def welch_p_value(xs, ys):
+    """Two-sided p-value of the hypothesis that `xs` and `ys` have the same mean, or `None` for too few samples."""
+    if len(xs) < 2 or len(ys) < 2:
+        return None
+    vx, vy = statistics.variance(xs) / len(xs), statistics.variance(ys) / len(ys)
+    diff = statistics.mean(xs) - statistics.mean(ys)
+    if vx + vy == 0:
+        return 1.0 if diff == 0 else 0.0
+    t = diff / math.sqrt(vx + vy)
+    df = (vx + vy) ** 2 / (vx ** 2 / (len(xs) - 1) + vy ** 2 / (len(ys) - 1))
+    return betainc(df / 2, 0.5, df / (df + t * t))
+
+def compare(args):
+    base, new = load_json(args.base), load_json(args.new)
+    pairs = [(mod, metric, base['benchmarks'][mod][metric], ys)
+             for mod, metrics in new['benchmarks'].items() if mod in base['benchmarks']
+             for metric, ys in metrics.items() if base['benchmarks'][mod].get(metric)]
+    # Bonferroni correction, otherwise comparing a build with itself reports one regression per 1/alpha metrics
+    alpha = args.alpha / max(len(pairs), 1)
+    result = {'base': base.get('version'), 'new': new.get('version'), 'alpha': alpha, 'benchmarks': {}}
+    regressions = 0
+    print(f"{'benchmark':<24} {'metric':<34} {'base':>10} {'new':>10} {'change':>8} {'p':>9}")
+    for mod, metric, xs, ys in pairs:
+        mx, my = statistics.mean(xs), statistics.mean(ys)
+        change = (my - mx) / mx * 100 if mx else 0.0
+        p = welch_p_value(xs, ys)
+        verdict = 'unchanged'
+        if p is not None and p < alpha and abs(change) >= args.threshold:
+            verdict = 'regression' if change > 0 else 'improvement'
+        regressions += verdict == 'regression'
+        result['benchmarks'].setdefault(mod, {})[metric] = {
+            'base': mx, 'new': my,
+            'base stddev': statistics.stdev(xs) if len(xs) > 1 else 0.0,
+            'new stddev': statistics.stdev(ys) if len(ys) > 1 else 0.0,
+            'change [%]': change, 'p': p, 'verdict': verdict}
+        mark = {'regression': ' !!', 'improvement': ' ++'}.get(verdict, '')
+        p = '-' if p is None else f'{p:.2g}'
+        print(f"{mod:<24} {metric:<34} {mx:>10.4g} {my:>10.4g} {change:>+7.1f}% {p:>9}{mark}")
+    print(f'{regressions} significant regression(s) at alpha = {args.alpha} / {len(pairs)}')
+    result['regressions'] = regressions
+    if args.output:
+        write_json(result, args.output)
+    return 1 if regressions else 0
+
+def load_json(fn):
+    with open(fn) as f:
+        return json.load(f)
+
+def write_json(data, fn):
+    if fn:
+        with open(fn, 'w') as f:
+            json.dump(data, f, indent=2)
+            f.write('\n')
+    else:
+        json.dump(data, sys.stdout, indent=2)
+        print()
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest='cmd')
+    p = sub.add_parser('run', help='measure a build of Lean')
+    p.add_argument('--lean', default='lean', help='`lean` executable, its stdlib is used for the imports')
+    p.add_argument('--runs', type=int, default=5)
+    p.add_argument('-o', '--output', help='JSON output file, stdout by default')
+    p.add_argument('modules', nargs='*', help=f"stdlib modules, default: {' '.join(MODULES)}")
+    p = sub.add_parser('compare', help='compare the results of two builds')
+    p.add_argument('base')
+    p.add_argument('new')
+    p.add_argument('--threshold', type=float, default=3.0, help='minimal relative change in percent to report')
+    p.add_argument('--alpha', type=float, default=0.05, help='significance level')
+    p.add_argument('-o', '--output', help='JSON output file')
+    args = parser.parse_args()
+    if args.cmd == 'run':
+        run(args)
+    elif args.cmd == 'compare':
+        sys.exit(compare(args))
+    else:
+        parser.print_help()
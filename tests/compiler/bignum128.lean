@@ -0,0 +1,17 @@
+#lang lean4
+def big (k : Nat) : Nat := 2^k
+
+def main (xs : List String) : IO UInt32 := do
+let n := xs.length;
+let a := big (63 + n) + 5;
+let b := big (127 + n) - 1;
+IO.println (a + a, b + 1, b + b, (b + 1) - b, a - b, b - a);
+IO.println (a * a, a * (big 64), b * 3, b / a, b % a, a / b, (b * b) % a);
+IO.println (decide (a < b), decide (b ≤ a), a == a + 0, b == b + 1);
+IO.println (big 62 * 4, (big 127) / 7, (big 128 + 9) % (big 64));
+let i : Int := Int.ofNat b;
+let j : Int := -Int.ofNat a;
+IO.println (i + j, j - i, i * j, j * j, i / j, i % j, j / 3, j % 7);
+IO.println (i + i, -i - i, (i + 1) - 1 == i, decide (j < i), decide (i ≤ j));
+IO.println ((Int.ofNat (big 126)) * (-2), (Int.ofNat (big 126)) * 2);
+pure 0
@@ -0,0 +1,11 @@
+#include <lean/lean.h>
+
+extern "C" lean_object * lean_test_set_deferred_free(uint32_t budget, uint32_t alloc_budget, uint8_t background, lean_object * /* w */) {
+    lean_set_deferred_free(budget, alloc_budget, background);
+    return lean_io_result_mk_ok(lean_box(0));
+}
+
+extern "C" lean_object * lean_test_flush_deferred(lean_object * /* w */) {
+    lean_flush_deferred();
+    return lean_io_result_mk_ok(lean_box(0));
+}
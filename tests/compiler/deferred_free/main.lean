@@ -0,0 +1,46 @@
+#lang lean4
+import Lean.Environment
+open Lean
+
+@[extern "lean_test_set_deferred_free"] constant setDeferredFree (budget allocBudget : UInt32) (background : Bool) : IO Unit
+@[extern "lean_test_flush_deferred"] constant flushDeferred : IO Unit
+
+@[noinline] def mkList (n : Nat) : List Nat :=
+List.range n
+
+@[noinline] def mkPairs (data : ModuleData) (n : Nat) : List (Nat × ModuleData) :=
+(List.range n).map fun i => (i, data)
+
+/- `lean_del` frees at most 16 objects, and the remaining ones are freed by the following allocations. -/
+def testBudget : IO Unit := do
+setDeferredFree 16 16 false
+let sums := (List.range 20).map fun i => (mkList (10000 + i)).foldl (· + ·) 0
+IO.println (sums.foldl (· + ·) 0)
+flushDeferred
+
+/- Task results are multi-threaded, and big dead multi-threaded lists are freed by the background thread. -/
+def testBackground : IO Unit := do
+setDeferredFree 16 16 true
+let ts := (List.range 8).map fun i => Task.spawn fun _ => mkList (10000 + i)
+let sums := ts.map fun t => t.get.foldl (· + ·) 0
+IO.println (sums.foldl (· + ·) 0)
+flushDeferred
+
+/- The dead pairs point into the region, and they are still in the queue of the worker thread when we free the
+   region. Thus, the region must only be freed after the worker has freed them. -/
+unsafe def testRegion : IO Unit := do
+setDeferredFree 16 16 false
+saveModuleData "build/region.olean" { imports := #[], constants := #[], entries := #[] }
+let (data, region) ← readModuleData "build/region.olean"
+let n := (Task.spawn fun _ => (mkPairs data 10000).length).get
+region.free
+let flushes ← (List.range 8).mapM fun _ => IO.asTask flushDeferred
+flushes.forM fun t => IO.ofExcept t.get
+let ts := (List.range 8).map fun i => Task.spawn fun _ => (mkList (10000 + i)).foldl (· + ·) 0
+IO.println (n, (ts.map Task.get).foldl (· + ·) 0)
+
+unsafe def main : List String → IO Unit
+| ["budget"]     => testBudget
+| ["background"] => testBackground
+| ["region"]     => testRegion
+| _              => throw $ IO.userError "usage: test (budget|background|region)"
@@ -0,0 +1,23 @@
+#lang lean4
+import Std.Data.FlatHashMap
+open Std
+
+abbrev Map := FlatHashMap Nat Nat
+
+def main : IO Unit := do
+let m₀ : Map := {};
+let m := (List.range 5000).foldl (fun (m : Map) i => m.insert (i*37) i) m₀;
+-- `m'` is a copy of `m`, which is still used below
+let m' := (List.range 2500).foldl (fun (m : Map) i => m.erase (i*74)) m;
+IO.println (m.size, m'.size, m.capacity);
+IO.println ((List.range 5000).all fun i => m.find? (i*37) == some i);
+IO.println ((List.range 5000).all fun i => m'.find? (i*37) == (if i % 2 == 0 then none else some i));
+IO.println (m'.contains 37, m'.contains 74, m'.contains 38);
+IO.println (m'.fold (fun s _ v => s + v) 0);
+-- reuse deleted slots
+let m'' := (List.range 10000).foldl (fun (m : Map) i => (m.insert (i*128) i).erase (i*128)) m';
+IO.println (m''.size, m''.capacity, m''.findD 37 0, m''.find! 111);
+let m'' := m''.insert 37 100;
+IO.println (m''.size, m''.find? 37, m''.findEntry? 111);
+let s : FlatHashMap String Nat := (List.range 100).foldl (fun (s : FlatHashMap String Nat) i => s.insert (toString i) i) {};
+IO.println (s.toList.length, s.toArray.size, s.find? "42", s.find? "100", s.isEmpty, (mkFlatHashMap : Map).isEmpty)
@@ -0,0 +1,23 @@
+#lang lean4
+import Std.Data.HashMap
+open Std
+
+def mkKey (i : Nat) : String :=
+"some/long/prefix/shared/by/all/keys/in/the/map/" ++ toString i
+
+def main (xs : List String) : IO UInt32 := do
+let m : HashMap String Nat := (List.range 1000).foldl (fun m i => m.insert (mkKey i) i) {};
+IO.println ((List.range 1000).all fun i => m.find? (mkKey i) == some i);
+IO.println (m.find? "missing");
+let m : HashMap String.Hash64 Nat := (List.range 1000).foldl (fun m i => m.insert ⟨mkKey i⟩ i) {};
+IO.println ((List.range 1000).all fun i => m.find? ⟨mkKey i⟩ == some i);
+IO.println (m.find? ⟨"missing"⟩);
+let s := "hello world, αβγ";
+IO.println (s.hash64 == (String.mk s.data).hash64);
+IO.println (s.hash64 == s.toSubstring.hash64);
+IO.println ((s.toSubstring.drop 6).hash64 == (s.drop 6).hash64);
+IO.println ("".hash64 == "".toSubstring.hash64);
+IO.println (s.hash64 != (s.push 'x').hash64);
+IO.println (s.toUTF8.hash == s.hash64);
+IO.println ((ByteArray.mk #[1, 2, 3]).hash != (ByteArray.mk #[1, 2, 4]).hash);
+pure 0
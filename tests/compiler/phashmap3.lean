@@ -14,7 +14,7 @@ partial def formatMap : Node Nat Nat → Format
       let p := if i > 0 then fmt ++ format "," ++ Format.line else fmt;
       p ++ "c@" ++ Format.paren (format k ++ " => " ++ format v))
     Format.nil
-| Node.entries entries        => Format.sbracket $
+| Node.entries _ entries      => Format.sbracket $
   entries.size.fold
     (fun i fmt =>
       let entry := entries.get! i;
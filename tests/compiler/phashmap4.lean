@@ -0,0 +1,20 @@
+#lang lean4
+import Std.Data.PersistentHashMap
+open Std
+
+abbrev Map := PersistentHashMap Nat Nat
+
+def main : IO Unit := do
+IO.println ((#[1, 2, 3].insertAt 0 0).insertAt 4 4);
+IO.println ((#[1, 2, 3].insertAt 1 10).insertAt 3 20);
+IO.println ([0, 1, 0xff, 0x80000001, 0xffffffff].map fun (n : Nat) => (n.toUInt32.popcount));
+let m₀ : Map := {};
+let m := (List.range 5000).foldl (fun (m : Map) i => m.insert (i*37) i) m₀;
+-- `m'` shares nodes with `m`
+let m' := (List.range 2500).foldl (fun (m : Map) i => m.erase (i*74)) m;
+IO.println ((List.range 5000).all fun i => m.find? (i*37) == some i);
+IO.println ((List.range 5000).all fun i => m'.find? (i*37) == (if i % 2 == 0 then none else some i));
+IO.println (m'.contains 37, m'.contains 74, m'.contains 38);
+IO.println (m'.foldl (fun s _ v => s + v) 0);
+IO.println m.stats;
+IO.println m'.stats
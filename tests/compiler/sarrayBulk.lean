@@ -0,0 +1,29 @@
+#lang lean4
+def bytes (n : Nat) : ByteArray :=
+(List.range n).foldl (fun a i => a.push (UInt8.ofNat (i % 7))) ByteArray.empty
+
+def floats (n : Nat) : FloatArray :=
+(List.range n).foldl (fun a i => a.push (Float.ofNat i)) FloatArray.empty
+
+def main (xs : List String) : IO UInt32 := do
+let a := bytes 20;
+IO.println a;
+IO.println (a.fill 3 8 255);
+IO.println (a.fill 18 100 9);
+IO.println (a.fill 5 2 9 == a);
+IO.println (a.indexOf? 6);
+IO.println (a.indexOf? 6 7);
+IO.println (a.indexOf? 6 19);
+IO.println (a.indexOf? 42);
+IO.println (a.extract 2 6 ++ a.extract 15 30);
+IO.println (a.copySlice 0 (bytes 3) 1 4);
+IO.println (a == bytes 20, a == bytes 21, a == a.set! 3 0);
+IO.println (decide (bytes 5 < bytes 6), decide (bytes 6 < bytes 5), decide (a.set! 3 0 < a), decide (a < a));
+let f := floats 11;
+IO.println (f.extract 8 20 ++ f.extract 0 2);
+IO.println f.sum;
+IO.println (f.dot f);
+IO.println (f.dot (floats 3));
+IO.println ((f.map (· * 2)).sum);
+IO.println FloatArray.empty.sum;
+pure 0
@@ -0,0 +1,17 @@
+#lang lean4
+import Std.ShareCommon
+open Std.ShareCommon
+
+@[noinline] def mkList (n : Nat) : List Nat :=
+(List.range n).map (· + 1)
+
+unsafe def main (xs : List String) : IO UInt32 := do
+let s ← mkConcurrentState;
+let ts := (List.range 8).map fun _ => Task.spawn fun _ => s.shareCommon (mkList 100);
+let ls := ts.map Task.get;
+let l := mkList 100;
+IO.println (ls.all fun l' => ptrAddrUnsafe l' == ptrAddrUnsafe (s.shareCommon l));
+IO.println (ptrAddrUnsafe l == ptrAddrUnsafe (s.shareCommon l));
+IO.println (ptrAddrUnsafe (s.shareCommon ((List.range 3).map (· + 98))) == ptrAddrUnsafe ((s.shareCommon l).drop 97));
+IO.println (s.shareCommon (mkList 5));
+pure 0
@@ -0,0 +1,16 @@
+#lang lean4
+import Std.ShareCommon
+open Std.ShareCommon
+
+@[noinline] def mkList (n : Nat) : List Nat :=
+(List.range n).map (· + 1)
+
+/- `s` is marked as multi-threaded after it has been populated, when it crosses the `Task` boundary. -/
+unsafe def main (xs : List String) : IO UInt32 := do
+let s ← mkConcurrentState;
+let l := s.shareCommon (mkList 100);
+let t := Task.spawn fun _ => ptrAddrUnsafe (s.shareCommon (mkList 100)) == ptrAddrUnsafe l;
+IO.println t.get;
+IO.println (ptrAddrUnsafe (s.shareCommon (mkList 100)) == ptrAddrUnsafe l);
+IO.println (s.shareCommon (mkList 100)).length;
+pure 0
@@ -0,0 +1,11 @@
+set_option compiler.share_specializations true
+
+def sum (xs : List Nat) : Nat :=
+xs.foldl (· + ·) 0
+
+def sumSq (xs : List Nat) : Nat :=
+xs.foldl (fun acc x => acc + x*x) 0
+
+def main : IO Unit := do
+ IO.println (toString (sum (List.range 100)))
+ IO.println (toString (sumSq (List.range 100)))
@@ -0,0 +1,5 @@
+import ShareSpec.A
+import ShareSpec.B
+
+def main : IO Unit :=
+  IO.println s!"{ShareSpec.sumA (List.range 100)} {ShareSpec.sumB (List.range 100)}"
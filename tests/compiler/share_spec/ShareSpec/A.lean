@@ -0,0 +1,8 @@
+set_option compiler.share_specializations true
+
+namespace ShareSpec
+
+def sumA (xs : List Nat) : Nat :=
+xs.foldl (· + ·) 0
+
+end ShareSpec
@@ -0,0 +1,17 @@
+def primes : List Nat := [2, 3, 5, 7, 11, 13]
+def names : Array String := #["α", "b\"c", "d\\e", "??=", "\x01f"]
+def table : Array (Option (Nat × String)) := #[some (1, "one"), none, some (2, "two")]
+def empty : Array Nat := #[]
+def flags : Array UInt8 := #[1, 255]
+def big : Nat := 100000000000000000000
+
+def main : IO Unit := do
+  IO.println primes
+  IO.println (names.map String.length)
+  IO.println (names.map String.utf8ByteSize)
+  IO.println (names[0] ++ "!")
+  IO.println table
+  IO.println ((empty.push 1).push 2)
+  IO.println (names.push "g").size
+  IO.println (flags.map UInt8.toNat)
+  IO.println big
@@ -0,0 +1,34 @@
+#lang lean4
+def block (c : Char) (n : Nat) : String :=
+(List.range n).foldl (fun s _ => s.push c) ""
+
+def main (xs : List String) : IO UInt32 := do
+let a := block 'a' 300;
+let b := block 'β' 200;
+-- `a` and `b` are shared, so the appends below produce concatenation nodes
+let s := a ++ b ++ a ++ b;
+IO.println s.length;
+IO.println s.utf8ByteSize;
+IO.println (s.get 300);
+IO.println (s.get 1000);
+IO.println (s == (a ++ b) ++ (a ++ b));
+IO.println (s.hash == ((a ++ b) ++ (a ++ b)).hash);
+IO.println (decide (a ++ b < a ++ a));
+-- slices
+let t := s.extract 200 1100;
+IO.println t.length;
+IO.println (t.take 3 ++ t.drop (t.length - 3));
+let u := t.extract 100 800;
+IO.println u.length;
+IO.println (u == (s.extract 300 1000));
+-- push and set on shared ropes
+let v := s.push '!';
+IO.println (v.length, s.length);
+IO.println (v.get (v.utf8ByteSize - 1));
+let w := t.set 0 'x';
+IO.println (w.take 2, t.take 2);
+-- flatten concurrently
+let tasks := (List.range 4).map fun i => Task.spawn fun _ => (s ++ toString i).length;
+IO.println (tasks.map Task.get);
+IO.println ((block 'z' 5 ++ s).length);
+pure 0
@@ -0,0 +1,21 @@
+#lang lean4
+def longLine (n : Nat) : String :=
+(List.range n).foldl (fun s i => s ++ toString (i % 10)) ""
+
+def main (xs : List String) : IO UInt32 := do
+let s := longLine 100 ++ "αβγ" ++ longLine 50 ++ "needle" ++ longLine 20;
+IO.println s.length;
+IO.println (s.findSubstr "needle");
+IO.println (s.findSubstr "needle" 160);
+IO.println (s.findSubstr "αβγ");
+IO.println (s.findSubstr "βγ0");
+IO.println (s.findSubstr "absent");
+IO.println (s.findSubstr "" 3);
+IO.println ("a\nbc\r\n\nd".lines);
+IO.println ("".lines);
+IO.println ("x\n".lines);
+IO.println (String.validateUTF8 s.toUTF8);
+IO.println (String.validateUTF8 (ByteArray.mk #[0x61, 0xc3]));
+IO.println (String.validateUTF8 (ByteArray.mk #[0xed, 0xa0, 0x80]));
+IO.println (String.fromUTF8? (ByteArray.mk #[0xce, 0xb1, 0x62]));
+pure 0
@@ -0,0 +1,15 @@
+#lang lean4
+def compute (v : Nat) : Thunk Nat :=
+⟨fun _ => let xs := List.replicate 1000000 v; xs.foldl Nat.add 0⟩
+
+@[noinline]
+def test (t : Thunk Nat) (n : Nat) : List (Task Nat) :=
+(List.range n).map fun i => if i % 2 == 0 then t.getAsync else Task.spawn fun _ => t.get + i
+
+def main (xs : List String) : IO UInt32 := do
+let ts := test (compute 1) 16;
+IO.println (toString (ts.foldl (fun r t => r + t.get) 0));
+let t := compute 2;
+IO.println (toString t.get);
+IO.println (toString t.getAsync.get);
+pure 0
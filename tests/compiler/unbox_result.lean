@@ -0,0 +1,32 @@
+structure Vec2 :=
+(x : Float)
+(y : Float)
+
+@[noinline] def Vec2.add (a b : Vec2) : Vec2 :=
+⟨a.x + b.x, a.y + b.y⟩
+
+structure Pair :=
+(fst : UInt64)
+(snd : UInt64)
+
+@[noinline] def divMod (a b : UInt64) : Pair :=
+⟨a / b, a % b⟩
+
+@[noinline] def split (x : Float) : Float × Float :=
+(x * 2, x + 1)
+
+def total : Nat → Float → Float
+| 0,   acc => acc
+| n+1, acc =>
+  let p := split n.toFloat
+  total n (acc + p.1 + p.2)
+
+def main : IO Unit := do
+ let v := Vec2.add ⟨1, 2⟩ ⟨3, 4⟩
+ IO.println v.x
+ IO.println v.y
+ let r := divMod 17 5
+ IO.println r.fst
+ IO.println r.snd
+ IO.println (total 10 0)
+ IO.println (split 3)
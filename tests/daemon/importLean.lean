@@ -0,0 +1,8 @@
+import Lean
+open Lean
+
+#eval toString `foo.bar
+
+def f (n : Nat) : Nat := n + 1
+
+#eval f 41
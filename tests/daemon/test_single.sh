@@ -0,0 +1,20 @@
+#!/usr/bin/env bash
+source ../common.sh
+
+sock=$(mktemp -u "${TMPDIR:-/tmp}/lean_daemon.XXXXXX")
+lean --daemon="$sock" &
+daemon=$!
+trap 'kill $daemon; rm -f "$sock"' EXIT
+for i in $(seq 100); do
+    [ -S "$sock" ] && break
+    sleep 0.1
+done
+
+# The second request reuses the environment imported by the first one
+function process_twice {
+    lean --connect="$sock" "$f" || true
+    lean --connect="$sock" "$f"
+}
+
+exec_check process_twice
+diff_produced
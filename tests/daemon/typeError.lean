@@ -0,0 +1 @@
+def x : Nat := "hello"
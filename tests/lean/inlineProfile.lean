@@ -0,0 +1,27 @@
+/- `inlineProfile.prof` is a call count profile, see `LEAN_PROFILE_CALL` in `lean.h`. -/
+set_option compiler.profile "inlineProfile.prof"
+set_option trace.compiler.inline_hot true
+
+def hotSmall (x : Nat) : Nat :=
+x * x + 3
+
+@[inline] def coldLarge (x : Nat) : String :=
+match x with
+| 0 => "zero"
+| 1 => "one"
+| 2 => "two"
+| 3 => "three"
+| 4 => "four"
+| 5 => "five"
+| 6 => "six"
+| 7 => "seven"
+| 8 => "eight"
+| _ => toString x ++ "!" ++ toString (x + 1) ++ "!" ++ toString (x + 2)
+
+-- `hotCaller` is hot, `hotSmall` and `coldLarge` are inlined
+def hotCaller (x : Nat) : String :=
+coldLarge (hotSmall x)
+
+-- `coldCaller` is not in the profile, `coldLarge` is not inlined
+def coldCaller (x : Nat) : String :=
+coldLarge x
@@ -0,0 +1,46 @@
+open IO.FS
+
+def check_eq {α} [BEq α] [Repr α] (tag : String) (expected actual : α) : IO Unit :=
+unless expected == actual do throw $ IO.userError $
+  s!"assertion failure \"{tag}\":\n  expected: {repr expected}\n  actual:   {repr actual}"
+
+def bytes (a : ByteArray) : List Nat :=
+a.toList.map UInt8.toNat
+
+def longLine : String := (List.replicate 100000 'x').asString
+
+def testLines : IO Unit := do
+let fn := "fd_test.txt"
+let h ← FdHandle.mk fn Mode.write
+h.putStrLn "hello"
+h.putStr "α"
+h.putStrLn longLine
+h.putStr "no newline"
+h.flush
+let h ← FdHandle.mk fn Mode.read
+check_eq "1" "hello\n" (← h.getLine)
+check_eq "2" ("α" ++ longLine ++ "\n") (← h.getLine)
+check_eq "3" false (← h.isEof)
+check_eq "4" "no newline" (← h.getLine)
+check_eq "5" "" (← h.getLine)
+check_eq "6" true (← h.isEof)
+
+def testBytes : IO Unit := do
+let fn := "fd_test.txt"
+let h ← FdHandle.mk fn Mode.write
+h.write ⟨#[1, 2, 3, 4, 5, 6, 7, 8]⟩
+h.flush
+let h ← FdHandle.mk fn Mode.readWrite
+check_eq "1" [1, 2, 3] (bytes (← h.read 3))
+let buf ← h.readToByteArray (ByteArray.mkEmpty 16) 2
+let buf ← h.readToByteArray buf 10
+check_eq "2" [4, 5, 6, 7, 8] (bytes buf)
+check_eq "3" [3, 4] (bytes (← h.pread 2 2))
+h.pwrite 6 ⟨#[70, 80, 90]⟩
+check_eq "4" [6, 70, 80, 90] (bytes (← h.pread 5 10))
+let tasks ← (List.range 4).mapM fun i => h.preadAsync i.toUInt64 2
+let rs ← tasks.mapM fun t => IO.ofExcept t.get
+check_eq "5" [[1, 2], [2, 3], [3, 4], [4, 5]] (rs.map bytes)
+
+#eval testLines
+#eval testBytes
@@ -0,0 +1,16 @@
+import Lean.Meta
+open Lean
+open Lean.Meta
+
+/- The hash codes of string literals are stored in .olean files, they must match the ones of new literals. -/
+def isComma : Expr → Bool
+  | Expr.lit (Literal.strVal ",") _ => true
+  | _                               => false
+
+def tst : MetaM Unit := do
+let some info ← pure ((← getEnv).find? `Lean.List.format) | throwError "unknown constant"
+let some lit ← pure (info.value?.bind (·.find? isComma)) | throwError "literal not found"
+unless lit == mkStrLit "," do throwError "imported literal is not equal to `mkStrLit \",\"`"
+unless lit.hash == (mkStrLit ",").hash do throwError "hash codes do not match"
+
+#eval tst
@@ -0,0 +1,30 @@
+open IO.FS
+
+def check_eq {α} [BEq α] [Repr α] (tag : String) (expected actual : α) : IO Unit :=
+unless expected == actual do throw $ IO.userError $
+  s!"assertion failure \"{tag}\":\n  expected: {repr expected}\n  actual:   {repr actual}"
+
+def contents : String :=
+"αβγ\n" ++ (List.replicate 100000 'x').asString
+
+def testMmap : IO Unit := do
+let fn := "mmap_test.txt"
+let h ← Handle.mk fn Mode.write
+h.putStr contents
+h.flush
+let a ← mmap fn
+check_eq "size" contents.utf8ByteSize a.size
+check_eq "get" 'x'.toNat (a.get! 50000).toNat
+check_eq "fromUTF8" (some contents) (String.fromUTF8? a)
+let b := a.set! 0 65
+check_eq "set" 65 (b.get! 0).toNat
+check_eq "shared" 0xce (a.get! 0).toNat
+let c := a.push 10
+check_eq "push" (a.size + 1) c.size
+let d ← mmap fn
+let d := d.set! 1 66
+check_eq "exclusive set" 66 (d.get! 1).toNat
+check_eq "unchanged" contents (← readFile fn)
+check_eq "empty" 0 (← (do let _ ← Handle.mk fn Mode.write; mmap fn)).size
+
+#eval testMmap
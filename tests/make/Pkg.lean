@@ -0,0 +1,5 @@
+import Pkg.A
+import Pkg.B
+
+def main : IO Unit :=
+  IO.println s!"{Pkg.a} {Pkg.b}"
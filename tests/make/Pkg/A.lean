@@ -0,0 +1,3 @@
+import Pkg.Base
+
+def Pkg.a : String := Pkg.greeting ++ ", A"
@@ -0,0 +1,3 @@
+import Pkg.Base
+
+def Pkg.b : String := Pkg.greeting ++ ", B"
@@ -0,0 +1 @@
+def Pkg.greeting : String := "hello"
@@ -0,0 +1,10 @@
+import Lean
+import Pkg.A
+open Lean
+
+#eval Pkg.a
+
+/- The .olean file of `Pkg.A` is already mapped at its base address, so it must be relocated when it is imported again. -/
+#eval show IO Unit from do
+  let env ← importModules [{ module := `Pkg.A }] {}
+  IO.println (env.contains `Pkg.a && env.contains `Pkg.greeting)
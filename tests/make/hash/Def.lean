@@ -0,0 +1,3 @@
+def f (n : Nat) : Nat := 0 + n
+
+theorem f_eq (n : Nat) : f n = n := Nat.zeroAdd n
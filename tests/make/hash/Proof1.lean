@@ -0,0 +1,3 @@
+def f (n : Nat) : Nat := n + 0
+
+theorem f_eq (n : Nat) : f n = n := rfl
@@ -0,0 +1 @@
+def P.f (n : Nat) : Nat := n + 1
@@ -0,0 +1,3 @@
+import Trans.A
+
+def P.g (n : Nat) : Nat := 2 * n
@@ -0,0 +1,3 @@
+import Trans.B
+
+theorem P.c : P.f 3 = 3 := rfl
@@ -0,0 +1 @@
+import Trans.C
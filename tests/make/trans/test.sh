@@ -0,0 +1,16 @@
+#!/usr/bin/env bash
+# `Trans.C` only imports `Trans.A` through `Trans.B`, and must be rebuilt when the interface of `Trans.A` changes.
+set -e
+rm -rf build
+mkdir -p build/src/Trans
+cp Trans.lean build/src
+cp A1.lean build/src/Trans/A.lean
+cp B.lean C.lean build/src/Trans
+cd build/src
+lean --make --o=../out Trans.lean
+cp ../../A2.lean Trans/A.lean
+if lean --make --o=../out Trans.lean > ../make.log 2>&1; then
+    echo "error: 'Trans.C' was not rebuilt"
+    exit 1
+fi
+grep -q "type mismatch" ../make.log